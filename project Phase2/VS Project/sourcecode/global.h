@@ -59,7 +59,8 @@ typedef         int                             BOOL;
 #define         FALSE                           (BOOL)0
 #define         TRUE                            (BOOL)1
 
-#define         PHYS_MEM_PGS                    (short)64
+#define         PHYS_MEM_PGS                    (short)64   // default, Z502_PHYS_MEM_PGS in the environment overrides it
+#define         MAX_PHYS_MEM_PGS                (PTBL_PHYS_PG_NO + 1)
 #define         PGSIZE                          (short)16
 #define         PGBITS                          (short)4
 #define         VIRTUAL_MEM_PGS                 1024
@@ -85,10 +86,22 @@ typedef         int                             BOOL;
 #define         PTBL_REFERENCED_BIT             0x2000 //10000000000000 14 wei
 #define         PTBL_PHYS_PG_NO                 0x0FFF //111111111111   12 wei
 
+        /* The page table has two levels: Z502_PAGE_TBL_ADDR is a directory
+           of leaves, each leaf holds the entries of PTBL_LEAF_PGS pages, a
+           NULL leaf makes all its pages invalid                 */
+
+#define         PTBL_LEAF_BITS                  6
+#define         PTBL_LEAF_PGS                   (1 << PTBL_LEAF_BITS)
+#define         PTBL_DIR_SIZE                   ((VIRTUAL_MEM_PGS + PTBL_LEAF_PGS - 1) >> PTBL_LEAF_BITS)
+
         /*  The maximum number of disks we will support:        */
 
 #define         MAX_NUMBER_OF_DISKS             (short)12
 
+        /*  The most contiguous sectors one disk request moves  */
+
+#define         MAX_DISK_VECTOR                 (short)16
+
 
 /*      These are the memory mapped IO addresses                */
 
@@ -101,8 +114,8 @@ typedef         int                             BOOL;
 #define      Z502DiskSetID             Z502DiskSetSector+1
 #define      Z502DiskSetSector         Z502DiskSetBuffer+1
 #define      Z502DiskSetBuffer         Z502DiskSetAction+1
-#define      Z502DiskSetAction         Z502DiskSetup4+1
-#define      Z502DiskSetup4            Z502DiskStart+1
+#define      Z502DiskSetAction         Z502DiskSetCount+1
+#define      Z502DiskSetCount          Z502DiskStart+1
 #define      Z502DiskStart             Z502DiskStatus+1
 #define      Z502DiskStatus            Z502MEM_MAPPED_MIN+1
 #define      Z502MEM_MAPPED_MIN        0x7FF00000
@@ -167,6 +180,10 @@ typedef         int                             BOOL;
         /* Miscellaneous                                        */
 
 #define         NUM_LOGICAL_SECTORS                     (short)1600
+        // A disk has NUM_SYSTEM_SECTORS more after the ones a program
+        // can reach, the OS keeps its swap space there.
+#define         NUM_SYSTEM_SECTORS                      (short)512
+#define         NUM_DISK_SECTORS                        (short)(NUM_LOGICAL_SECTORS + NUM_SYSTEM_SECTORS)
 
 #define         SWITCH_CONTEXT_KILL_MODE                (short)0
 #define         SWITCH_CONTEXT_SAVE_MODE                (short)1
@@ -66,6 +66,8 @@ void   test2e( void );
 void   test2f( void );
 void   test2g( void );
 void   test2h( void );
+void   test2i( void );
+void   test2j( void );
 
 
 //                      ENTRIES in z502.c
@@ -85,5 +87,7 @@ void   Z502MakeContext( void **, void *, BOOL );
 void   Z502SwitchContext( BOOL, void ** );
 void   *Z502PrepareProcessForExecution( void );
 void   Z502MemoryReadModify( INT32, INT32, INT32, INT32 * );
+void   Z502InvalidateTLB( INT32 );
+void   Z502ReportCacheStats( INT32, INT32, INT32 );
 
 #endif // PROTOS_H_
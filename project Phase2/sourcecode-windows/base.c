@@ -40,7 +40,34 @@ are multiprocessing, interaction between these processes, and some simple error
 #include			 "stdlib.h"
 ///////////////////define the definition///////////////////
 #define			ProcessLimit				15 //the limit of the total number of process
-#define			MessageLimit				100 //list the message pool 100
+#define			PriorityLevels				100 //priority 0-99, the range checked in SYSNUM_CREATE_PROCESS
+#define			ProcessTableSize			100 //pid 0-99, the range checked in the process syscalls
+#define			NameHashSize				32 //buckets of the process name hash
+#define			MailboxSize					100 //messages one mailbox holds, each pid and the broadcast have one
+#define			HandoffPageLimit			16 //pages one message can hand over, when the length is larger than 64
+#define			SharedAreaLimit				8 //the number of shared areas
+#define			SharedPageLimit				32 //pages one shared area can have
+#define			FRAME_HANDOFF				0x1 //the frame travels in a message
+#define			FRAME_SHARED				0x2 //the frame belongs to a shared area
+#define			FRAME_BUSY					0x4 //the fault handler waits for the disk on the frame
+#define			PTBL_SWAPPED_BIT			0x1000 //the page has a copy in its swap slot
+#define			SwapSectorsPerDisk			NUM_SYSTEM_SECTORS //the sectors after the ones a program reaches are the swap space
+#define			SwapFirstSector				NUM_LOGICAL_SECTORS
+#define			SwapSlotCount				(MAX_NUMBER_OF_DISKS*SwapSectorsPerDisk)
+#define			ReplacePolicyCount			5 //clock, wsclock, aging, 2q, arc
+#define			WSClockWindow				32 //faults a page stays in the working set after its last use
+#define			TwoQInRatio					4 //A1in holds at most 1/4 of the memory
+#define			ReadAheadPages				2 //pages read ahead on a stride
+#define			SwapClusterPages			1 //neighbours read with a swap-in that has no stride
+#define			WorkingSetTicks				2 //timer samples a page stays in the working set after its last use
+#define			WorkingSetSlack				2 //frames a process may have over its working set
+#define			CleanFrameReserve			8 //free or clean frames the page cleaner keeps when the cpu idles
+#define			DiskQueueSize				(ProcessTableSize+ProcessLimit*IO_RING_ENTRIES) //requests one disk queue holds, one of every waiting process and its ring
+#define			DiskPolicyCount				4 //fcfs, sstf, scan, clook
+#define			DiskSampleLimit				4096 //service times kept for the percentile in the disk report
+#define			BufferCacheSize				64 //sectors the buffer cache holds
+#define			BufferHashSize				128 //hash chains of the buffer cache, a power of 2
+#define			BufferFlushAge				32 //cache ticks a dirty buffer waits before a DISK_READ or DISK_WRITE writes it back
 #define			DO_LOCK                     1
 #define			DO_UNLOCK                   0
 #define			SUSPEND_UNTIL_LOCKED        TRUE
@@ -59,13 +86,33 @@ typedef struct node
     Process_Control_Block data;  
    // PCBNode next;  
 	INT32	time; //save the current system time here
+	INT32	bucket; //the priority level the node was queued at, only used by readyqueue
+	INT32	heapindex; //position in the timerqueue heap, -1 when not in a heap
+	INT32	order; //insert order, breaks ties between equal times in the heap
 	struct node *next;
+	struct node *prev; //so a node can be unlinked without walking to it
+	struct pcbqueue *queue; //the queue the node is linked into, NULL when in none
+	struct node *hashnext; //next node in the same name hash bucket
 }Node, *PCBNode; 
-typedef struct 
+typedef struct
+	{        //one FIFO per priority level, all chained in order through the queue itself
+	PCBNode head[PriorityLevels];
+	PCBNode tail[PriorityLevels];
+	UINT32	bitmap[(PriorityLevels+31)/32]; //bit set when that level has a node
+}PriorityBuckets;
+typedef struct
+	{        //min-heap of timerqueue nodes keyed on wake up time
+	PCBNode *entry;
+	INT32	count;
+	INT32	capacity;
+}TimerHeap;
+typedef struct pcbqueue
 	{  
     PCBNode front;  
     PCBNode rear;  //point to the last element of the queue, doesnt very useful
     INT32 size;  
+	PriorityBuckets *buckets; //only readyqueue has buckets, NULL for the other queues
+	TimerHeap *heap; //only timerqueue has a heap, NULL for the other queues
 }PCBQueue;
 typedef struct{//this structure is for send and receive message
     long    target_pid;
@@ -75,17 +122,158 @@ typedef struct{//this structure is for send and receive message
     long    receive_length;
     long    actual_send_length;
     long    loop_count;
+    long    order; //send order, to merge a mailbox with the broadcast one
     char    msg_buffer[64];
+    INT32   page_count; //pages handed over instead of msg_buffer, 0 for a normal message
+    UINT16  frames[HandoffPageLimit]; //the frames of those pages
+    INT32   prev; //slot of the message sent just before it to the same mailbox, -1 for the oldest
+    INT32   next; //slot of the one sent just after it, -1 for the newest, the next free slot when unused
+    INT32   nextfrom; //slot of the next message from the same source, -1 for the last one
 }Messagestr;  
+typedef struct{//reverse map of one physical frame
+    INT32   pid; //the owner, -1 when the frame is free
+    INT32   vpn; //the page of the owner in the frame
+    UINT16  pinned; //FRAME_HANDOFF, FRAME_SHARED, FRAME_BUSY, a pinned frame is neither free nor a victim
+    INT32   nextfree; //the next frame in the free list, -1 at the end
+}FrameEntry;
+typedef struct{//the page that owns one swap slot
+    INT32   pid; //-1 when the slot is free
+    INT32   vpn;
+}SwapOwner;
+typedef struct{//one area of DEFINE_SHARED_AREA, the same frames are in the page table of every sharer
+    char    tag[32]; //the name the processes use to find the area, empty when not used
+    INT32   page_count;
+    UINT16  frames[SharedPageLimit];
+    INT32   refcount; //the number of processes that have it in their page table
+    char    sharer[ProcessTableSize]; //1 for the pids in refcount
+}SharedArea;
+typedef struct{//one page replacement policy, the hooks may be NULL
+    char    *name;
+    void    (*init)(void ); //osInit
+    void    (*fault)(void ); //every page fault, before the victim is chosen
+    void    (*pagein)(INT32 ); //the frame gets a page
+    void    (*release)(INT32 ); //the frame is free again
+    INT32   (*victim)(INT32 ); //the frame to give up, never a pinned one, with 1 it is -1 when the choice is dirty
+}ReplacePolicy;
+typedef struct{//what paging cost, for the report at the end
+    INT32   faults;
+    INT32   pageins;
+    INT32   pageouts;
+    INT32   cleanevictions; //victims that needed no write
+    INT32   readaheads; //pages read before their fault
+    INT32   loadswaps; //processes the load controller took out
+    INT32   cleanerwrites; //dirty pages the page cleaner wrote
+    INT32   tableleaves; //leaves of page tables and swap maps in use
+    INT32   peakleaves; //the most leaves in use at once
+}PagingStats;
+typedef struct{//one DISK_READ or DISK_WRITE of a process, or of the fault handler for it
+    INT32   pid; //-1 for none
+    INT32   sector;
+    INT32   action; //0 read, 1 write
+    INT32   count; //0 for one sector into data, else data is a list of count buffers for the sectors from sector on
+    char    *data;
+    INT32   queuetime; //when it was asked for
+    INT32   async; //1 when it came from the ring of pid, nobody is suspended for it
+    long    userdata; //the user_data of its ring entry
+}DiskRequest;
+typedef struct{//the requests that wait for one disk, in the order they came
+    DiskRequest request[DiskQueueSize];
+    INT32   count;
+    DiskRequest active; //the request on the disk, active.pid is -1 when the disk does none or only a background one
+    INT32   readahead; //the frame a readahead reads into, -1 when none, the disk takes nothing else until its interrupt
+    INT32   readaheadstale; //1 when the page got another frame or its process is gone, the interrupt frees the frame
+    INT32   headsector; //the sector of the last start, where the arm is
+    INT32   direction; //1 when SCAN goes up, -1 when it goes down
+}DiskQueue;
+typedef struct{//one disk scheduling policy
+    char    *name;
+    INT32   (*pick)(INT32 ); //the index in the queue of the disk to start next, the queue is not empty
+}DiskPolicy;
+typedef struct{//what the disk queues cost, for the report at the end
+    INT32   requests; //requests finished
+    INT32   queued; //requests that had to wait for their disk
+    INT32   seeksectors; //the arm moved over so many sectors for the requests
+    long    servicetotal; //from asking to finishing, summed
+    INT32   servicecount; //samples kept in diskservice
+}DiskStats;
+typedef struct{//one sector of a disk in the buffer cache
+    INT32   disk_id; //-1 when the buffer is empty
+    INT32   sector;
+    INT32   dirty; //1 when the disk does not have the data yet
+    INT32   dirtytick; //the cache tick it became dirty
+    INT32   hashnext; //the next buffer in its hash chain, -1 at the end
+    INT32   prev; //the more recently used buffer, -1 at the head of the lru list
+    INT32   next; //the less recently used buffer, -1 at the tail
+    char    data[PGSIZE];
+}CacheBuffer;
+typedef struct{//what the buffer cache saved, the hardware prints it
+    INT32   hits;
+    INT32   misses;
+    INT32   writebacks; //dirty buffers written to their disk
+}CacheStats;
+typedef struct{//messages for one target pid, or for broadcast, chained in sending order and per source
+    Messagestr slot[MailboxSize];
+    INT32   head; //slot of the oldest message, -1 when empty
+    INT32   tail; //slot of the newest message
+    INT32   freeslot; //first unused slot, -1 when full
+    INT32   count;
+    INT32   fromhead[ProcessTableSize]; //slot of the oldest message from each source, -1 if none
+    INT32   fromtail[ProcessTableSize]; //slot of the newest message from each source
+}Mailbox;
 ///////////////////These loacations are global and define information about the page table///////////////////
-extern UINT16        *Z502_PAGE_TBL_ADDR;
+extern UINT16        **Z502_PAGE_TBL_ADDR;
 extern INT16         Z502_PAGE_TBL_LENGTH;
 extern void          *TO_VECTOR [];
-UINT16 frametable[64]; 
-UINT16 pidprint[64];
-INT32 currentvictim;
+FrameEntry *framemap; //owner and state of every frame, the tables of frames are as long as the memory
+INT32 freeframehead = -1; //the free frames are linked through nextfree
+INT32 freeframecount = 0;
+UINT16 **pagetable[ProcessTableSize]; //the page directory of every pid, the hardware only knows the one of the running context
+INT16 **swapmap[ProcessTableSize]; //the swap slot of every page of the pid, -1 when it has none, a leaf is made for the first slot in it
+UINT32 swapbitmap[(SwapSlotCount+31)/32]; //1 for a slot in use
+SwapOwner swapowner[SwapSlotCount];
+INT32 swapcursor = 0; //the next slot to try, page-outs go round all the disks
+INT32 framepinnedcount = 0; //frames in messages or shared areas, at most half of the memory
+SharedArea sharedarea[SharedAreaLimit];
+INT32 currentvictim; //the clock hand, the other policies start their search here too
+INT32 *frameage; //aging keeps the shifted reference bits, wsclock the fault count of the last use
+INT32 *framelist; //the list of 2Q or ARC the frame is in, -1 for none
+INT32 *listnext;
+INT32 *listprev;
+INT32 listhead[2], listtail[2], listsize[2]; //A1in and Am of 2Q, T1 and T2 of ARC
+SwapOwner *ghostpages[2]; //pages that left memory, A1out of 2Q, B1 and B2 of ARC
+INT32 ghostcount[2];
+INT32 arctarget = 0; //the size ARC wants for T1
+PagingStats pagingstats;
+INT32 pagingreport = 0; //1 when the policy is given on the command line
+INT32 lastfault[ProcessTableSize]; //the page of the last fault of every pid
+INT32 faultstride[ProcessTableSize]; //the distance between its last two faults
+INT32 stridehits[ProcessTableSize]; //how many faults in a row kept that distance
+INT32 wstick = 0; //working set samples so far, one at every timer interrupt
+INT32 *framelastuse; //the sample the frame was last seen used
+INT32 residentcount[ProcessTableSize]; //frames of every pid
+INT32 workingset[ProcessTableSize]; //its pages used in the last WorkingSetTicks samples
+INT32 framequota[ProcessTableSize]; //frames it may have before it replaces its own pages, 0 for no quota
+INT32 loadswapped[ProcessTableSize]; //1 when the load controller took it out of the readyqueue
+INT32 swappedset[ProcessTableSize]; //its working set when it was taken out
+INT32 localhand = 0; //the hand of LocalVictim
+DiskQueue diskqueue[MAX_NUMBER_OF_DISKS+1]; //one per disk, 1 to MAX_NUMBER_OF_DISKS
+INT32 diskqueued[ProcessTableSize]; //1 while the request of the pid waits in a disk queue, it is not on the disk yet
+INT32 diskstatus[ProcessTableSize]; //the status of the interrupt that finished the last request of the pid
+DiskStats diskstats;
+INT32 diskservice[DiskSampleLimit]; //the service times of the first requests
+INT32 diskreport = 0; //1 when the disk policy is given on the command line
+CacheBuffer buffercache[BufferCacheSize];
+INT32 bufferhash[BufferHashSize]; //the first buffer of every chain, -1 for none
+INT32 lruhead = -1; //the most recently used buffer
+INT32 lrutail = -1; //the least recently used one, the first to take
+INT32 cachetick = 0; //one tick for every DISK_READ and DISK_WRITE, the clock of the flush
+CacheStats cachestats;
+IO_RING *ioring[ProcessTableSize]; //the ring every pid set up, NULL for none
+INT32 ringinflight[ProcessTableSize]; //its ring requests on a disk or in a disk queue
+INT32 ringwant[ProcessTableSize]; //completions it waits for in IO_RING_ENTER, 0 when it does not wait
 //extern memory
-extern char MEMORY[PHYS_MEM_PGS * PGSIZE ];
+extern char *MEMORY;
+extern INT32 PhysMemPages; //the frames of the hardware, chosen when it starts
 ///////////////////////////////////////
 char                 *call_names[] = { "mem_read ", "mem_write",
                             "read_mod ", "get_time ", "sleep    ",
@@ -96,19 +284,35 @@ char                 *call_names[] = { "mem_read ", "mem_write",
 PCBQueue			*timerqueue; //create the timerqueue and store in OS
 PCBQueue			*readyqueue; //create the readyqueue and store in OS
 PCBQueue			*suspendqueue; //create the readyqueue and store in OS
-Messagestr			messagelist[MessageLimit]; //the message queue, limit number 100
+Mailbox				*mailbox[ProcessTableSize]; //the messages sent to each pid, created on the first send
+Mailbox				broadcastbox; //the messages sent to -1
+INT32				receivewaiting[ProcessTableSize]; //1 when the pid is suspended in RECEIVE_MESSAGE
+INT32				receivesource[ProcessTableSize]; //the source pid it waits for, -1 for anyone
+INT32				anywaitnext[ProcessTableSize]; //the pids waiting for anyone, in the order they suspended
+INT32				anywaitprev[ProcessTableSize];
+INT32				anywaithead = -1; //the first one, a broadcast resumes it
+INT32				anywaittail = -1;
 Process_Control_Block	*PCB; //create the PCB for new test and store in OS
 Process_Control_Block	*CURRENTPCB; 
 Process_Control_Block	*start_PCB; //¼teminateʱõ
 INT32			PCBcount = 0; //the global counter for pcb
 INT32			currenttriggertime;     //the global current time interrupt, cause the interrupt only effect once
-INT32			messagecount = 0;//the global message number count
+long			messageorder = 0;//the global counter for Messagestr.order
 INT32			diskinterrupttime;
+INT32			timerorder = 0; //counter for Node.order
+PCBNode			processtable[ProcessTableSize]; //one node per process, indexed by pid, moved between the queues
+PCBNode			namehash[NameHashSize]; //the same nodes chained by process name
 ///////////////////declare the routines generate in base.c///////////////////
 INT32		OSCreateProcess(char *, void *, INT32 );
 PCBQueue	*InitQueue();
+PCBQueue	*InitPriorityQueue();
+PCBQueue	*InitTimerQueue();
 //queueroutine
 INT32		GetPIDByName(PCBQueue *, char *);
+PCBNode		GetProcessNode(Process_Control_Block * );
+PCBNode		FindNodeByPid(INT32 );
+PCBNode		FindNodeByName(PCBQueue *, char * );
+INT32		HashName(char * );
 PCBNode		AddToTimerQueue(PCBQueue *,Process_Control_Block *, INT32 );
 PCBNode		AddToReadyQueue(PCBQueue *,Process_Control_Block *);
 PCBNode		AddToSuspendQueue(PCBQueue *,Process_Control_Block *);
@@ -116,15 +320,41 @@ PCBNode		AddToReadyQueueByPriority(PCBQueue *, Process_Control_Block *);
 INT32		IsEmpty(PCBQueue * );  
 void		ListQueue(PCBQueue * ); 
 PCBNode		RemoveFromTimerQueue(PCBQueue *, INT32 );
+PCBNode		GetFirstTimer(PCBQueue * );
+INT32		IsTimerBefore(PCBNode, PCBNode );
+void		TimerHeapSiftUp(TimerHeap *, INT32 );
+void		TimerHeapSiftDown(TimerHeap *, INT32 );
+void		TimerHeapInsert(TimerHeap *, PCBNode );
+void		TimerHeapRemove(TimerHeap *, INT32 );
 INT32		RemoveQueueByPid(PCBQueue *,INT32 );
 PCBNode		RemoveQueueByName(PCBQueue *, char * ); 
 PCBNode		DeQueueFirstElement(PCBQueue *pqueue );
+void		AppendNode(PCBQueue *, PCBNode );
+void		UnlinkNode(PCBQueue *, PCBNode );
+INT32		GetBucketLevel(INT32 );
+INT32		FindBucketAtOrBefore(PriorityBuckets *, INT32 );
 INT32		IsNameDuplicate( PCBQueue *, char * );
 INT32		IsPidExist(PCBQueue *, INT32 );
-Process_Control_Block GetPcbByPid(PCBQueue *, INT32 );
+Process_Control_Block GetPcbByPid(INT32 );
 //message routine
-void		removefrommessagelist(INT32 );
-INT32		IsSourcePidExsit( INT32 );
+void		InitMailbox(Mailbox *);
+Mailbox		*GetMailbox(INT32 );
+INT32		AddToMailbox(INT32 , char *, INT32 , INT32 );
+INT32		IsHandoffBuffer(long , INT32 );
+INT32		IsMessageFit(Messagestr *, INT32 , INT32 );
+INT32		IsPageResident(INT32 , INT32 );
+void		DetachPages(INT32 , INT32 , UINT16 *);
+void		AttachPages(INT32 , INT32 , UINT16 *);
+Messagestr	*GetMessageAt(Mailbox *, INT32 );
+INT32		FindInMailbox(Mailbox *, INT32 );
+Mailbox		*FindMessage(INT32 , INT32 , INT32 *);
+void		RemoveFromMailbox(Mailbox *, INT32 );
+void		ReleaseMessagePages(Messagestr *);
+void		ReleaseMessages(INT32 );
+INT32		IsSourcePidExsit( INT32 , INT32 );
+void		BeginReceiveWait(INT32 , INT32 );
+void		EndReceiveWait(INT32 );
+INT32		FindBroadcastWaiter(void );
 void		messageprocess( char *);
 //for debug
 void		ListTimerQueue();
@@ -135,8 +365,130 @@ void		ListSuspendQueue();
 void		dospprint(char *, INT32 , Process_Control_Block *);
 void		Memory_Print();
 //project2
+void		AllocFrameTables(void );
+void		InitFrameMap(void );
 INT32		IsFreeFrameExist(void );
 INT32		GetFreeFrame(void );
+void		SetFrameOwner(INT32 , INT32 , INT32 );
+void		FreeFrame(INT32 );
+INT32		IsFramePinned(INT32 );
+UINT16		**GetPageTable(INT32 );
+void		InstallPageTable(void );
+UINT16		*TableEntry(UINT16 **, INT32 );
+UINT16		PeekTableEntry(UINT16 **, INT32 );
+INT16		SwapSlotOf(INT32 , INT32 );
+void		SetSwapSlot(INT32 , INT32 , INT16 );
+UINT16		*FramePTE(INT32 );
+INT32		IsFrameDirty(INT32 );
+void		ReleaseProcessPages(INT32 );
+void		InitSwapSpace(void );
+INT32		GetSwapSlot(INT32 , INT32 );
+void		FreeSwapSlot(INT32 );
+INT32		SwapDisk(INT32 );
+INT32		SwapSector(INT32 );
+void		ReleaseSwapSlots(INT32 );
+void		MapPages(INT32 , INT32 , UINT16 *);
+SharedArea	*FindSharedArea(char * );
+SharedArea	*CreateSharedArea(char *, INT32 );
+void		ReleaseSharedAreas(INT32 );
+void		SelectReplacePolicy(char *);
+void		PrintPagingReport(void );
+void		SamplePages(void );
+void		ListAppend(INT32 , INT32 );
+void		ListUnlink(INT32 );
+INT32		GhostFind(INT32 , INT32 , INT32 );
+void		GhostRemove(INT32 , INT32 );
+void		GhostAdd(INT32 , INT32 );
+INT32		AnyUnpinnedFrame(void );
+INT32		IsVictimRefused(INT32 , INT32 );
+void		ClockInit(void );
+void		ClockPageIn(INT32 );
+INT32		ClockVictim(INT32 );
+void		WSClockPageIn(INT32 );
+INT32		WSClockVictim(INT32 );
+void		AgingFault(void );
+void		AgingPageIn(INT32 );
+INT32		AgingVictim(INT32 );
+void		ListInit(void );
+void		ListRelease(INT32 );
+void		TwoQPageIn(INT32 );
+INT32		TwoQVictim(INT32 );
+void		ARCPageIn(INT32 );
+INT32		ARCVictim(INT32 );
+INT32		IsDiskFree(INT32 );
+void		StartDiskRead(INT32 , INT32 , char *);
+void		UnmapFrame(INT32 );
+void		ReadAhead(INT32 , INT32 );
+void		FinishReadAhead(INT32 , INT32 );
+INT32		WaitForReadAhead(INT32 , INT32 );
+void		CancelReadAhead(INT32 , INT32 );
+void		SampleWorkingSets(void );
+INT32		ChooseVictim(INT32 );
+INT32		LocalVictim(INT32 );
+void		LoadControl(void );
+INT32		IsLoadSwapped(INT32 );
+INT32		PageCleaner(void );
+INT32		CountCleanFrames(void );
+void		StartDiskWrite(INT32 , INT32 , char *);
+INT32		ReadFromDisk(INT32 , INT32 , char *);
+INT32		WriteToDisk(INT32 , INT32 , char *);
+INT32		ReadSectorsFromDisk(INT32 , INT32 , INT32 , char **);
+INT32		WriteSectorsToDisk(INT32 , INT32 , INT32 , char **);
+void		InitDiskQueues(void );
+INT32		SubmitDiskRequest(INT32 , INT32 , INT32 , INT32 , char *);
+INT32		QueueDiskRequest(INT32 , DiskRequest *);
+void		IssueDiskIO(INT32 , INT32 , INT32 , INT32 , char *);
+void		StartDiskRequest(INT32 , DiskRequest *);
+INT32		FinishDiskRequest(INT32 );
+INT32		DispatchDiskRequest(INT32 , INT32 );
+void		WaitForDiskStart(INT32 );
+void		SelectDiskPolicy(char *);
+void		PrintDiskReport(void );
+int			CompareServiceTime(const void *, const void *);
+INT32		FCFSPick(INT32 );
+INT32		SSTFPick(INT32 );
+INT32		SCANPick(INT32 );
+INT32		CLOOKPick(INT32 );
+void		InitBufferCache(void );
+INT32		CacheHash(INT32 , INT32 );
+INT32		FindBuffer(INT32 , INT32 );
+void		TouchBuffer(INT32 );
+void		UnhashBuffer(INT32 );
+INT32		TakeBuffer(void );
+INT32		WriteBackBuffer(INT32 );
+INT32		CacheRead(INT32 , INT32 , char *);
+INT32		CacheWrite(INT32 , INT32 , char *);
+void		CacheFill(INT32 , INT32 , char *);
+INT32		CacheReadSectors(INT32 , INT32 , INT32 , char **, char **, char *);
+void		CacheWriteSectors(INT32 , INT32 , INT32 , char **);
+INT32		NextDiskRun(INT32 , INT32 , char **, char **, INT32 *);
+INT32		FlushBufferCache(INT32 );
+INT32		CountDirtyBuffers(void );
+INT32		AreDisksQuiet(void );
+void		DrainBufferCache(void );
+void		ReportCacheStats(void );
+INT32		SetupIORing(INT32 , IO_RING *);
+INT32		SubmitIORing(INT32 );
+INT32		RingCompletions(INT32 );
+void		PostCompletion(INT32 , long , INT32 );
+INT32		CompleteRingRequest(DiskRequest *, INT32 );
+INT32		SuspendForRing(INT32 , INT32 );
+void		ReleaseIORing(INT32 );
+ReplacePolicy	replacepolicies[ReplacePolicyCount] = {
+	{"clock",	ClockInit,	NULL,		ClockPageIn,	NULL,			ClockVictim},
+	{"wsclock",	ClockInit,	NULL,		WSClockPageIn,	NULL,			WSClockVictim},
+	{"aging",	ClockInit,	AgingFault,	AgingPageIn,	NULL,			AgingVictim},
+	{"2q",		ListInit,	NULL,		TwoQPageIn,		ListRelease,	TwoQVictim},
+	{"arc",		ListInit,	NULL,		ARCPageIn,		ListRelease,	ARCVictim}
+};
+ReplacePolicy	*replacepolicy = &replacepolicies[0]; //clock unless the second argument names another one
+DiskPolicy	diskpolicies[DiskPolicyCount] = {
+	{"fcfs",	FCFSPick},
+	{"sstf",	SSTFPick},
+	{"scan",	SCANPick},
+	{"clook",	CLOOKPick}
+};
+DiskPolicy	*diskpolicy = &diskpolicies[0]; //fcfs unless the third argument names another one
 //void		DoSleep(INT32 millisecs);
 /************************************************************************
 interrup handle, there are two types of interrupt
@@ -150,13 +502,13 @@ void    interrupt_handler( void ) {
     //static BOOL		remove_this_in_your_code = TRUE;   /** TEMP **/.
     //static INT32		how_many_interrupt_entries = 0;    /** TEMP **/
 	PCBNode				bnode;
-	char				tempname[16]; //for the process name
-	INT32				Time,icount,jcount;  //time and temp count
+	INT32				Time;  //current time
 	INT32				LockResult; //return for lock
 	INT32				nextinterupttime,mintime; //for calculate the next interrupt
 	INT32				Temp;
+	INT32				disk_id;
+	INT32				woken; //the requester the disk interrupt wakes, -1 for none
 	//INT32				bb;
-	Process_Control_Block	pcbtemp;   //for temperory pcb store
 
     // Get cause of interrupt
     MEM_READ(Z502InterruptDevice, &device_id );
@@ -179,25 +531,15 @@ void    interrupt_handler( void ) {
 			READ_MODIFY(MEMORY_INTERLOCK_BASE+1, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //timerqueue
 			READ_MODIFY(MEMORY_INTERLOCK_BASE+2, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //suspendqueue
 
-			bnode = timerqueue->front; 
-			icount = 1;
 			//when get time interrupt, add pcb to readyqueue and remove the data at timerqueue
-			while(bnode!=NULL&&icount<=timerqueue->size){ //used to occur the interrupt insert two data at same time,now change the reset time, its ok now 
-				if(bnode->time<=Time){  
-					CALL(AddToReadyQueueByPriority(readyqueue,&bnode->data)); //AddToReadyQueueByPriority is inserting data by priority
-					//CALL(AddToReadyQueue(readyqueue, &bnode->data)); //FIFO logic routine
-					strcpy(tempname,bnode->data.Name);
-					bnode = bnode->next;
-					CALL(RemoveQueueByName(timerqueue, tempname)); 
-					//bnode = bnode->next;
-					//icount++;
-					//Z502SwitchContext( +, &readyqueue->front->data.context);
-				}
-				else {
-					bnode = bnode->next;	
-					icount++;
-				}
+			//the heap gives the expired sleepers earliest first, stop at the first one still sleeping
+			while((bnode = GetFirstTimer(timerqueue))!=NULL&&bnode->time<=Time){
+				CALL(UnlinkNode(timerqueue, bnode)); //take it off the timerqueue and the heap first
+				CALL(AddToReadyQueueByPriority(readyqueue,&bnode->data)); //AddToReadyQueueByPriority is inserting data by priority
+				//CALL(AddToReadyQueue(readyqueue, &bnode->data)); //FIFO logic routine
 			}
+			SampleWorkingSets(); //the timer is the clock of the working sets, we have the frametable with the disk lock
+			LoadControl();
 			//for debug
 			//CALL(ListTwoQueue()); //we have to add call, otherwise the error happened for no sense
 			//CALL(dospprint("INTERUPT", CURRENTPCB->Processid, CURRENTPCB)); //after giving memory to CURRENTPCB, the printer is ok
@@ -205,21 +547,8 @@ void    interrupt_handler( void ) {
 			//reset time interrupt, traverse timerqueue, find the min time as next interrupt time
 			//READ_MODIFY(MEMORY_INTERLOCK_BASE+1, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //timerqueue
 			if(IsEmpty(timerqueue)!=1){ //if timerqueue is not empty, we need to reset
-				//first get the min time at timerqueue
-				bnode = timerqueue->front; 
-				icount = 1;
-				mintime = bnode->time;
-				while(bnode!=NULL&&icount<=timerqueue->size){
-					if(mintime>bnode->time){
-						mintime = bnode->time;
-						bnode = bnode->next;	
-						icount++;
-					}
-					else {
-						bnode = bnode->next;	
-						icount++;
-					}
-				}
+				//first get the min time at timerqueue, the top of the heap
+				mintime = GetFirstTimer(timerqueue)->time;
 				//second write to the time interrupt
 				CALL(MEM_READ( Z502ClockStatus, &Time )); //too much call waste time, may cause 10 time idle before interrupt, mean ERROR
 				nextinterupttime = mintime - Time;
@@ -241,32 +570,26 @@ void    interrupt_handler( void ) {
 
 			CALL(dospprint("TIME_INT", CURRENTPCB->Processid, CURRENTPCB)); //after giving memory to CURRENTPCB, the printer is ok
 		}
-		//else if (device_id == (short)5|(short)6|(short)7|(short)8|(short)9|(short)10|(short)11|(short)12|(short)13|(short)14|(short)15|(short)16){ //all 12 disks, 5-16
-		else if (device_id == (short)5|(short)6|(short)7|(short)8|(short)9|(short)10){ //all 12 disks, 5-16
+		else if (device_id >= DISK_INTERRUPT_DISK1 && device_id < DISK_INTERRUPT_DISK1+MAX_NUMBER_OF_DISKS){ //all 12 disks, 5-16
 			//printf("Interrupt handler: DISK_INTERRUPT_DISK:%i\n",device_id);
+			disk_id = device_id-DISK_INTERRUPT_DISK1+1; //only this disk is done, the others may still be busy
+			woken = -1;
+			READ_MODIFY(MEMORY_INTERLOCK_BASE+5, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //diskqueue
 			READ_MODIFY(MEMORY_INTERLOCK_BASE+0, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //readyqueue
 			READ_MODIFY(MEMORY_INTERLOCK_BASE+2, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //suspendqueue
-			for(icount=1;icount<=MAX_NUMBER_OF_DISKS;icount++){
-			//icount =device_id;
-				MEM_WRITE(Z502DiskSetID, &icount);
-				MEM_READ(Z502DiskStatus, &Temp);
-				
-				for(jcount=0;jcount<6;jcount++){
-					if((IsPidExist(suspendqueue, jcount))&&Temp == DEVICE_FREE){
-						pcbtemp = GetPcbByPid(suspendqueue,jcount);
-						//RemoveQueueByPid(readyqueue,Index-1);
-						AddToReadyQueueByPriority(readyqueue,&pcbtemp);
-						RemoveQueueByPid(suspendqueue,jcount);
-
-						CALL(dospprint("DISK_INT", pcbtemp.Processid, CURRENTPCB));
-					}
-				}
+			MEM_WRITE(Z502DiskSetID, &disk_id);
+			MEM_READ(Z502DiskStatus, &Temp);
+			if(Temp == DEVICE_FREE){ //a background request started before we got here makes it busy again, its own interrupt comes later
+				FinishReadAhead(disk_id, status); //we hold the frametable lock
+				woken = DispatchDiskRequest(disk_id, status); //wakes the requester of the finished request and starts the next one
 			}
 
 			READ_MODIFY(MEMORY_INTERLOCK_BASE+0, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //readyqueue
 			READ_MODIFY(MEMORY_INTERLOCK_BASE+2, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //suspendqueue	
-			//CALL(dospprint("DISK_INT", pcbtemp.Processid, CURRENTPCB));
-			
+			READ_MODIFY(MEMORY_INTERLOCK_BASE+5, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //diskqueue
+			if(woken != -1){ //the printer takes the queue locks itself
+				CALL(dospprint("DISK_INT", woken, CURRENTPCB));
+			}
 		}
 		else{
 			printf( "* ERROR!  InterruptDevice ID not recognized!\n" );
@@ -299,6 +622,9 @@ void    fault_handler( void )
 	long		tempdata;
 	INT32		LockResult;
 	INT32		Temp;
+	INT32		victimpid; //the owner of the frame the clock takes, not always us
+	INT32		victimvpn;
+	INT32		slot; //swap slot of the page
 
     // Get cause of interrupt
     MEM_READ(Z502InterruptDevice, &device_id );
@@ -320,45 +646,45 @@ void    fault_handler( void )
             CALL(Z502Halt());
         if (status < 0)//Illegal virtual address,
             CALL(Z502Halt());
-        if (Z502_PAGE_TBL_ADDR == NULL ){ //Page table doesn't exist,
-			Z502_PAGE_TBL_LENGTH = 1024;
-			Z502_PAGE_TBL_ADDR = (UINT16 *)calloc( sizeof(UINT16), Z502_PAGE_TBL_LENGTH );
+        if (Z502_PAGE_TBL_ADDR == NULL ){ //Page table isn't in the hardware yet, the one made with the process
+			InstallPageTable();
 		}
         if (status >= Z502_PAGE_TBL_LENGTH){//Address is larger than page table,
 			CALL(Z502Halt());
 		}
 		
-        if ((Z502_PAGE_TBL_ADDR[(UINT16) status] & PTBL_VALID_BIT)>>15 == 0){ //Page table entry exists, but page is invalid.
+        if ((PeekTableEntry(Z502_PAGE_TBL_ADDR, status) & PTBL_VALID_BIT)>>15 == 0){ //Page table entry exists, but page is invalid.
 			//valid,Ҫvalid
 			
 			READ_MODIFY(MEMORY_INTERLOCK_BASE+4, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //frametable
+			pagingstats.faults++;
+			if(replacepolicy->fault!=NULL)
+				replacepolicy->fault();
 			//ǷӲ
-			if ((Z502_PAGE_TBL_ADDR[(UINT16) status] & 0x1000)>>12 == 1){
+			if(WaitForReadAhead(CURRENTPCB->Processid, status)==1){
+				//a readahead had it on the way, the interrupt of its disk made it valid
+			}
+			else if ((PeekTableEntry(Z502_PAGE_TBL_ADDR, status) & PTBL_SWAPPED_BIT)>>12 == 1){
 				//Ӳ̶ݽڴ
 				if(IsFreeFrameExist()==1){
 					//ʹframe,Ӳ̶ݽ
 					frame_number = GetFreeFrame();
-					currentvictim = frame_number;
-					ReadFromDisk(CURRENTPCB->Processid+1, status, (char *) &MEMORY[frame_number*PGSIZE]);
+					slot = SwapSlotOf(CURRENTPCB->Processid, status);
+					if(ReadFromDisk(SwapDisk(slot), SwapSector(slot), (char *) &MEMORY[frame_number*PGSIZE])==0){ //the page is not there before the read starts
+						framemap[frame_number].pinned |= FRAME_BUSY;
+						READ_MODIFY(MEMORY_INTERLOCK_BASE+4, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //frametable
+						WaitForDiskStart(CURRENTPCB->Processid);
+						READ_MODIFY(MEMORY_INTERLOCK_BASE+4, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //frametable
+						framemap[frame_number].pinned &= ~FRAME_BUSY;
+					}
+					pagingstats.pageins++;
 
-					Z502_PAGE_TBL_ADDR[(UINT16) status] =  (UINT16)frame_number|PTBL_VALID_BIT;
-					frametable[frame_number] = status; //1ʾ	
-					pidprint[frame_number] = CURRENTPCB->Processid;
+					*TableEntry(Z502_PAGE_TBL_ADDR, status) =  (UINT16)frame_number|PTBL_VALID_BIT|PTBL_SWAPPED_BIT; //the copy on disk stays good until we write the page
+					SetFrameOwner(frame_number, CURRENTPCB->Processid, status); //1ʾ	
 				}
 				else{//ûfreeframe
 					//ڴпһframeӲ̣ȻӲ̶ݽ
-					for(frame_number = currentvictim;frame_number<64;){
-						if((Z502_PAGE_TBL_ADDR[frametable[frame_number]]&PTBL_REFERENCED_BIT)>>13==1)
-						{
-                            Z502_PAGE_TBL_ADDR[frametable[frame_number]]&=(~PTBL_REFERENCED_BIT);
-							if(frame_number==63){
-								frame_number = 0;
-							}
-							else frame_number++;
-						}
-						else break;
-					}
-					currentvictim = frame_number;
+					frame_number = ChooseVictim(CURRENTPCB->Processid);
 					//frame_number = status%64; //ʱ߼victim
 					//øframeΪɶ״̬ͨ
 					//Z502_PAGE_TBL_ADDR[(UINT16) frame_number]|=PTBL_VALID_BIT;
@@ -368,31 +694,50 @@ void    fault_handler( void )
 					//MEM_WRITE(Z502DiskSetID, &CURRENTPCB->Processid+1);
 					//MEM_READ(Z502DiskStatus, &Temp);
 					//if (Temp == DEVICE_FREE){ 
-					WriteToDisk(CURRENTPCB->Processid+1, frametable[frame_number],(char *) &MEMORY[frame_number*PGSIZE]);
-					READ_MODIFY(MEMORY_INTERLOCK_BASE+4, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //frametable
-					while(IsEmpty(readyqueue)){ //while nothing in readyqueue, do idle
-						printf("");
-						CALL(Z502Idle());
+					//the victim may be in the page table of another process, it goes to the next swap slot of the stripe
+					//and is invalid before we give up the cpu, the frame is busy until we read our page into it
+					victimpid = framemap[frame_number].pid;
+					victimvpn = framemap[frame_number].vpn;
+					framemap[frame_number].pinned |= FRAME_BUSY;
+					Temp = IsFrameDirty(frame_number);
+					*FramePTE(frame_number) &= ~(PTBL_VALID_BIT|PTBL_MODIFIED_BIT);
+					*FramePTE(frame_number) |= PTBL_SWAPPED_BIT;
+					Z502InvalidateTLB(victimvpn);
+					if(Temp==1){ //only a dirty victim is written and waited for, a clean one is still good on disk
+						slot = GetSwapSlot(victimpid, victimvpn);
+						WriteToDisk(SwapDisk(slot), SwapSector(slot),(char *) &MEMORY[frame_number*PGSIZE]);
+						pagingstats.pageouts++;
+						READ_MODIFY(MEMORY_INTERLOCK_BASE+4, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //frametable
+						while(IsEmpty(readyqueue)){ //while nothing in readyqueue, do idle
+							printf("");
+							if(PageCleaner()==0&&FlushBufferCache(0)==0){ //after a write look at the readyqueue again, its interrupt may come before the idle
+								CALL(Z502Idle());
+							}
+						}
+						//until something appear in readyqueue, we switch to that process
+						memcpy(CURRENTPCB, &readyqueue->front->data,sizeof(Process_Control_Block));
+						CALL(Z502SwitchContext( SWITCH_CONTEXT_SAVE_MODE, &CURRENTPCB->context)); //switch to first one in readyqueue*/
+						READ_MODIFY(MEMORY_INTERLOCK_BASE+4, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //frametable
 					}
-					//until something appear in readyqueue, we switch to that process
-					memcpy(CURRENTPCB, &readyqueue->front->data,sizeof(Process_Control_Block));
-					CALL(Z502SwitchContext( SWITCH_CONTEXT_SAVE_MODE, &readyqueue->front->data.context)); //switch to first one in readyqueue*/
-					READ_MODIFY(MEMORY_INTERLOCK_BASE+4, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //frametable
-					ReadFromDisk(CURRENTPCB->Processid+1, status, (char *) &MEMORY[frame_number*PGSIZE]);
+					else pagingstats.cleanevictions++;
+					slot = SwapSlotOf(CURRENTPCB->Processid, status);
+					if(ReadFromDisk(SwapDisk(slot), SwapSector(slot), (char *) &MEMORY[frame_number*PGSIZE])==0){ //the cleaner or another process has the disk
+						READ_MODIFY(MEMORY_INTERLOCK_BASE+4, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //frametable
+						WaitForDiskStart(CURRENTPCB->Processid);
+						READ_MODIFY(MEMORY_INTERLOCK_BASE+4, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //frametable
+					}
+					pagingstats.pageins++;
 
 					//}
-					//ǸvalidΪ0,reserveΪ1
-					Z502_PAGE_TBL_ADDR[(UINT16) frametable[frame_number]] &= ~PTBL_VALID_BIT;//¼diskĹţ
-					Z502_PAGE_TBL_ADDR[(UINT16) frametable[frame_number]] |= 0x1000;
 
 					//ڴӴ̶,дڴ
 					
 					//ReadFromDisk(1,frametable_index,(char *)&tempdata);
 					//MEM_WRITE(frame_number*PGSIZE, &tempdata);
 					//µı־λ
-					Z502_PAGE_TBL_ADDR[(UINT16) status] =  (UINT16)frame_number|PTBL_VALID_BIT;
-					frametable[frame_number] = status; //¼ĸڴռ
-					pidprint[frame_number] = CURRENTPCB->Processid;
+					*TableEntry(Z502_PAGE_TBL_ADDR, status) =  (UINT16)frame_number|PTBL_VALID_BIT|PTBL_SWAPPED_BIT;
+					SetFrameOwner(frame_number, CURRENTPCB->Processid, status); //¼ĸڴռ
+					framemap[frame_number].pinned &= ~FRAME_BUSY;
 				}
 			}
 			else{ //Ӳ
@@ -400,43 +745,45 @@ void    fault_handler( void )
 				if(IsFreeFrameExist()==1){
 					//ʹframe
 					frame_number = GetFreeFrame();
-					currentvictim = frame_number;
-					Z502_PAGE_TBL_ADDR[(UINT16) status] =  (UINT16)frame_number|PTBL_VALID_BIT;
-					frametable[frame_number] = status; //¼ĸڴռ
-					pidprint[frame_number] = CURRENTPCB->Processid;
+					*TableEntry(Z502_PAGE_TBL_ADDR, status) =  (UINT16)frame_number|PTBL_VALID_BIT;
+					SetFrameOwner(frame_number, CURRENTPCB->Processid, status); //¼ĸڴռ
 					//Z502_PAGE_TBL_ADDRvalid־λreferencereserve,modify־λԺ
 					//frametable	
 				}
 				else{ //ûfreeframe
-					for(frame_number = currentvictim;frame_number<64;){
-						if((Z502_PAGE_TBL_ADDR[frametable[frame_number]]&PTBL_REFERENCED_BIT)>>13==1)
-						{
-                            Z502_PAGE_TBL_ADDR[frametable[frame_number]]&=(~PTBL_REFERENCED_BIT);
-							if(frame_number==63){
-								frame_number = 0;
-							}
-							else frame_number++;
-						}
-						else break;
-					}
-					currentvictim = frame_number;
+					frame_number = ChooseVictim(CURRENTPCB->Processid);
 					//ڴпһframeӲ
 					//frame_number = status%64; //ʱ߼victim
 					//MEM_READ(frame_number*PGSIZE, &tempdata);
 					//void Z502ReadPhysicalMemory(INT32 PhysicalPageNumber, char *PhysicalDataPointer) 
 					//frametable_index+=1;
-					WriteToDisk(CURRENTPCB->Processid+1, frametable[frame_number],(char *) &MEMORY[frame_number*PGSIZE]); //ĸinterruptˣ÷ŵĸdiskأʱȶŵ1	
+					victimpid = framemap[frame_number].pid;
+					victimvpn = framemap[frame_number].vpn;
+					framemap[frame_number].pinned |= FRAME_BUSY; //the write may only be queued, the frame stays ours until it starts
+					Temp = IsFrameDirty(frame_number);
 					
-					//ǸvalidΪ0,reserveΪ1
-					Z502_PAGE_TBL_ADDR[(UINT16) frametable[frame_number]] &= ~PTBL_VALID_BIT;//¼diskĹţ
-					Z502_PAGE_TBL_ADDR[(UINT16) frametable[frame_number]] |= 0x1000;
+					//ǸvalidΪ0,reserveΪ1, in the page table of the owner
+					*FramePTE(frame_number) &= ~(PTBL_VALID_BIT|PTBL_MODIFIED_BIT);//¼diskĹţ
+					*FramePTE(frame_number) |= PTBL_SWAPPED_BIT;
+					Z502InvalidateTLB(victimvpn);
+					if(Temp==1){ //only a dirty victim is written, a clean one is still good on disk
+						slot = GetSwapSlot(victimpid, victimvpn);
+						if(WriteToDisk(SwapDisk(slot), SwapSector(slot),(char *) &MEMORY[frame_number*PGSIZE])==0){ //ĸinterruptˣ÷ŵĸdiskأʱȶŵ1	
+							READ_MODIFY(MEMORY_INTERLOCK_BASE+4, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //frametable
+							WaitForDiskStart(CURRENTPCB->Processid);
+							READ_MODIFY(MEMORY_INTERLOCK_BASE+4, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //frametable
+						}
+						pagingstats.pageouts++;
+					}
+					else pagingstats.cleanevictions++;
+					framemap[frame_number].pinned &= ~FRAME_BUSY;
 
 					//»õframe
-					Z502_PAGE_TBL_ADDR[(UINT16) status] =  (UINT16)frame_number|PTBL_VALID_BIT;
-					frametable[frame_number] = status; //1ʾ
-					pidprint[frame_number] = CURRENTPCB->Processid;
+					*TableEntry(Z502_PAGE_TBL_ADDR, status) =  (UINT16)frame_number|PTBL_VALID_BIT;
+					SetFrameOwner(frame_number, CURRENTPCB->Processid, status); //1ʾ
 				}
 			}
+			ReadAhead(CURRENTPCB->Processid, status);
 			//READ_MODIFY(MEMORY_INTERLOCK_BASE+5, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //frametable
 		}
 		else{ //validе
@@ -449,11 +796,13 @@ void    fault_handler( void )
 		READ_MODIFY(MEMORY_INTERLOCK_BASE+4, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //frametable
 		while(IsEmpty(readyqueue)){ //while nothing in readyqueue, do idle
 			printf("");
-			CALL(Z502Idle());
+			if(PageCleaner()==0&&FlushBufferCache(0)==0){
+				CALL(Z502Idle());
+			}
 		}
 		//until something appear in readyqueue, we switch to that process
 		memcpy(CURRENTPCB, &readyqueue->front->data,sizeof(Process_Control_Block));
-		CALL(Z502SwitchContext( SWITCH_CONTEXT_SAVE_MODE, &readyqueue->front->data.context)); //switch to first one in readyqueue*/
+		CALL(Z502SwitchContext( SWITCH_CONTEXT_SAVE_MODE, &CURRENTPCB->context)); //switch to first one in readyqueue*/
 	}
 	else if(device_id == INVALID_PHYSICAL_MEMORY){//receive 3
 		CALL(Z502Halt());
@@ -487,14 +836,25 @@ void    svc( SYSTEM_CALL_DATA *SystemCallData ) {
 	void					*processaddress;//for get argument from test.c
 	INT32					processpriority;//for get argument from test.c
 	INT32					processid;//for get argument from test.c
+	INT32					endedpid; //the process TERMINATE_PROCESS ended, -1 if none
 	PCBNode					pnode;
 	INT32					icount,jcount; //the temp count
 	Process_Control_Block	pcbtemp;   //for temperory pcb store
 	INT32					LockResult;//return the result for read_modify
 	char					*messagebuff;       //for message handle
 	INT32					sendlength,receivelength; //for message handle
+	INT32					pagecount; //for message handle, pages handed over
+	INT32					pageflag; //for message handle, MESSAGE_PAGES when the buffer is virtual memory to hand over
+	SharedArea				*psharedarea; //for shared area
+	Mailbox					*pbox; //for message handle
+	Messagestr				messagetemp; //for message handle
 	INT32					disk_id,sector;
 	char					*char_data;
+	INT32					sectorcount; //for vectored disk handle
+	char					**user_list; //the buffers of the process, one for each sector
+	char					*disk_list[MAX_DISK_VECTOR]; //the buffers the disk fills, a cached sector goes to disk_buffer_read
+	INT32					runstart,runcount; //the sectors of the vector one disk request reads
+	INT32					mincomplete; //for disk ring handle
 	char					disk_buffer_write[PGSIZE ];
 	char					disk_buffer_read[PGSIZE ];
 
@@ -529,12 +889,22 @@ void    svc( SYSTEM_CALL_DATA *SystemCallData ) {
 		**************************************************************************************************************************************/
         case SYSNUM_TERMINATE_PROCESS:
 			processid = (INT32 )SystemCallData->Argument[0];
-			//unit lock
+			endedpid = -1;
+			//unit lock, the frametable first like the interrupt handler, the pages are released under the queue locks
+			READ_MODIFY(MEMORY_INTERLOCK_BASE+4, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //frametable
 			READ_MODIFY(MEMORY_INTERLOCK_BASE+0, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //readyqueue
 			READ_MODIFY(MEMORY_INTERLOCK_BASE+1, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult);//timerqueue
 			READ_MODIFY(MEMORY_INTERLOCK_BASE+2, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult);//suspendqueue
 			if(processid ==-2){ //If process_id = -2, then terminate self and any child processes.
+				READ_MODIFY(MEMORY_INTERLOCK_BASE+0, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult);//readyqueue
+				READ_MODIFY(MEMORY_INTERLOCK_BASE+1, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult);//timerqueue
+				READ_MODIFY(MEMORY_INTERLOCK_BASE+2, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult);//suspendqueue
+				READ_MODIFY(MEMORY_INTERLOCK_BASE+4, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //frametable, the disk interrupts need it for the drain
 				CALL(dospprint("DONE", start_PCB->Processid, CURRENTPCB));
+				DrainBufferCache();
+				PrintPagingReport();
+				PrintDiskReport();
+				ReportCacheStats();
 				CALL(Z502Halt());
 			}
 			else if(processid ==-1){ //If process_id = -1, then terminate self	
@@ -542,6 +912,9 @@ void    svc( SYSTEM_CALL_DATA *SystemCallData ) {
 				//printf("CURRENTName:%s,CURRENTPID:%d,TARGETPID:%d\n",CURRENTPCB->Name, CURRENTPCB->Processid,processid);
 				CALL(RemoveQueueByName(readyqueue, CURRENTPCB->Name));
 				//printf("CURRENTName:%s,CURRENTPID:%d,TARGETPID:%d\n",CURRENTPCB->Name, CURRENTPCB->Processid,processid);
+				ReleaseSharedAreas(CURRENTPCB->Processid);
+				ReleaseProcessPages(CURRENTPCB->Processid);
+				endedpid = CURRENTPCB->Processid;
 				*(INT32 *)SystemCallData->Argument[1] = ERR_SUCCESS;
 				//CALL(ListTwoQueue()); //for debug
 			}
@@ -551,6 +924,9 @@ void    svc( SYSTEM_CALL_DATA *SystemCallData ) {
 				while(pnode!=NULL&&icount<=readyqueue->size){
 					if(pnode->data.Processid == processid){
 						CALL(RemoveQueueByName(readyqueue, pnode->data.Name)); //if remove one node, we can jump out of the loop
+						ReleaseSharedAreas(processid);
+						ReleaseProcessPages(processid);
+						endedpid = processid;
 						*(INT32 *)SystemCallData->Argument[1] = ERR_SUCCESS;
 						break;
 					}
@@ -561,22 +937,33 @@ void    svc( SYSTEM_CALL_DATA *SystemCallData ) {
 				while(pnode!=NULL&&icount<=readyqueue->size){
 					if(pnode->data.Processid == processid){
 						CALL(RemoveQueueByName(timerqueue, pnode->data.Name)); 
+						ReleaseSharedAreas(processid);
+						ReleaseProcessPages(processid);
+						endedpid = processid;
 						*(INT32 *)SystemCallData->Argument[1] = ERR_SUCCESS;
 						break;
 					}
 					pnode = pnode->next;
 				}	
 			}
+			LoadControl(); //the pages are free now, a swapped process may fit again
 			//unlock
 			READ_MODIFY(MEMORY_INTERLOCK_BASE+0, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult);//readyqueue
 			READ_MODIFY(MEMORY_INTERLOCK_BASE+1, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult);//timerqueue
 			READ_MODIFY(MEMORY_INTERLOCK_BASE+2, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult);//suspendqueue
+			READ_MODIFY(MEMORY_INTERLOCK_BASE+4, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //frametable
+			ReleaseMessages(endedpid); //it takes the mailbox lock before the frametable one
+			ReleaseIORing(endedpid); //it idles for the ring requests on a disk, no lock may be held
 			if(processid ==-1){
 				CALL(dospprint("DONE", CURRENTPCB->Processid, CURRENTPCB));
 			}
 			else CALL(dospprint("DONE", processid, CURRENTPCB));
 			
 			if(IsEmpty(readyqueue)&&IsEmpty(timerqueue)){
+				DrainBufferCache();
+				PrintPagingReport();
+				PrintDiskReport();
+				ReportCacheStats();
 				CALL(Z502Halt());
 			}
 			//WARN!!! we cant lock system with idle between lock and unlock, that lead to unexpected ERROR! well, the interrupt will not work good
@@ -592,7 +979,7 @@ void    svc( SYSTEM_CALL_DATA *SystemCallData ) {
 				CALL(Z502Idle());  //after idle, system callback here, do loop again
 			}
 			memcpy(CURRENTPCB, &readyqueue->front->data,sizeof(Process_Control_Block)); //memory copy for the pointer type CURRENTPCB
-			CALL(Z502SwitchContext( SWITCH_CONTEXT_SAVE_MODE, &readyqueue->front->data.context)); 
+			CALL(Z502SwitchContext( SWITCH_CONTEXT_SAVE_MODE, &CURRENTPCB->context)); 
 							
 			//below are old logic after terminate, after change the reset time, we dont need these logic now
 			/*if(IsEmpty(readyqueue)){ //ֹreadyqueue˵Ĵ
@@ -684,11 +1071,13 @@ void    svc( SYSTEM_CALL_DATA *SystemCallData ) {
 				else{//if not, choose the most recently time
 					printf("timer is busy,readyqueue:%d timequeue:%d\n",readyqueue->size,timerqueue->size);
 				}	*/
-				CALL(Z502Idle());
+				if(PageCleaner()==0&&FlushBufferCache(0)==0){
+					CALL(Z502Idle());
+				}
 			}
 			//until something appear in readyqueue, we switch to that process
 			memcpy(CURRENTPCB, &readyqueue->front->data,sizeof(Process_Control_Block));
-			CALL(Z502SwitchContext( SWITCH_CONTEXT_SAVE_MODE, &readyqueue->front->data.context)); //switch to first one in readyqueue
+			CALL(Z502SwitchContext( SWITCH_CONTEXT_SAVE_MODE, &CURRENTPCB->context)); //switch to first one in readyqueue
 			break;
 		/**************************************************************************************************************************************
 		char process_name[N];
@@ -722,7 +1111,7 @@ void    svc( SYSTEM_CALL_DATA *SystemCallData ) {
 					*(INT32 *)SystemCallData->Argument[4] = DEVICE_IN_USE; 
 					printf("ERROR! the processname '%s' is already exsited.\n",processname);
 					memcpy(CURRENTPCB, &readyqueue->front->data,sizeof(Process_Control_Block)); 
-					CALL(Z502SwitchContext( SWITCH_CONTEXT_SAVE_MODE, &readyqueue->front->data.context));
+					CALL(Z502SwitchContext( SWITCH_CONTEXT_SAVE_MODE, &CURRENTPCB->context));
 				}
 				else{
 					*(INT32 *)SystemCallData->Argument[4] = ERR_SUCCESS; 
@@ -807,13 +1196,13 @@ void    svc( SYSTEM_CALL_DATA *SystemCallData ) {
 					break;
 				}
 				else if(IsPidExist(readyqueue, processid)){
-					pcbtemp = GetPcbByPid(readyqueue,processid);
+					pcbtemp = GetPcbByPid(processid);
 					CALL(AddToSuspendQueue(suspendqueue,&pcbtemp));
 					CALL(RemoveQueueByPid(readyqueue,processid));
 					*(INT32 *)SystemCallData->Argument[1] = ERR_SUCCESS;
 				}
 				else if(IsPidExist(timerqueue, processid)){
-					pcbtemp = GetPcbByPid(timerqueue,processid);
+					pcbtemp = GetPcbByPid(processid);
 					CALL(AddToSuspendQueue(suspendqueue,&pcbtemp));
 					CALL(RemoveQueueByPid(timerqueue,processid));
 					*(INT32 *)SystemCallData->Argument[1] = ERR_SUCCESS;
@@ -867,7 +1256,7 @@ void    svc( SYSTEM_CALL_DATA *SystemCallData ) {
 			else{
 				//READ_MODIFY(MEMORY_INTERLOCK_BASE+0, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult);//it get deadlock here?
 				if(IsPidExist(readyqueue, processid)!=1){ //no matter it come from readyqueue or timerqueue, it resume back to readyqueue!
-					pcbtemp = GetPcbByPid(suspendqueue,processid);
+					pcbtemp = GetPcbByPid(processid);
 					CALL(AddToReadyQueueByPriority(readyqueue,&pcbtemp));
 					CALL(RemoveQueueByPid(suspendqueue,processid));
 					*(INT32 *)SystemCallData->Argument[1] = ERR_SUCCESS;
@@ -1010,130 +1399,75 @@ void    svc( SYSTEM_CALL_DATA *SystemCallData ) {
 			//init return argument
 			*(INT32 *)SystemCallData->Argument[3] = ERR_SUCCESS; //only error lead to other return
 
-			if(sendlength>64){//I use the 64 as message length limit
+			pageflag = (INT32)(long)SystemCallData->Argument[4]; //SEND_MESSAGE_PAGES says so, SEND_MESSAGE leaves it 0
+			pagecount = 0;
+			if(pageflag==MESSAGE_PAGES){ //the buffer is a virtual address, its pages are handed over
+				if(IsHandoffBuffer((long)messagebuff, sendlength)!=1){
+					printf("ERROR! The send_length:%d is illegal\n",sendlength);
+					*(INT32 *)SystemCallData->Argument[3] = ERR_ILLEGAL_ADDRESS;
+					break;
+				}
+				pagecount = (sendlength+PGSIZE-1)/PGSIZE;
+				if(IsPageResident((INT32)((long)messagebuff/PGSIZE), pagecount)!=1){
+					printf("ERROR! The pages of the message have to be in memory\n");
+					*(INT32 *)SystemCallData->Argument[3] = ERR_ILLEGAL_ADDRESS;
+					break;
+				}
+				if(framepinnedcount+pagecount>PhysMemPages/2){ //the clock needs frames it can take
+					printf("ERROR! Too many pages are in messages now\n");
+					*(INT32 *)SystemCallData->Argument[3] = ERR_ILLEGAL_ADDRESS;
+					break;
+				}
+			}
+			else if(sendlength>64){//I use the 64 as message length limit
 				printf("ERROR! The send_length:%d is illegal\n",sendlength);
 				*(INT32 *)SystemCallData->Argument[3] = ERR_ILLEGAL_ADDRESS;
 				break;
 			}
-			if(sendlength<strlen(messagebuff)){ //if the real message is large than the buff length, ERROR
+			else if(sendlength<strlen(messagebuff)){ //if the real message is large than the buff length, ERROR
 				printf("ERROR! The send_length:%d is not enough\n",sendlength);
 				*(INT32 *)SystemCallData->Argument[3] = ERR_ILLEGAL_ADDRESS;
 				break;
 			}
-			if(processid == -1){//if processid is -1, broadcase
-				//printf("the processid:%d, let's broadcast messages\n",processid);
-				//just insert into messagelist
-				if(messagecount>MessageLimit-1){ //limit message number 100
-						printf("ERROR! The limit number of messages is 100\n");
-						*(INT32 *)SystemCallData->Argument[3] = ERR_ILLEGAL_ADDRESS;
-						break;
-				}
-				else{
-					READ_MODIFY(MEMORY_INTERLOCK_BASE+3, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult);//messagelist
-					//fill the data to messagelist
-					messagelist[messagecount].actual_send_length = strlen(messagebuff);
-					messagelist[messagecount].actual_source_pid = CURRENTPCB->Processid;
-					messagelist[messagecount].loop_count = 0; //no use
-					strcpy(messagelist[messagecount].msg_buffer,messagebuff);
-					messagelist[messagecount].receive_length = 0; //init receive buff,no use
-					messagelist[messagecount].send_length = sendlength;
-					messagelist[messagecount].source_pid = CURRENTPCB->Processid; 
-					messagelist[messagecount].target_pid = processid;//store -1 here, well, sp print cant show it
-					messagecount++;
-					READ_MODIFY(MEMORY_INTERLOCK_BASE+3, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult);//messagelist
-				}	
-			}
-			else if(processid<0||processid>99){
+			if(processid<-1||processid>99){
 				printf("ERROR! The processid:%d is illegal\n",processid);
 				*(INT32 *)SystemCallData->Argument[3] = ERR_ILLEGAL_ADDRESS;
 				break;
 			}
-			else{
-				if(processid==CURRENTPCB->Processid){//can sender send to itself?
-					//yes, we do yes here
-					if(messagecount>MessageLimit-1){ //limit message number 100
-						printf("ERROR! The limit number of messages is 100\n");
-						*(INT32 *)SystemCallData->Argument[3] = ERR_ILLEGAL_ADDRESS;
-						break;
-					}
-					else{
-						READ_MODIFY(MEMORY_INTERLOCK_BASE+3, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult);//messagelist
-						//fill data to messagelist
-						messagelist[messagecount].actual_send_length = strlen(messagebuff);  
-						messagelist[messagecount].actual_source_pid = CURRENTPCB->Processid;
-						messagelist[messagecount].loop_count = 0; //no use
-						strcpy(messagelist[messagecount].msg_buffer,messagebuff);
-						messagelist[messagecount].receive_length = 0;//no use
-						messagelist[messagecount].send_length = sendlength;
-						messagelist[messagecount].source_pid = CURRENTPCB->Processid;
-						messagelist[messagecount].target_pid = processid;
-						messagecount++;
-						READ_MODIFY(MEMORY_INTERLOCK_BASE+3, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult);//messagelist
-					}	
-				}
-				//if the receive pid is not exsited? 
-				else if(IsPidExist(readyqueue,processid)!=1&&IsPidExist(timerqueue,processid)!=1&&IsPidExist(suspendqueue,processid)!=1){ 
-					//no, we are not allow to do this
-					printf("ERROR! the pid is not exsited in OS queue!");
-					*(INT32 *)SystemCallData->Argument[3] = ERR_ILLEGAL_ADDRESS;
-					break;
-				}
-				else if(IsPidExist(suspendqueue,processid)==1){//if the targetpid is in suspendqueue, we resume that process
-					if(messagecount>MessageLimit-1){//limit message number 100
-						printf("ERROR! The limit number of messages is 100\n");
-						*(INT32 *)SystemCallData->Argument[3] = ERR_ILLEGAL_ADDRESS;
-						break;
-					}
-					else{
-						READ_MODIFY(MEMORY_INTERLOCK_BASE+0, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult);//readyqueue
-						READ_MODIFY(MEMORY_INTERLOCK_BASE+2, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult);//suspendqueue
-						READ_MODIFY(MEMORY_INTERLOCK_BASE+3, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult);//messagelist
-						//resume pid readyqueue
-						pcbtemp = GetPcbByPid(suspendqueue,processid);
-						CALL(AddToReadyQueueByPriority(readyqueue,&pcbtemp));
-						CALL(RemoveQueueByPid(suspendqueue,processid));
-						//renew the messagelist
-						messagelist[messagecount].actual_send_length = strlen(messagebuff); 
-						messagelist[messagecount].actual_source_pid = CURRENTPCB->Processid;
-						messagelist[messagecount].loop_count = 0; //no use
-						strcpy(messagelist[messagecount].msg_buffer,messagebuff);
-						messagelist[messagecount].receive_length = 0; //no use
-						messagelist[messagecount].send_length = sendlength;
-						messagelist[messagecount].source_pid = CURRENTPCB->Processid;
-						messagelist[messagecount].target_pid = processid;
-						messagecount++;
-						//*(INT32 *)SystemCallData->Argument[3] = ERR_SUCCESS;
-						READ_MODIFY(MEMORY_INTERLOCK_BASE+0, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult);//readyqueue
-						READ_MODIFY(MEMORY_INTERLOCK_BASE+2, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult);//suspendqueue
-						READ_MODIFY(MEMORY_INTERLOCK_BASE+3, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult);//messagelist
-						dospprint("RESUME", processid, CURRENTPCB);
-					}
-				}
-				else{
-					if(messagecount>MessageLimit-1){ //limit message number 100
-						printf("ERROR! The limit number of messages is 100\n");
-						*(INT32 *)SystemCallData->Argument[3] = ERR_ILLEGAL_ADDRESS;
-						break;
-					}
-					READ_MODIFY(MEMORY_INTERLOCK_BASE+0, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult);//readyqueue
-					READ_MODIFY(MEMORY_INTERLOCK_BASE+2, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult);//suspendqueue
-					READ_MODIFY(MEMORY_INTERLOCK_BASE+3, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult);//messagelist
-					//messagelist
-					messagelist[messagecount].actual_send_length = strlen(messagebuff);  
-					messagelist[messagecount].actual_source_pid = CURRENTPCB->Processid;
-					messagelist[messagecount].loop_count = 0; //no use
-					strcpy(messagelist[messagecount].msg_buffer,messagebuff);
-					messagelist[messagecount].receive_length = 0; //no use
-					messagelist[messagecount].send_length = sendlength;
-					messagelist[messagecount].source_pid = CURRENTPCB->Processid;
-					messagelist[messagecount].target_pid = processid;
-					messagecount++;
-					//*(INT32 *)SystemCallData->Argument[3] = ERR_SUCCESS;
-					READ_MODIFY(MEMORY_INTERLOCK_BASE+0, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult);//readyqueue
-					READ_MODIFY(MEMORY_INTERLOCK_BASE+2, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult);//suspendqueue
-					READ_MODIFY(MEMORY_INTERLOCK_BASE+3, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult);//messagelist
-				}
-			}		
+			//if the receive pid is not exsited? no, we are not allow to do this. -1 is broadcast, and the sender can send to itself
+			if(processid!=-1&&processid!=CURRENTPCB->Processid&&IsPidExist(readyqueue,processid)!=1&&IsPidExist(timerqueue,processid)!=1&&IsPidExist(suspendqueue,processid)!=1){ 
+				printf("ERROR! the pid is not exsited in OS queue!");
+				*(INT32 *)SystemCallData->Argument[3] = ERR_ILLEGAL_ADDRESS;
+				break;
+			}
+			READ_MODIFY(MEMORY_INTERLOCK_BASE+3, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult);//mailbox
+			Temp = AddToMailbox(processid, messagebuff, sendlength, pagecount); //the mailbox may be full, look under the lock
+			READ_MODIFY(MEMORY_INTERLOCK_BASE+3, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult);//mailbox
+			if(Temp!=1){ //limit message number of the mailbox
+				printf("ERROR! The limit number of messages is %d\n", MailboxSize);
+				*(INT32 *)SystemCallData->Argument[3] = ERR_ILLEGAL_ADDRESS;
+				break;
+			}
+			//a broadcast resumes the first process waiting for anyone, a message resumes its target if that is suspended
+			READ_MODIFY(MEMORY_INTERLOCK_BASE+0, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult);//readyqueue
+			READ_MODIFY(MEMORY_INTERLOCK_BASE+2, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult);//suspendqueue
+			jcount = -1;
+			if(processid == -1){
+				jcount = FindBroadcastWaiter();
+			}
+			else if(processid!=CURRENTPCB->Processid&&IsPidExist(suspendqueue,processid)==1){
+				jcount = processid;
+			}
+			if(jcount>=0){
+				pcbtemp = GetPcbByPid(jcount);
+				CALL(AddToReadyQueueByPriority(readyqueue,&pcbtemp));
+				CALL(RemoveQueueByPid(suspendqueue,jcount));
+			}
+			READ_MODIFY(MEMORY_INTERLOCK_BASE+0, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult);//readyqueue
+			READ_MODIFY(MEMORY_INTERLOCK_BASE+2, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult);//suspendqueue
+			if(jcount>=0){
+				dospprint("RESUME", jcount, CURRENTPCB);
+			}
 			break;
 		/**************************************************************************************************************************************
 		INT32 source_pid;
@@ -1159,7 +1493,8 @@ void    svc( SYSTEM_CALL_DATA *SystemCallData ) {
 			*(INT32 *)SystemCallData->Argument[3] = 0; //actual_send_length return
 			*(INT32 *)SystemCallData->Argument[4] = 0; //actual_source_pid return, there is a situation -1
 			*(INT32 *)SystemCallData->Argument[5] = ERR_SUCCESS; //default success, only error lead to other return
-			if(receivelength>64){
+			pageflag = (INT32)(long)SystemCallData->Argument[6]; //RECEIVE_MESSAGE_PAGES says so, RECEIVE_MESSAGE leaves it 0
+			if((pageflag==MESSAGE_PAGES&&IsHandoffBuffer((long)SystemCallData->Argument[1], receivelength)!=1)||(pageflag!=MESSAGE_PAGES&&receivelength>64)){
 				printf("ERROR! The receivelength:%d is illegal\n",receivelength);
 				*(INT32 *)SystemCallData->Argument[5] = ERR_ILLEGAL_ADDRESS;
 				break;
@@ -1168,45 +1503,56 @@ void    svc( SYSTEM_CALL_DATA *SystemCallData ) {
 				//printf("the processid:%d, let's recevie any message send to us from anyone\n",processid);
 				jcount = 0;	//everytime after suspend, we need to receive again, this is count for this
 				while(jcount==0){ //only get pid count for once
-					for(icount = 0;icount<messagecount;icount++){
-						if(messagelist[icount].target_pid == CURRENTPCB->Processid||messagelist[icount].target_pid==-1){ //if targetpid is -1, also receive it
-							//printf("pid:%d receive %s from pid:%d\n",CURRENTPCB->Processid,messagelist[icount].msg_buffer,messagelist[icount].source_pid);
-							if(receivelength<strlen(messagelist[icount].msg_buffer)){//if the receive length is larger than buff, ERROR
-								printf("ERROR! The receivelength:%d is not enough\n",receivelength);
-								*(INT32 *)SystemCallData->Argument[5] = ERR_ILLEGAL_ADDRESS;
-								jcount++;
-								break;
-							}
-							else{
-								strcpy((char *)SystemCallData->Argument[1],messagelist[icount].msg_buffer);//return the received message
+					//the older one of our mailbox and the broadcast mailbox, the mailbox stays locked until we are a waiter
+					READ_MODIFY(MEMORY_INTERLOCK_BASE+3, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult);//mailbox
+					pbox = FindMessage(CURRENTPCB->Processid, -1, &icount);
+					if(pbox!=NULL){
+						//printf("pid:%d receive %s from pid:%d\n",CURRENTPCB->Processid,GetMessageAt(pbox,icount)->msg_buffer,GetMessageAt(pbox,icount)->source_pid);
+						if(IsMessageFit(GetMessageAt(pbox, icount), receivelength, pageflag)!=1){//if the receive length is larger than buff, ERROR
+							READ_MODIFY(MEMORY_INTERLOCK_BASE+3, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult);//mailbox
+							printf("ERROR! The receivelength:%d is not enough\n",receivelength);
+							*(INT32 *)SystemCallData->Argument[5] = ERR_ILLEGAL_ADDRESS;
+						}
+						else{
+							messagetemp = *GetMessageAt(pbox, icount);
+							RemoveFromMailbox(pbox, icount);
+							READ_MODIFY(MEMORY_INTERLOCK_BASE+3, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult);//mailbox
+							if(messagetemp.page_count>0){ //the pages go to the receive buffer
+								AttachPages((INT32)((long)SystemCallData->Argument[1]/PGSIZE), messagetemp.page_count, messagetemp.frames);
 							}
-							//*(INT32 *)SystemCallData->Argument[3] = messagelist[icount].actual_send_length; //this return value is also confused
-							*(INT32 *)SystemCallData->Argument[3] = messagelist[icount].send_length; //it should be actural length, but the requirement..ok,just return send_lengh
-							*(INT32 *)SystemCallData->Argument[4] = messagelist[icount].actual_source_pid; //actual_source_pid reture	
-							//lock for messagelist
-							READ_MODIFY(MEMORY_INTERLOCK_BASE+3, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult);//messagelist
-							messageprocess(messagelist[icount].msg_buffer);
-							removefrommessagelist(icount);
-							READ_MODIFY(MEMORY_INTERLOCK_BASE+3, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult);//messagelist
-							jcount++;
-							break; //can break when get one message
+							else strcpy((char *)SystemCallData->Argument[1],messagetemp.msg_buffer);//return the received message
+							//*(INT32 *)SystemCallData->Argument[3] = messagetemp.actual_send_length; //this return value is also confused
+							*(INT32 *)SystemCallData->Argument[3] = messagetemp.send_length; //it should be actural length, but the requirement..ok,just return send_lengh
+							*(INT32 *)SystemCallData->Argument[4] = messagetemp.actual_source_pid; //actual_source_pid reture	
+							messageprocess(messagetemp.msg_buffer);
 						}
+						jcount++; //can stop when get one message
 					}
 					*(INT32 *)SystemCallData->Argument[5] = ERR_SUCCESS;
 					//if no message receive, suspend itself
 					if(jcount == 0){
 						READ_MODIFY(MEMORY_INTERLOCK_BASE+0, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult);//readyqueue
 						READ_MODIFY(MEMORY_INTERLOCK_BASE+2, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult);//suspendqueue
-						//printf("pid:%d receive nothing from pid:%d,suspend itself\n",CURRENTPCB->Processid,messagelist[icount].source_pid);
-						pcbtemp = GetPcbByPid(readyqueue,CURRENTPCB->Processid);
+						//printf("pid:%d receive nothing, suspend itself\n",CURRENTPCB->Processid);
+						pcbtemp = GetPcbByPid(CURRENTPCB->Processid);
 						CALL(AddToSuspendQueue(suspendqueue,&pcbtemp));
 						CALL(RemoveQueueByPid(readyqueue,CURRENTPCB->Processid));
+						BeginReceiveWait(CURRENTPCB->Processid, -1); //a broadcast can resume us
 						READ_MODIFY(MEMORY_INTERLOCK_BASE+0, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult);//readyqueue
 						READ_MODIFY(MEMORY_INTERLOCK_BASE+2, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult);//suspendqueue
+						READ_MODIFY(MEMORY_INTERLOCK_BASE+3, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult);//mailbox
 						dospprint("SUSPEND", CURRENTPCB->Processid, CURRENTPCB);//because the pid is -1, we get real pid here
 						//suspend itself and switch to readyqueue
+						while(IsEmpty(readyqueue)){ //everyone may wait, then idle until a sleeper wakes up
+							CALL(Z502Idle());
+						}
 						memcpy(CURRENTPCB, &readyqueue->front->data,sizeof(Process_Control_Block));
 						CALL(Z502SwitchContext( SWITCH_CONTEXT_SAVE_MODE, &CURRENTPCB->context));
+						READ_MODIFY(MEMORY_INTERLOCK_BASE+0, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult);//readyqueue
+						READ_MODIFY(MEMORY_INTERLOCK_BASE+2, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult);//suspendqueue
+						EndReceiveWait(CURRENTPCB->Processid);
+						READ_MODIFY(MEMORY_INTERLOCK_BASE+0, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult);//readyqueue
+						READ_MODIFY(MEMORY_INTERLOCK_BASE+2, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult);//suspendqueue
 						//after switch back, we do recevie again, well, it just for test1j
 					}
 				}		
@@ -1217,65 +1563,52 @@ void    svc( SYSTEM_CALL_DATA *SystemCallData ) {
 				break;
 			}
 			else{
-				if(IsSourcePidExsit(processid)!=1){ //if the source pid is not in messagelist, suspend itself, it is legal here
+				READ_MODIFY(MEMORY_INTERLOCK_BASE+3, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult);//mailbox
+				if(IsSourcePidExsit(CURRENTPCB->Processid, processid)!=1){ //if the source pid has no message pending for us, suspend itself, it is legal here
 					READ_MODIFY(MEMORY_INTERLOCK_BASE+0, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult);//readyqueue
 					READ_MODIFY(MEMORY_INTERLOCK_BASE+2, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult);//suspendqueue
-					//printf("the source_pid is not exsited in messagelist\n");
-					pcbtemp = GetPcbByPid(readyqueue,CURRENTPCB->Processid);
+					//printf("the source_pid has no message pending\n");
+					pcbtemp = GetPcbByPid(CURRENTPCB->Processid);
 					CALL(AddToSuspendQueue(suspendqueue,&pcbtemp));
 					CALL(RemoveQueueByPid(readyqueue,CURRENTPCB->Processid));
+					BeginReceiveWait(CURRENTPCB->Processid, processid);
 					READ_MODIFY(MEMORY_INTERLOCK_BASE+0, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult);//readyqueue
 					READ_MODIFY(MEMORY_INTERLOCK_BASE+2, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult);//suspendqueue
+					READ_MODIFY(MEMORY_INTERLOCK_BASE+3, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult);//mailbox
 					dospprint("SUSPEND", processid, CURRENTPCB);
 					//suspend itself and switch to readyqueue
+					while(IsEmpty(readyqueue)){ //everyone may wait, then idle until a sleeper wakes up
+						CALL(Z502Idle());
+					}
 					memcpy(CURRENTPCB, &readyqueue->front->data,sizeof(Process_Control_Block));
 					CALL(Z502SwitchContext( SWITCH_CONTEXT_SAVE_MODE, &CURRENTPCB->context)); 
+					READ_MODIFY(MEMORY_INTERLOCK_BASE+0, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult);//readyqueue
+					READ_MODIFY(MEMORY_INTERLOCK_BASE+2, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult);//suspendqueue
+					EndReceiveWait(CURRENTPCB->Processid);
+					READ_MODIFY(MEMORY_INTERLOCK_BASE+0, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult);//readyqueue
+					READ_MODIFY(MEMORY_INTERLOCK_BASE+2, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult);//suspendqueue
 				}
 				else{
-					jcount = 0;
-					while(jcount==0){
-						//if targetpid is match and from the right source, just delete it
-						for(icount = 0;icount<messagecount;icount++){
-							if(messagelist[icount].target_pid == CURRENTPCB->Processid&&messagelist[icount].source_pid == processid){
-								//printf("pid:%d receive %s from pid:%d\n",CURRENTPCB->Processid,messagelist[icount].msg_buffer,messagelist[icount].source_pid);
-								if(receivelength<strlen(messagelist[icount].msg_buffer)){//if the receive length is larger than buff, ERROR
-									printf("ERROR! The receivelength:%d is not enough\n",receivelength);
-									*(INT32 *)SystemCallData->Argument[5] = ERR_ILLEGAL_ADDRESS;
-									jcount++;
-									break; 
-								}
-								else{
-									strcpy((char *)SystemCallData->Argument[1],messagelist[icount].msg_buffer);//return message received
-								}
-								//*(INT32 *)SystemCallData->Argument[3] = messagelist[icount].actual_send_length; 
-								*(INT32 *)SystemCallData->Argument[3] = messagelist[icount].send_length; //confused value, ok for test1j
-								*(INT32 *)SystemCallData->Argument[4] = messagelist[icount].actual_source_pid;
-								//lock for messagelist
-								READ_MODIFY(MEMORY_INTERLOCK_BASE+3, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult);//messagelist
-								messageprocess(messagelist[icount].msg_buffer);
-								removefrommessagelist(icount);
-								READ_MODIFY(MEMORY_INTERLOCK_BASE+3, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult);//messagelist
-								//everytime after suspend, we need to receive again, this is count for this
-								jcount++; 
-								break;//one time get one
-							}
-						}
-						//if that source has no message for curentpcb, suspend the currentpcb until send resume
-						if(jcount == 0){
-							READ_MODIFY(MEMORY_INTERLOCK_BASE+0, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult);//readyqueue
-							READ_MODIFY(MEMORY_INTERLOCK_BASE+2, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult);//suspendqueue
-							//printf("pid:%d receive nothing from pid:%d,suspend itself\n",CURRENTPCB->Processid,messagelist[icount].source_pid);
-							pcbtemp = GetPcbByPid(readyqueue,CURRENTPCB->Processid);
-							CALL(AddToSuspendQueue(suspendqueue,&pcbtemp));
-							CALL(RemoveQueueByPid(readyqueue,CURRENTPCB->Processid));
-							READ_MODIFY(MEMORY_INTERLOCK_BASE+0, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult);//readyqueue
-							READ_MODIFY(MEMORY_INTERLOCK_BASE+2, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult);//suspendqueue
-							//print when doing change
-							dospprint("SUSPEND", processid, CURRENTPCB);
-							//suspend itself and switch to readyqueue
-							memcpy(CURRENTPCB, &readyqueue->front->data,sizeof(Process_Control_Block));
-							CALL(Z502SwitchContext( SWITCH_CONTEXT_SAVE_MODE, &CURRENTPCB->context)); 
+					//the oldest message from that source to us, it is there
+					pbox = FindMessage(CURRENTPCB->Processid, processid, &icount);
+					//printf("pid:%d receive %s from pid:%d\n",CURRENTPCB->Processid,GetMessageAt(pbox,icount)->msg_buffer,processid);
+					if(IsMessageFit(GetMessageAt(pbox, icount), receivelength, pageflag)!=1){//if the receive length is larger than buff, ERROR
+						READ_MODIFY(MEMORY_INTERLOCK_BASE+3, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult);//mailbox
+						printf("ERROR! The receivelength:%d is not enough\n",receivelength);
+						*(INT32 *)SystemCallData->Argument[5] = ERR_ILLEGAL_ADDRESS;
+					}
+					else{
+						messagetemp = *GetMessageAt(pbox, icount);
+						RemoveFromMailbox(pbox, icount);
+						READ_MODIFY(MEMORY_INTERLOCK_BASE+3, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult);//mailbox
+						if(messagetemp.page_count>0){ //the pages go to the receive buffer
+							AttachPages((INT32)((long)SystemCallData->Argument[1]/PGSIZE), messagetemp.page_count, messagetemp.frames);
 						}
+						else strcpy((char *)SystemCallData->Argument[1],messagetemp.msg_buffer);//return message received
+						//*(INT32 *)SystemCallData->Argument[3] = messagetemp.actual_send_length; 
+						*(INT32 *)SystemCallData->Argument[3] = messagetemp.send_length; //confused value, ok for test1j
+						*(INT32 *)SystemCallData->Argument[4] = messagetemp.actual_source_pid;
+						messageprocess(messagetemp.msg_buffer);
 					}
 				}
 			}
@@ -1296,16 +1629,24 @@ void    svc( SYSTEM_CALL_DATA *SystemCallData ) {
 			disk_id = (INT32 )SystemCallData->Argument[0];
 			sector = (INT32 )SystemCallData->Argument[1];
 			char_data = (char *)SystemCallData->Argument[2];
+			if(disk_id<1||disk_id>MAX_NUMBER_OF_DISKS||sector<0||sector>=NUM_LOGICAL_SECTORS){ //the sectors after these are the swap space
+				printf("ERROR! Disk %d sector %d is not one a program can use\n",disk_id,sector);
+				break;
+			}
+			if(CacheWrite(disk_id, sector, char_data)==1) //the buffer has it now, the disk gets it with the flush
+				break;
 			//READ_MODIFY(MEMORY_INTERLOCK_BASE+4, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //disk
 			WriteToDisk(disk_id, sector, char_data);
 			//READ_MODIFY(MEMORY_INTERLOCK_BASE+4, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //disk
 			while(IsEmpty(readyqueue)){ //while nothing in readyqueue, do idle
 				printf("");
-				CALL(Z502Idle());
+				if(PageCleaner()==0&&FlushBufferCache(0)==0){
+					CALL(Z502Idle());
+				}
 			}
 			//until something appear in readyqueue, we switch to that process
 			memcpy(CURRENTPCB, &readyqueue->front->data,sizeof(Process_Control_Block));
-			CALL(Z502SwitchContext( SWITCH_CONTEXT_SAVE_MODE, &readyqueue->front->data.context)); //switch to first one in readyqueue*/
+			CALL(Z502SwitchContext( SWITCH_CONTEXT_SAVE_MODE, &CURRENTPCB->context)); //switch to first one in readyqueue*/
 			
 			break;
 		/**************************************************************************************************************************************
@@ -1323,16 +1664,195 @@ void    svc( SYSTEM_CALL_DATA *SystemCallData ) {
 			disk_id = (INT32 )SystemCallData->Argument[0];
 			sector = (INT32 )SystemCallData->Argument[1];
 			char_data = (char *)SystemCallData->Argument[2];
+			if(disk_id<1||disk_id>MAX_NUMBER_OF_DISKS||sector<0||sector>=NUM_LOGICAL_SECTORS){ //the sectors after these are the swap space
+				printf("ERROR! Disk %d sector %d is not one a program can use\n",disk_id,sector);
+				break;
+			}
+			if(CacheRead(disk_id, sector, char_data)==1) //a hit does not wait for the disk
+				break;
 			//READ_MODIFY(MEMORY_INTERLOCK_BASE+4, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //disk
 			ReadFromDisk(disk_id, sector, char_data);
 			//READ_MODIFY(MEMORY_INTERLOCK_BASE+4, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //disk
 			while(IsEmpty(readyqueue)){ //while nothing in readyqueue, do idle
 				printf("");
-				CALL(Z502Idle());
+				if(PageCleaner()==0&&FlushBufferCache(0)==0){
+					CALL(Z502Idle());
+				}
 			}
 			//until something appear in readyqueue, we switch to that process
 			memcpy(CURRENTPCB, &readyqueue->front->data,sizeof(Process_Control_Block));
-			CALL(Z502SwitchContext( SWITCH_CONTEXT_SAVE_MODE, &readyqueue->front->data.context)); //switch to first one in readyqueue*/
+			CALL(Z502SwitchContext( SWITCH_CONTEXT_SAVE_MODE, &CURRENTPCB->context)); //switch to first one in readyqueue*/
+			if(diskstatus[CURRENTPCB->Processid]==ERR_SUCCESS) //we run again when the read is done, a failed one has nothing to keep
+				CacheFill(disk_id, sector, char_data);
+			break;
+		/**************************************************************************************************************************************
+		INT32 starting_address_of_shared_area;
+		INT32 pages_in_shared_area;
+		char area_tag[32];
+		INT32 number_previous_sharers;
+		INT32 error;
+
+		DEFINE_SHARED_AREA( starting_address_of_shared_area, pages_in_shared_area, area_tag, &number_previous_sharers, &error );
+		Map pages_in_shared_area pages from starting_address_of_shared_area on to the shared area called area_tag. The first caller with 
+		a tag makes the area, the later ones with the same tag get the same physical memory, so all of them see what the others write. 
+		number_previous_sharers returns how many processes had the area before this call, the first one gets 0.
+		http://web.cs.wpi.edu/~jb/CS502/Project/appendixC.html
+		**************************************************************************************************************************************/
+		case SYSNUM_DEFINE_SHARED_AREA:
+			Temp = (INT32)(long)SystemCallData->Argument[0]; //starting address
+			pagecount = (INT32)(long)SystemCallData->Argument[1];
+			char_data = (char *)SystemCallData->Argument[2]; //tag
+			*(INT32 *)SystemCallData->Argument[3] = 0;
+			*(INT32 *)SystemCallData->Argument[4] = ERR_SUCCESS;
+			if(Temp<0||Temp%PGSIZE!=0||pagecount<=0||pagecount>SharedPageLimit||Temp/PGSIZE+pagecount>VIRTUAL_MEM_PGS){
+				printf("ERROR! The shared area at %d with %d pages is illegal\n",Temp,pagecount);
+				*(INT32 *)SystemCallData->Argument[4] = ERR_BAD_PARAM;
+				break;
+			}
+			READ_MODIFY(MEMORY_INTERLOCK_BASE+4, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //frametable
+			psharedarea = FindSharedArea(char_data);
+			if(psharedarea==NULL){ //the first one makes it
+				psharedarea = CreateSharedArea(char_data, pagecount);
+				if(psharedarea==NULL){
+					READ_MODIFY(MEMORY_INTERLOCK_BASE+4, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //frametable
+					printf("ERROR! There is no memory for the shared area %s\n",char_data);
+					*(INT32 *)SystemCallData->Argument[4] = ERR_BAD_PARAM;
+					break;
+				}
+			}
+			else if(pagecount>psharedarea->page_count){
+				READ_MODIFY(MEMORY_INTERLOCK_BASE+4, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //frametable
+				printf("ERROR! The shared area %s only has %d pages\n",char_data,psharedarea->page_count);
+				*(INT32 *)SystemCallData->Argument[4] = ERR_BAD_PARAM;
+				break;
+			}
+			MapPages(Temp/PGSIZE, pagecount, psharedarea->frames);
+			*(INT32 *)SystemCallData->Argument[3] = psharedarea->refcount;
+			if(psharedarea->sharer[CURRENTPCB->Processid]!=1){
+				psharedarea->sharer[CURRENTPCB->Processid] = 1;
+				psharedarea->refcount++;
+			}
+			READ_MODIFY(MEMORY_INTERLOCK_BASE+4, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //frametable
+			break;
+		/**************************************************************************************************************************************
+		INT16 disk_id;
+		INT16 sector;
+		INT32 count;
+		char *buffers[count];
+		INT32 error;
+
+		DISK_WRITEV( disk_id, sector, count, buffers, &error );
+		The count buffers are stored at <DISK_ID, sector>, <DISK_ID, sector+1> and on, with one request and one interrupt, the seek is 
+		paid once. count goes from 1 to MAX_DISK_VECTOR, a run that leaves the disk gives ERR_BAD_PARAM. The write goes to the disk now, 
+		the sectors that are in the buffer cache get the new data too. error is the status the disk gave the write.
+		**************************************************************************************************************************************/
+		case SYSNUM_DISK_WRITEV:
+			disk_id = (INT32)(long)SystemCallData->Argument[0];
+			sector = (INT32)(long)SystemCallData->Argument[1];
+			sectorcount = (INT32)(long)SystemCallData->Argument[2];
+			user_list = (char **)SystemCallData->Argument[3];
+			*(INT32 *)SystemCallData->Argument[4] = ERR_SUCCESS;
+			if(disk_id<1||disk_id>MAX_NUMBER_OF_DISKS||sectorcount<1||sectorcount>MAX_DISK_VECTOR||sector<0||sector+sectorcount>NUM_LOGICAL_SECTORS){
+				printf("ERROR! %d sectors from %d on disk %d are illegal\n",sectorcount,sector,disk_id);
+				*(INT32 *)SystemCallData->Argument[4] = ERR_BAD_PARAM;
+				break;
+			}
+			WriteSectorsToDisk(disk_id, sector, sectorcount, user_list);
+			CacheWriteSectors(disk_id, sector, sectorcount, user_list); //after the submit, an old dirty buffer cannot get to the disk first
+			while(IsEmpty(readyqueue)){ //while nothing in readyqueue, do idle
+				if(PageCleaner()==0&&FlushBufferCache(0)==0){
+					CALL(Z502Idle());
+				}
+			}
+			memcpy(CURRENTPCB, &readyqueue->front->data,sizeof(Process_Control_Block));
+			CALL(Z502SwitchContext( SWITCH_CONTEXT_SAVE_MODE, &CURRENTPCB->context)); //switch to first one in readyqueue
+			*(INT32 *)SystemCallData->Argument[4] = diskstatus[CURRENTPCB->Processid]; //we run again when the write is done
+			break;
+		/**************************************************************************************************************************************
+		INT16 disk_id;
+		INT16 sector;
+		INT32 count;
+		char *buffers[count];
+		INT32 error;
+
+		DISK_READV( disk_id, sector, count, buffers, &error );
+		The sectors <DISK_ID, sector>, <DISK_ID, sector+1> and on are returned in the count buffers, with one request and one interrupt. 
+		The sectors in the buffer cache are copied from there, the disk reads from the first missed sector to the last one in one request, 
+		when all of them are cached the disk is not used. A cached sector the disk may not have yet splits the run, the disk reads the 
+		missed sectors on each side of it. error is the first status the disk gave that is not ERR_SUCCESS, a sector that was never 
+		written gives ERR_NO_PREVIOUS_WRITE.
+		**************************************************************************************************************************************/
+		case SYSNUM_DISK_READV:
+			disk_id = (INT32)(long)SystemCallData->Argument[0];
+			sector = (INT32)(long)SystemCallData->Argument[1];
+			sectorcount = (INT32)(long)SystemCallData->Argument[2];
+			user_list = (char **)SystemCallData->Argument[3];
+			*(INT32 *)SystemCallData->Argument[4] = ERR_SUCCESS;
+			if(disk_id<1||disk_id>MAX_NUMBER_OF_DISKS||sectorcount<1||sectorcount>MAX_DISK_VECTOR||sector<0||sector+sectorcount>NUM_LOGICAL_SECTORS){
+				printf("ERROR! %d sectors from %d on disk %d are illegal\n",sectorcount,sector,disk_id);
+				*(INT32 *)SystemCallData->Argument[4] = ERR_BAD_PARAM;
+				break;
+			}
+			CacheReadSectors(disk_id, sector, sectorcount, user_list, disk_list, disk_buffer_read);
+			runstart = 0;
+			while((runstart = NextDiskRun(sectorcount, runstart, user_list, disk_list, &runcount))!=-1){
+				ReadSectorsFromDisk(disk_id, sector+runstart, runcount, &disk_list[runstart]);
+				while(IsEmpty(readyqueue)){ //while nothing in readyqueue, do idle
+					if(PageCleaner()==0&&FlushBufferCache(0)==0){
+						CALL(Z502Idle());
+					}
+				}
+				memcpy(CURRENTPCB, &readyqueue->front->data,sizeof(Process_Control_Block));
+				CALL(Z502SwitchContext( SWITCH_CONTEXT_SAVE_MODE, &CURRENTPCB->context)); //switch to first one in readyqueue
+				if(diskstatus[CURRENTPCB->Processid]!=ERR_SUCCESS){ //the disk read nothing of the run
+					*(INT32 *)SystemCallData->Argument[4] = diskstatus[CURRENTPCB->Processid];
+					break;
+				}
+				runstart += runcount;
+			}
+			break;
+		/**************************************************************************************************************************************
+		IO_RING ring;
+		INT32 error;
+
+		IO_RING_SETUP( &ring, &error );
+		The ring is shared from now on, the process puts its disk requests into the submission half and the OS puts their completions 
+		into the completion half. Both halves start empty. A process has one ring, it can take another one when nothing of the old one 
+		is on a disk, else the error is ERR_BAD_PARAM.
+		**************************************************************************************************************************************/
+		case SYSNUM_IO_RING_SETUP:
+			*(INT32 *)SystemCallData->Argument[1] = SetupIORing(CURRENTPCB->Processid, (IO_RING *)SystemCallData->Argument[0]);
+			break;
+		/**************************************************************************************************************************************
+		INT32 min_complete;
+		INT32 submitted;
+		INT32 error;
+
+		IO_RING_ENTER( min_complete, &submitted, &error );
+		All entries from sq_head to sq_tail go to their disk queues, as long as the completion half has room for them, the rest stay for 
+		the next call, submitted returns how many were taken. A read the buffer cache has completes at once, an entry with a bad disk, 
+		sector or opcode completes with ERR_BAD_PARAM. Then the caller is suspended until min_complete completions wait in the ring or 
+		none of its requests is left on a disk, 0 only submits.
+		**************************************************************************************************************************************/
+		case SYSNUM_IO_RING_ENTER:
+			mincomplete = (INT32)(long)SystemCallData->Argument[0];
+			*(INT32 *)SystemCallData->Argument[1] = 0;
+			*(INT32 *)SystemCallData->Argument[2] = ERR_SUCCESS;
+			if(ioring[CURRENTPCB->Processid]==NULL||mincomplete<0||mincomplete>IO_RING_ENTRIES){
+				printf("ERROR! The process %d has no ring or waits for %d completions\n",CURRENTPCB->Processid,mincomplete);
+				*(INT32 *)SystemCallData->Argument[2] = ERR_BAD_PARAM;
+				break;
+			}
+			*(INT32 *)SystemCallData->Argument[1] = SubmitIORing(CURRENTPCB->Processid);
+			while(SuspendForRing(CURRENTPCB->Processid, mincomplete)==1){ //the load controller may let it run before the completions are there
+				while(IsEmpty(readyqueue)){ //while nothing in readyqueue, do idle
+					if(PageCleaner()==0&&FlushBufferCache(0)==0){
+						CALL(Z502Idle());
+					}
+				}
+				memcpy(CURRENTPCB, &readyqueue->front->data,sizeof(Process_Control_Block));
+				CALL(Z502SwitchContext( SWITCH_CONTEXT_SAVE_MODE, &CURRENTPCB->context)); //switch to first one in readyqueue
+			}
 			break;
         default:
             printf( "* ERROR!  call_type not recognized!\n" );
@@ -1343,8 +1863,8 @@ void    svc( SYSTEM_CALL_DATA *SystemCallData ) {
 /************************************************************************
 below are universal routines for readyqueue, timerqueue and suspend queue
    
-   InitQueue, IsEmpty, IsPidExist, IsNameDuplicate, GetPIDByName,
-   GetPcbByPid, DeQueueFirstElement, RemoveQueueByName,RemoveQueueByPid
+   InitQueue, InitPriorityQueue, InitTimerQueue, IsEmpty, IsPidExist, IsNameDuplicate, GetPIDByName,
+   GetPcbByPid, DeQueueFirstElement, AppendNode, UnlinkNode, RemoveQueueByName,RemoveQueueByPid
 ************************************************************************/
 
 /************************************************************************
@@ -1362,6 +1882,44 @@ PCBQueue *InitQueue()
         pqueue->front = NULL;  
         pqueue->rear = NULL;  
         pqueue->size = 0;  
+        pqueue->buckets = NULL;  
+        pqueue->heap = NULL;  
+    }  
+    return pqueue;  
+} 
+
+/************************************************************************
+InitPriorityQueue
+//initialize a queue that also keeps one FIFO per priority level, used by readyqueue
+
+in: void
+out: queue
+************************************************************************/
+PCBQueue *InitPriorityQueue()  
+{  
+    PCBQueue *pqueue = InitQueue();  
+    if(pqueue!=NULL)  
+    {  
+        pqueue->buckets = (PriorityBuckets *)calloc(1, sizeof(PriorityBuckets));  
+    }  
+    return pqueue;  
+} 
+
+/************************************************************************
+InitTimerQueue
+//initialize a queue that also keeps a min-heap on wake up time, used by timerqueue
+
+in: void
+out: queue
+************************************************************************/
+PCBQueue *InitTimerQueue()  
+{  
+    PCBQueue *pqueue = InitQueue();  
+    if(pqueue!=NULL)  
+    {  
+        pqueue->heap = (TimerHeap *)calloc(1, sizeof(TimerHeap));  
+        pqueue->heap->capacity = ProcessLimit+1;  
+        pqueue->heap->entry = (PCBNode *)calloc(pqueue->heap->capacity, sizeof(PCBNode));  
     }  
     return pqueue;  
 } 
@@ -1390,17 +1948,10 @@ out: INT32(1/0)
 ************************************************************************/
 INT32 IsPidExist(PCBQueue *pqueue, INT32 pid)  
 {
-	PCBNode pnode;
-	INT32 icount;
+	PCBNode pnode = FindNodeByPid(pid);
 
-	pnode = pqueue->front;
-	icount =1;
-	while(pnode!=NULL&&icount<=pqueue->size){
-		if(pnode->data.Processid == pid){
-			return 1;
-		}
-		pnode = pnode->next;
-		icount++;
+	if(pnode!=NULL&&pnode->queue==pqueue){
+		return 1;
 	}
 	return 0;
 }
@@ -1413,18 +1964,8 @@ in: queue, process name
 out: INT32(1/0)
 ************************************************************************/
 INT32 IsNameDuplicate( PCBQueue *pqueue, char *processname ){ 
-	PCBNode pnode =	pqueue->front;
-	if(IsEmpty(pqueue)){
-		return 0;
-	}
-	while (pnode!= NULL)
-	{
-		if (strcmp(pnode->data.Name,processname)==0 ){
-			return 1;
-		}
-		else {
-			pnode = pnode->next;
-		}
+	if(FindNodeByName(pqueue, processname)!=NULL){
+		return 1;
 	}
 	return 0;
 }
@@ -1437,205 +1978,269 @@ in: queue, process name
 out: process id
 ************************************************************************/
 INT32 GetPIDByName(PCBQueue *pqueue, char* pname){  
-	PCBNode current = pqueue->front;
+	PCBNode pnode;
 	if(pname ==NULL||pname ==""||strcmp(pname,"")==0){
 		//return readyqueue->rear->data.Processid;
 		return CURRENTPCB->Processid;
 	}
-	while (current!= NULL)
-	{
-		if(strcmp(current->data.Name,pname)==0){
-			return current->data.Processid;
-		}
-		current = current->next;
+	pnode = FindNodeByName(pqueue, pname);
+	if(pnode!=NULL){
+		return pnode->data.Processid;
 	}
 	return 99; //default
 }
 
 /************************************************************************
 GetPcbByPid
-//get the PCB through pid in queue
+//get the PCB through pid, the process table keeps it whatever queue
+//the process is in, a caller that needs a queue checks it with IsPidExist
 
-in: queue, process id
-out: PCB
+in: process id
+out: PCB, Processid is -1 if the pid was never created
 ************************************************************************/
-Process_Control_Block GetPcbByPid(PCBQueue *pqueue, INT32 pid){ 
-	PCBNode pnode;
-	INT32 icount;
+Process_Control_Block GetPcbByPid(INT32 pid){ 
+	PCBNode pnode = FindNodeByPid(pid);
+	Process_Control_Block pcb;
 
-	pnode = pqueue->front;
-	icount =1;
-	while(pnode!=NULL&&icount<=pqueue->size){
-		if(pnode->data.Processid == pid){
-			return pnode->data;
-		}
-		pnode = pnode->next;
-		icount++;
+	if(pnode!=NULL){
+		return pnode->data;
 	}
+	memset(&pcb, 0, sizeof(pcb));
+	pcb.Processid = -1;
+	return pcb;
 }
 
 /************************************************************************
-DeQueueFirstElement
-//delete the first element in queue
+Below are routines for the process table
+	
+	GetProcessNode, FindNodeByPid, FindNodeByName, HashName
 
-in: queue
-out: node
+	every process owns one node, found by pid in processtable and by name
+	in namehash. The Add routines move that node between the queues, so a
+	state change neither mallocs nor copies, and the lookups don't walk
 ************************************************************************/
-PCBNode DeQueueFirstElement(PCBQueue *pqueue){ 
-    PCBNode pnode;  
-	pnode = pqueue->front;
-	//pnode.data = pqueue->front->data;
-	//pnode.next = pqueue->front->next;
-    if(IsEmpty(pqueue)!=1&&pnode!=NULL)  
-    {  
-        pqueue->size--;  
-        pqueue->front = pnode->next;  
-        if(pqueue->size==0){
-			pqueue->rear = NULL;  
-		}
-    }  
-    return pnode;  
+
+/************************************************************************
+HashName
+//hash a process name into a namehash bucket
+
+in: process name
+out: bucket
+************************************************************************/
+INT32 HashName(char *processname){ 
+	UINT32 hash = 0;
+
+	while(*processname!='\0'){
+		hash = hash*31+(unsigned char)*processname;
+		processname++;
+	}
+	return (INT32)(hash%NameHashSize);
 }
 
 /************************************************************************
-RemoveQueueByName
-//delete all match nodes through process name in queue
+FindNodeByPid
+//get the node of the process through pid
 
-in: queue, process name
-out: node
+in: process id
+out: node, NULL if the pid was never created
 ************************************************************************/
-PCBNode RemoveQueueByName(PCBQueue *pqueue,char *processname)  
-{
-	PCBNode pnode = pqueue->front;
-	PCBNode ptemp;
-	INT32 flag = 0; //the record for elements
-
-	while(1)
-	{
-		if(pnode!=NULL){
-			if (strcmp(pnode->data.Name, processname)==0) //handle the head element
-			{
-				flag++;
-				pqueue->front = pqueue->front->next;
-				pnode = pqueue->front;
-				pqueue->size--;
-				if(pqueue->size==0)//if no element left, delete rear node as well
-				{
-					pqueue->rear = NULL;
-				}
-			}
-			else break;
-		}
-		else 
-		{
-			//printf("Delete %d nodes, the total number left  in the queue is %d\n", flag, pqueue->size);
-			return pnode;
-		}
+PCBNode FindNodeByPid(INT32 pid){ 
+	if(pid<0||pid>=ProcessTableSize){
+		return NULL;
 	}
-	while (pnode->next!= NULL)
-	{
-		if (strcmp(pnode->next->data.Name,processname)==0 )
-		{
-			flag++;
-			ptemp = pnode->next;
-			if (pnode->next->next != NULL)
-			{
-				pnode->next = pnode->next->next;
-				free(ptemp);
-				ptemp = NULL;
-				pqueue->size--;
-			}
-			else //if the target is the last node
-			{
-				free(ptemp);
-				ptemp = NULL;
-				pnode->next = NULL;
-				pqueue->rear = pnode; //point the last element to rear after delete
-				pqueue->size--;
-				break;
-			}
-		}
-		else //if no one match, move to next node
-		{
-			pnode = pnode->next;
+	return processtable[pid];
+}
+
+/************************************************************************
+FindNodeByName
+//get the node of the process through name, only if it is in the queue
+
+in: queue, process name
+out: node, NULL if no process in the queue has the name
+************************************************************************/
+PCBNode FindNodeByName(PCBQueue *pqueue, char *processname){ 
+	PCBNode pnode;
+
+	for(pnode = namehash[HashName(processname)]; pnode!=NULL; pnode = pnode->hashnext){
+		if(pnode->queue==pqueue&&strcmp(pnode->data.Name,processname)==0){
+			return pnode;
 		}
 	}
-	//printf("Delete %d nodes, the total number left in the queue is %d\n", flag, pqueue->size);
+	return NULL;
+}
+
+/************************************************************************
+GetProcessNode
+//get the node of the pcb for an Add routine, the first time a pid is seen
+//the node is created and put into processtable and namehash. The pcb is
+//copied into the node and the node is taken out of the queue it is in
+
+in: PCB
+out: node, NULL if the pid is out of range
+************************************************************************/
+PCBNode GetProcessNode(Process_Control_Block *pcb){ 
+	PCBNode pnode = FindNodeByPid(pcb->Processid);
+	INT32 bucket;
+
+	if(pcb->Processid<0||pcb->Processid>=ProcessTableSize){
+		printf("ERROR! the pid:%d is out of the process table\n",pcb->Processid);
+		return NULL;
+	}
+	if(pnode==NULL){
+		pnode = (PCBNode)calloc(1, sizeof(Node)); //first time write Node to PCBNode, waste me 1 day to debug it
+		pnode->heapindex = -1;
+		pnode->data = *pcb;
+		bucket = HashName(pcb->Name);
+		pnode->hashnext = namehash[bucket];
+		namehash[bucket] = pnode;
+		processtable[pcb->Processid] = pnode;
+		return pnode;
+	}
+	if(&pnode->data!=pcb){
+		pnode->data = *pcb;
+	}
+	if(pnode->queue!=NULL){
+		UnlinkNode(pnode->queue, pnode);
+	}
 	return pnode;
 }
 
+/************************************************************************
+DeQueueFirstElement
+//delete the first element in queue
+
+in: queue
+out: node
+************************************************************************/
+PCBNode DeQueueFirstElement(PCBQueue *pqueue){ 
+    PCBNode pnode;  
+	pnode = pqueue->front;
+    if(IsEmpty(pqueue)!=1&&pnode!=NULL)  
+    {  
+		UnlinkNode(pqueue, pnode);
+    }  
+    return pnode;  
+}
+
+/************************************************************************
+AppendNode
+//add the node at the rear of the queue, FIFO order
+
+in: queue, node
+out:
+************************************************************************/
+void AppendNode(PCBQueue *pqueue, PCBNode pnode){ 
+	pnode->next = NULL;
+	pnode->prev = pqueue->rear;
+	if(IsEmpty(pqueue)){
+		pqueue->front = pnode; 
+	}
+	else pqueue->rear->next = pnode;
+	pqueue->rear = pnode;
+	pqueue->size++;
+	pnode->queue = pqueue;
+}
+
+/************************************************************************
+UnlinkNode
+//take the node out of the queue, fix front, rear, size, the priority buckets
+//and the timer heap. The node is not freed, it stays in the process table
+
+in: queue, node
+out:
+************************************************************************/
+void UnlinkNode(PCBQueue *pqueue, PCBNode pnode){ 
+	PriorityBuckets *pbuckets = pqueue->buckets;
+	PCBNode previous = pnode->prev;
+	INT32 level;
+
+	if(pnode->queue!=pqueue){ //already moved to another queue
+		return;
+	}
+	if(pbuckets!=NULL){
+		level = pnode->bucket;
+		if(pbuckets->head[level]==pnode&&pbuckets->tail[level]==pnode){ //the last one at this level
+			pbuckets->head[level] = NULL;
+			pbuckets->tail[level] = NULL;
+			pbuckets->bitmap[level>>5] &= ~(1U<<(level&31));
+		}
+		else if(pbuckets->head[level]==pnode){
+			pbuckets->head[level] = pnode->next;
+		}
+		else if(pbuckets->tail[level]==pnode){
+			pbuckets->tail[level] = previous;
+		}
+	}
+	if(pqueue->heap!=NULL&&pnode->heapindex>=0){
+		TimerHeapRemove(pqueue->heap, pnode->heapindex);
+	}
+	if(previous==NULL){
+		pqueue->front = pnode->next;
+	}
+	else previous->next = pnode->next;
+	if(pnode->next!=NULL){
+		pnode->next->prev = previous;
+	}
+	if(pqueue->rear==pnode){
+		pqueue->rear = previous;
+	}
+	pnode->next = NULL;
+	pnode->prev = NULL;
+	pnode->queue = NULL;
+	pqueue->size--;
+	if(pqueue->size==0){//if no element left, delete front and rear as well
+		pqueue->front = NULL;
+		pqueue->rear = NULL;
+	}
+}
+
+/************************************************************************
+RemoveQueueByName
+//take the process out of the queue through process name
+//the node stays in the process table, the caller may still use its context
+
+in: queue, process name
+out: node
+************************************************************************/
+PCBNode RemoveQueueByName(PCBQueue *pqueue,char *processname)  
+{
+	PCBNode pnode = FindNodeByName(pqueue, processname);
+
+	if(pnode!=NULL){
+		UnlinkNode(pqueue, pnode);
+	}
+	//printf("the total number left in the queue is %d\n", pqueue->size);
+	return pqueue->rear;
+}
+
 /************************************************************************
 RemoveQueueByPid
-//delete all match nodes through process name in queue, 
+//take the process out of the queue through process id, 
+//the node stays in the process table, the caller may still use its context
 
 in: queue, process id
 out: INT32(1/0)
 ************************************************************************/
 INT32 RemoveQueueByPid(PCBQueue *pqueue, INT32 processid)  
 {
-	PCBNode pnode = pqueue->front;
-	PCBNode ptemp;
-	INT32 flag = 0;
-
-	while(1)
-	{
-		if(pnode!=NULL){
-			if (pnode->data.Processid == processid) 
-			{
-				flag++;
-				pqueue->front = pqueue->front->next;
-				pnode = pqueue->front;
-				pqueue->size--;
-				if(pqueue->size==0)
-				{
-					pqueue->rear = NULL;
-				}
-			}
-			else break;
-		}
-		else 
-		{
-			//printf("Delete %d nodes, the total number left  in the queue is %d\n", flag, pqueue->size);
-			if(flag>0) return 1;
-			else return 0;
-		}
-	}
-	while (pnode->next != NULL)
-	{
-		if (pnode->next->data.Processid == processid )
-		{
-			flag++;
-			ptemp = pnode->next;
-			if (pnode->next->next != NULL)
-			{
-				pnode->next = pnode->next->next;
-				free(ptemp);
-				ptemp = NULL;
-				pqueue->size--;
-			}
-			else
-			{
-				free(ptemp);
-				ptemp = NULL;
-				pnode->next = NULL;
-				pqueue->rear = pnode; 
-				pqueue->size--;
-				break;
-			}
-		}
-		else 
-		{
-			pnode = pnode->next;
-		}
+	PCBNode pnode = FindNodeByPid(processid);
+
+	if(pnode!=NULL&&pnode->queue==pqueue){
+		UnlinkNode(pqueue, pnode);
+		return 1;
 	}
-	//printf("Delete %d nodes, the total number left in the queue is %d\n", flag, pqueue->size);
-	if(flag>0) return 1;
-	else return 0;
+	//printf("the total number left in the queue is %d\n", pqueue->size);
+	return 0;
 }
 /************************************************************************
 Below are routines just for timerqueue
 	
-	AddToTimerQueue, RemoveFromTimerQueue
+	AddToTimerQueue, RemoveFromTimerQueue, GetFirstTimer, IsTimerBefore,
+	TimerHeapSiftUp, TimerHeapSiftDown, TimerHeapInsert, TimerHeapRemove
+
+	timerqueue keeps its nodes in FIFO order for the walkers, and a min-heap
+	of the same nodes on wake up time, so the timer interrupt can take the
+	expired sleepers off the top and read the next deadline without a scan
 ************************************************************************/
 
 /************************************************************************
@@ -1647,96 +2252,151 @@ out: node
 ************************************************************************/
 PCBNode AddToTimerQueue(PCBQueue *pqueue,Process_Control_Block *pcb, INT32 ptime)
 {
-	PCBNode current, pnode;
-	pnode = (PCBNode)malloc(sizeof(Node)); //first time write Node to PCBNode, waste me 1 day to debug it
-	pnode->data = *pcb; 
-	pnode->time = ptime;
-	pnode->next = NULL;  //it should be NULL
-	
-	if(IsEmpty(pqueue))  
-    {  
-		pqueue->front = pnode; 
-		pqueue->rear = pnode;
-		//pqueue->size++;  
-		pqueue->size = 1; 
-		return pnode;
+	PCBNode pnode = GetProcessNode(pcb);
+	if(pnode==NULL){
+		return NULL;
 	}
-	current = pqueue->front;
-	while (current->next != NULL)
-	{
-		current = current->next;
+	pnode->time = ptime;
+	pnode->order = timerorder++;
+	AppendNode(pqueue, pnode);
+	if(pqueue->heap!=NULL){
+		TimerHeapInsert(pqueue->heap, pnode);
 	}
-	current->next = pnode;
-	pqueue->rear = pnode;
-	pqueue->size++;  
 	return pnode;
 }
 
 /************************************************************************
 RemoveFromTimerQueue
-//remove the node in timerqueue, almost the same as RemoveQueueByName
+//remove the node in timerqueue, the same as RemoveQueueByPid
 
 in: queue, process id
 out: node
 ************************************************************************/
 PCBNode RemoveFromTimerQueue(PCBQueue *pqueue, INT32 processid) 
 {
-	PCBNode pnode = pqueue->front;
-	PCBNode ptemp;
-	INT32 flag = 0;
-
-	while (1)
-	{
-		if(pnode!=NULL){
-			if (pnode->data.Processid == processid) //delete head situation
-			{
-				flag++;
-				pqueue->front = pqueue->front->next;
-				pnode = pqueue->front;
-				pqueue->size--;
-				if(pqueue->size==0)
-				{
-					pqueue->rear = NULL;
-				}
-			}
-			else break;
-		}
-		else 
-		{
-			//printf("Delete %d nodes, the total number left  in the queue is %d\n", flag, pqueue->size);
-			return pnode;
+	CALL(RemoveQueueByPid(pqueue, processid));
+	return pqueue->rear;
+}
+
+/************************************************************************
+GetFirstTimer
+//get the node that wakes up first, without removing it
+
+in: queue
+out: node, NULL if the queue is empty
+************************************************************************/
+PCBNode GetFirstTimer(PCBQueue *pqueue) 
+{
+	if(pqueue->heap==NULL||pqueue->heap->count==0){
+		return NULL;
+	}
+	return pqueue->heap->entry[0];
+}
+
+/************************************************************************
+IsTimerBefore
+//earlier time first, equal times in the order they were added
+
+in: node, node
+out: INT32(1/0)
+************************************************************************/
+INT32 IsTimerBefore(PCBNode anode, PCBNode bnode) 
+{
+	if(anode->time!=bnode->time){
+		return anode->time<bnode->time;
+	}
+	return anode->order<bnode->order;
+}
+
+/************************************************************************
+TimerHeapSiftUp
+//move the entry up until its parent is earlier
+
+in: heap, index
+out:
+************************************************************************/
+void TimerHeapSiftUp(TimerHeap *pheap, INT32 index) 
+{
+	PCBNode pnode = pheap->entry[index];
+	INT32 parent;
+
+	while(index>0){
+		parent = (index-1)/2;
+		if(IsTimerBefore(pnode, pheap->entry[parent])!=1){
+			break;
 		}
+		pheap->entry[index] = pheap->entry[parent];
+		pheap->entry[index]->heapindex = index;
+		index = parent;
 	}
-	while (pnode->next != NULL)
-	{
-		if (pnode->next->data.Processid == processid )
-		{
-			flag++;
-			ptemp = pnode->next;
-			if (pnode->next->next != NULL)
-			{
-				pnode->next = pnode->next->next;
-				free(ptemp);
-				ptemp = NULL;
-				pqueue->size--;
-			}
-			else 
-			{
-				free(ptemp);
-				ptemp = NULL;
-				pnode->next = NULL;
-				pqueue->rear = pnode;
-				pqueue->size--;
-				break;
-			}
+	pheap->entry[index] = pnode;
+	pnode->heapindex = index;
+}
+
+/************************************************************************
+TimerHeapSiftDown
+//move the entry down until both children are later
+
+in: heap, index
+out:
+************************************************************************/
+void TimerHeapSiftDown(TimerHeap *pheap, INT32 index) 
+{
+	PCBNode pnode = pheap->entry[index];
+	INT32 child;
+
+	while((child = 2*index+1)<pheap->count){
+		if(child+1<pheap->count&&IsTimerBefore(pheap->entry[child+1], pheap->entry[child])){
+			child++;
 		}
-		else 
-		{
-			pnode = pnode->next;
+		if(IsTimerBefore(pheap->entry[child], pnode)!=1){
+			break;
 		}
+		pheap->entry[index] = pheap->entry[child];
+		pheap->entry[index]->heapindex = index;
+		index = child;
 	}
-	//printf("Delete %d nodes, the total number left in the queue is %d\n", flag, pqueue->size);
-	return pnode;
+	pheap->entry[index] = pnode;
+	pnode->heapindex = index;
+}
+
+/************************************************************************
+TimerHeapInsert
+//add the node to the heap, grow the heap if it is full
+
+in: heap, node
+out:
+************************************************************************/
+void TimerHeapInsert(TimerHeap *pheap, PCBNode pnode) 
+{
+	if(pheap->count>=pheap->capacity){
+		pheap->capacity *= 2;
+		pheap->entry = (PCBNode *)realloc(pheap->entry, pheap->capacity*sizeof(PCBNode));
+	}
+	pheap->entry[pheap->count] = pnode;
+	pheap->count++;
+	TimerHeapSiftUp(pheap, pheap->count-1);
+}
+
+/************************************************************************
+TimerHeapRemove
+//remove the entry at index, the last entry fills the hole
+
+in: heap, index
+out:
+************************************************************************/
+void TimerHeapRemove(TimerHeap *pheap, INT32 index) 
+{
+	PCBNode pnode = pheap->entry[index];
+
+	pheap->count--;
+	if(index<pheap->count){
+		pheap->entry[index] = pheap->entry[pheap->count];
+		pheap->entry[index]->heapindex = index;
+		TimerHeapSiftDown(pheap, index);
+		TimerHeapSiftUp(pheap, pheap->entry[index]->heapindex);
+	}
+	pnode->heapindex = -1;
 }
 
 /************************************************************************
@@ -1745,71 +2405,103 @@ Below are routines just for readyqueue
 	AddToReadyQueueByPriority, AddToReadyQueue
 ************************************************************************/
 
+/************************************************************************
+GetBucketLevel
+//map a priority to its bucket, CHANGE_PRIORITY can set values outside 0-99
+
+in: priority
+out: level
+************************************************************************/
+INT32 GetBucketLevel(INT32 priority){
+	if(priority<0) return 0;
+	if(priority>=PriorityLevels) return PriorityLevels-1;
+	return priority;
+}
+
+/************************************************************************
+FindBucketAtOrBefore
+//find the largest non-empty level that is not larger than the given level
+
+in: buckets, level
+out: level, -1 if all of them are empty
+************************************************************************/
+INT32 FindBucketAtOrBefore(PriorityBuckets *pbuckets, INT32 level){
+	INT32 word = level>>5;
+	UINT32 bits;
+
+	bits = pbuckets->bitmap[word] & (0xFFFFFFFFU>>(31-(level&31))); //keep the bits up to level
+	while(1){
+		if(bits!=0){
+			level = word*32+31;
+			while((bits&0x80000000U)==0){
+				bits <<= 1;
+				level--;
+			}
+			return level;
+		}
+		if(word==0) return -1;
+		word--;
+		bits = pbuckets->bitmap[word];
+	}
+}
+
 /************************************************************************
 AddToReadyQueueByPriority
 //add the pcb to readyqueue order by priority, low number mean high priority
+//the node goes to the tail of its priority level, found through the bucket bitmap
+//instead of walking the queue, so the queue stays in the same order as before
 
 in: queue, PCB
 out: node
 ************************************************************************/
 PCBNode AddToReadyQueueByPriority(PCBQueue *pqueue,Process_Control_Block *pcb) 
 {
+	PriorityBuckets *pbuckets = pqueue->buckets;
 	PCBNode current, previous, pnode;
-	INT32 position, positioncount;
-	pnode = (PCBNode)malloc(sizeof(Node));
-	pnode->data = *pcb; 
-	pnode->next = NULL;  //it should be NULL
-	
-	if(IsEmpty(pqueue))  //if the readyqueue is empty, init it
-    {  
-		pqueue->front = pnode; 
-		pqueue->rear = pnode;
-		//pqueue->size++;  
-		pqueue->size = 1;
-		return pnode;
+	INT32 level, before;
+	pnode = GetProcessNode(pcb);
+	if(pnode==NULL){
+		return NULL;
 	}
+	pnode->next = NULL;  //it should be NULL
+	level = GetBucketLevel(pcb->Priority);
+	pnode->bucket = level;
 
-	current = pqueue->front;
-	position = 1;
-	 //get the insert position
-	while(current!=NULL&&position<=pqueue->size){
-		if(pnode->data.Priority<current->data.Priority){
-			break;
+	previous = NULL;
+	if(pbuckets==NULL){ //queue without buckets, walk to the insert position
+		for(current = pqueue->front; current!=NULL&&current->data.Priority<=pcb->Priority; current = current->next){
+			previous = current;
 		}
-		current = current->next;
-		position++; 
 	}
-
-	if(position == 1){ //if insert into the first position
+	else{
+		before = FindBucketAtOrBefore(pbuckets, level);
+		if(before>=0){
+			previous = pbuckets->tail[before];
+		}
+	}
+	pnode->prev = previous;
+	pnode->queue = pqueue;
+	if(previous==NULL){ //insert into the first position
 		pnode->next = pqueue->front;
 		pqueue->front = pnode; 
-		//pqueue->rear = current;
-		pqueue->size++;  
-		return pnode;
 	}
-	else if(position == pqueue->size+1){//if insert into the last position
-		current = pqueue->front;
-		while (current->next != NULL)
-		{
-			current = current->next;
-		}
-		current->next = pnode;
+	else{
+		pnode->next = previous->next;
+		previous->next = pnode;
+	}
+	if(pnode->next==NULL){
 		pqueue->rear = pnode;
-		pqueue->size++;  
-		return pnode;
 	}
-	else{ //if insert between first and last node
-		previous = pqueue->front; 
-		positioncount = 2;
-		while(positioncount<position){
-			previous = previous->next;
-			positioncount++;
+	else pnode->next->prev = pnode;
+	if(pbuckets!=NULL){
+		if(pbuckets->head[level]==NULL){
+			pbuckets->head[level] = pnode;
+			pbuckets->bitmap[level>>5] |= (1U<<(level&31));
 		}
-		pnode->next = previous->next;
-		previous->next = pnode;
-		pqueue->size++; 
-		return pnode;
+		pbuckets->tail[level] = pnode;
 	}
+	pqueue->size++;  
+	return pnode;
 }
 
 /************************************************************************
@@ -1821,27 +2513,15 @@ out: node
 ************************************************************************/
 PCBNode AddToReadyQueue(PCBQueue *pqueue,Process_Control_Block *pcb) 
 {
-	PCBNode current, pnode;
-	pnode = (PCBNode)malloc(sizeof(Node));
-	pnode->data = *pcb; 
-	pnode->next = NULL; 
-	
-	if(IsEmpty(pqueue))  
-    {  
-		pqueue->front = pnode; 
-		pqueue->rear = pnode;
-		//pqueue->size++;  
-		pqueue->size = 1;
-		return pnode;
+	PCBNode pnode;
+	if(pqueue->buckets!=NULL){ //plain FIFO would break the priority levels
+		return AddToReadyQueueByPriority(pqueue, pcb);
 	}
-	current = pqueue->front;
-	while (current->next != NULL)
-	{
-		current = current->next;
+	pnode = GetProcessNode(pcb);
+	if(pnode==NULL){
+		return NULL;
 	}
-	current->next = pnode;
-	pqueue->rear = pnode;
-	pqueue->size++;  
+	AppendNode(pqueue, pnode);
 	return pnode;
 }
 
@@ -1860,27 +2540,11 @@ out: node
 ************************************************************************/
 PCBNode AddToSuspendQueue(PCBQueue *pqueue,Process_Control_Block *pcb) 
 {
-	PCBNode current, pnode;
-	pnode = (PCBNode)malloc(sizeof(Node)); 
-	pnode->data = *pcb; 
-	pnode->next = NULL;  //it should be NULL
-	
-	if(IsEmpty(pqueue))  
-    {  
-		pqueue->front = pnode; 
-		pqueue->rear = pnode;
-		//pqueue->size++;  
-		pqueue->size = 1;
-		return pnode;
-	}
-	current = pqueue->front;
-	while (current->next != NULL)
-	{
-		current = current->next;
+	PCBNode pnode = GetProcessNode(pcb);
+	if(pnode==NULL){
+		return NULL;
 	}
-	current->next = pnode;
-	pqueue->rear = pnode;
-	pqueue->size++;  
+	AppendNode(pqueue, pnode);
 	return pnode;
 }
 
@@ -2057,7 +2721,12 @@ void dospprint(char *action, INT32 tarGetPID, Process_Control_Block *currentPCB)
 	spnode = suspendqueue->front; //print suspendqueue
 	spcount =1;
 	while(spnode!=NULL&&spcount<=suspendqueue->size){
-		CALL(SP_setup( SP_SUSPENDED_MODE, spnode->data.Processid ));
+		if(IsLoadSwapped(spnode->data.Processid)==1){
+			CALL(SP_setup( SP_SWAPPED_MODE, spnode->data.Processid ));
+		}
+		else{
+			CALL(SP_setup( SP_SUSPENDED_MODE, spnode->data.Processid ));
+		}
 		spnode = spnode->next;
 		spcount++;
 	}
@@ -2067,310 +2736,2975 @@ void dospprint(char *action, INT32 tarGetPID, Process_Control_Block *currentPCB)
 	if(action == "CREATE"){
 		CALL(SP_setup( SP_NEW_MODE, tarGetPID ));
 	}
-	
-	CALL(SP_print_header());
-	CALL(SP_print_line());
-
-	READ_MODIFY(MEMORY_INTERLOCK_BASE+0, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //readyqueue
-	READ_MODIFY(MEMORY_INTERLOCK_BASE+1, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //timerqueue
-	READ_MODIFY(MEMORY_INTERLOCK_BASE+2, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //suspendqueue
+	
+	CALL(SP_print_header());
+	CALL(SP_print_line());
+
+	READ_MODIFY(MEMORY_INTERLOCK_BASE+0, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //readyqueue
+	READ_MODIFY(MEMORY_INTERLOCK_BASE+1, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //timerqueue
+	READ_MODIFY(MEMORY_INTERLOCK_BASE+2, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //suspendqueue
+}
+
+/**************************************************************************************************************************************
+Memory Print routine
+
+Memory_Print
+//get information of the physical memeory, target pid and the virtual memeory address
+
+in: global varible
+out:
+**************************************************************************************************************************************/
+void Memory_Print(){
+	INT32 Temp;
+	for (Temp = 0; Temp < PhysMemPages && Temp < PHYS_MEM_PGS; Temp = Temp + 2) { //the printer has room for PHYS_MEM_PGS frames
+		if (framemap[Temp].pid!=-1){
+			//line number,pid number,vpn, 13-15 bit of virtual page
+			MP_setup( (INT32)Temp, (INT32)framemap[Temp].pid, (INT32)framemap[Temp].vpn, (*FramePTE(Temp)&0xe000)>>13);
+		}	
+	}
+	MP_print_line();
+}
+
+/**************************************************************************************************************************************
+Below are the routines for memory manager
+
+	AllocFrameTables, InitFrameMap, IsFreeFrameExist, GetFreeFrame, SetFrameOwner, FreeFrame, IsFramePinned, GetPageTable, InstallPageTable, TableEntry,
+	PeekTableEntry, SwapSlotOf, SetSwapSlot, FramePTE, IsFrameDirty, ReleaseProcessPages, MapPages, FindSharedArea, CreateSharedArea, ReleaseSharedAreas
+**************************************************************************************************************************************/
+
+/**************************************************************************************************************************************
+IsFramePinned
+//judge if the frame travels in a message, belongs to a shared area or waits for the disk,
+//such a frame is neither free nor a victim of the clock
+
+in: frame number
+out: 1 if pinned, 0 if not
+**************************************************************************************************************************************/
+INT32 IsFramePinned(INT32 frame_number){
+	if(framemap[frame_number].pinned!=0)
+		return 1;
+	return 0;
+}
+
+/**************************************************************************************************************************************
+GetPageTable
+//get the page directory of the pid, it is made the first time someone asks for it, with the swap map,
+//both start with no leaves, a leaf of PTBL_LEAF_PGS entries is made when a page in it is first touched
+
+in: process id
+out: the page directory, PTBL_DIR_SIZE leaves
+**************************************************************************************************************************************/
+UINT16 **GetPageTable(INT32 pid){
+	if(pagetable[pid]==NULL){
+		pagetable[pid] = (UINT16 **)calloc( sizeof(UINT16 *), PTBL_DIR_SIZE );
+		swapmap[pid] = (INT16 **)calloc( sizeof(INT16 *), PTBL_DIR_SIZE );
+	}
+	return pagetable[pid];
+}
+
+/**************************************************************************************************************************************
+InstallPageTable
+//give the hardware the page table of the running process, the hardware keeps it
+//in the context from now on and brings it back on every switch
+
+in: CURRENTPCB
+out: 
+**************************************************************************************************************************************/
+void InstallPageTable(){
+	Z502_PAGE_TBL_LENGTH = VIRTUAL_MEM_PGS;
+	Z502_PAGE_TBL_ADDR = GetPageTable(CURRENTPCB->Processid);
+}
+
+/**************************************************************************************************************************************
+TableEntry
+//find the entry of the page in the directory, its leaf is made when it is missing,
+//so use it only for a page that gets a frame or a bit
+
+in: page directory, virtual page
+out: the page table entry
+**************************************************************************************************************************************/
+UINT16 *TableEntry(UINT16 **directory, INT32 vpn){
+	UINT16 **leaf = &directory[vpn>>PTBL_LEAF_BITS];
+
+	if(*leaf==NULL){
+		*leaf = (UINT16 *)calloc( sizeof(UINT16), PTBL_LEAF_PGS );
+		if(++pagingstats.tableleaves>pagingstats.peakleaves)
+			pagingstats.peakleaves = pagingstats.tableleaves;
+	}
+	return &(*leaf)[vpn&(PTBL_LEAF_PGS-1)];
+}
+
+/**************************************************************************************************************************************
+PeekTableEntry
+//read the entry of the page without making its leaf, a missing leaf reads as 0, not valid and not on disk
+
+in: page directory, virtual page
+out: the page table entry
+**************************************************************************************************************************************/
+UINT16 PeekTableEntry(UINT16 **directory, INT32 vpn){
+	UINT16 *leaf = directory[vpn>>PTBL_LEAF_BITS];
+
+	if(leaf==NULL)
+		return 0;
+	return leaf[vpn&(PTBL_LEAF_PGS-1)];
+}
+
+/**************************************************************************************************************************************
+SwapSlotOf
+//the swap slot of the page, a missing leaf of the swap map means no slot
+
+in: process id, virtual page
+out: slot number, -1 if none
+**************************************************************************************************************************************/
+INT16 SwapSlotOf(INT32 pid, INT32 vpn){
+	INT16 *leaf = swapmap[pid][vpn>>PTBL_LEAF_BITS];
+
+	if(leaf==NULL)
+		return -1;
+	return leaf[vpn&(PTBL_LEAF_PGS-1)];
+}
+
+/**************************************************************************************************************************************
+SetSwapSlot
+//write the swap slot of the page, the leaf of the swap map is made with every slot -1
+
+in: process id, virtual page, slot number or -1
+out: 
+**************************************************************************************************************************************/
+void SetSwapSlot(INT32 pid, INT32 vpn, INT16 slot){
+	INT16 **leaf = &swapmap[pid][vpn>>PTBL_LEAF_BITS];
+	INT32 i;
+
+	if(*leaf==NULL){
+		if(slot==-1)
+			return;
+		*leaf = (INT16 *)calloc( sizeof(INT16), PTBL_LEAF_PGS );
+		for(i=0;i<PTBL_LEAF_PGS;i++)
+			(*leaf)[i] = -1;
+		if(++pagingstats.tableleaves>pagingstats.peakleaves)
+			pagingstats.peakleaves = pagingstats.tableleaves;
+	}
+	(*leaf)[vpn&(PTBL_LEAF_PGS-1)] = slot;
+}
+
+/**************************************************************************************************************************************
+FramePTE
+//find the page table entry that maps the frame, in the page table of the owner,
+//which needs not be the running process
+
+in: frame number
+out: the page table entry
+**************************************************************************************************************************************/
+UINT16 *FramePTE(INT32 frame_number){
+	return TableEntry(GetPageTable(framemap[frame_number].pid), framemap[frame_number].vpn);
+}
+
+/**************************************************************************************************************************************
+IsFrameDirty
+//judge if the page in the frame has to be written back before the frame is taken, it has
+//when it was written since it came from disk, or when it was never on disk
+
+in: frame number
+out: 1 if dirty, 0 if the copy on the swap disk is still good
+**************************************************************************************************************************************/
+INT32 IsFrameDirty(INT32 frame_number){
+	UINT16 pte = *FramePTE(frame_number);
+
+	if((pte&PTBL_MODIFIED_BIT)!=0||(pte&PTBL_SWAPPED_BIT)==0)
+		return 1;
+	return 0;
+}
+
+/**************************************************************************************************************************************
+ReleaseProcessPages
+//the process is gone, its frames go back to the frame table and its swap slots to the bitmap,
+//pinned frames are left to the shared area or the message that has them, the leaves are freed
+//and only the empty directory stays for the next process with the pid, the caller has the frametable locked
+
+in: process id
+out: 
+**************************************************************************************************************************************/
+void ReleaseProcessPages(INT32 pid){
+	int i, j;
+	INT32 frame_number;
+	UINT16 *leaf;
+
+	if(pid<0||pid>=ProcessTableSize||pagetable[pid]==NULL){
+		return;
+	}
+	lastfault[pid] = 0; //the next process with the pid starts a new stride and a new working set
+	workingset[pid] = 0;
+	framequota[pid] = 0;
+	loadswapped[pid] = 0;
+	faultstride[pid] = 0;
+	stridehits[pid] = 0;
+	CancelReadAhead(pid, -1); //their pages are invalid until the read is done, the interrupt frees their frames
+	for(i=0;i<PTBL_DIR_SIZE;i++){ //only the leaves that were touched, its page table is shorter than the memory can be
+		leaf = pagetable[pid][i];
+		if(leaf==NULL)
+			continue;
+		for(j=0;j<PTBL_LEAF_PGS;j++){
+			if((leaf[j]&PTBL_VALID_BIT)==0)
+				continue;
+			frame_number = leaf[j]&PTBL_PHYS_PG_NO;
+			if(framemap[frame_number].pid==pid&&IsFramePinned(frame_number)!=1)
+				FreeFrame(frame_number);
+		}
+		free(leaf);
+		pagetable[pid][i] = NULL;
+		pagingstats.tableleaves--;
+	}
+	Z502InvalidateTLB(-1); //the TLB points into the leaves
+	ReleaseSwapSlots(pid);
+}
+
+/**************************************************************************************************************************************
+MapPages
+//put the frames into the current page table from the virtual page on, the frames
+//that were there before are given back to the frame table and their swap slots to
+//the bitmap, the caller holds the frametable lock
+
+in: first virtual page, page count, frames
+out: 
+**************************************************************************************************************************************/
+void MapPages(INT32 vpn, INT32 page_count, UINT16 *frames){
+	INT32 i;
+	UINT16 oldframe;
+
+	if (Z502_PAGE_TBL_ADDR == NULL ){ //Page table isn't in the hardware yet, the same as fault_handler
+		InstallPageTable();
+	}
+	for(i=0;i<page_count;i++){
+		if((PeekTableEntry(Z502_PAGE_TBL_ADDR, vpn+i)&PTBL_VALID_BIT)!=0){
+			oldframe = PeekTableEntry(Z502_PAGE_TBL_ADDR, vpn+i)&PTBL_PHYS_PG_NO;
+			if(IsFramePinned(oldframe)!=1){ //a shared frame stays with the area
+				FreeFrame(oldframe);
+			}
+		}
+		if(SwapSlotOf(CURRENTPCB->Processid, vpn+i)!=-1){ //the old page on disk is no use either
+			FreeSwapSlot(SwapSlotOf(CURRENTPCB->Processid, vpn+i));
+		}
+		CancelReadAhead(CURRENTPCB->Processid, vpn+i); //nor a read of it still on the way
+		*TableEntry(Z502_PAGE_TBL_ADDR, vpn+i) = frames[i]|PTBL_VALID_BIT;
+		Z502InvalidateTLB(vpn+i);
+		SetFrameOwner(frames[i], CURRENTPCB->Processid, vpn+i);
+	}
+}
+
+/**************************************************************************************************************************************
+FindSharedArea
+//find the shared area through its tag
+
+in: tag
+out: the area, NULL if there is none
+**************************************************************************************************************************************/
+SharedArea *FindSharedArea(char *tag){
+	int i;
+	for(i=0;i<SharedAreaLimit;i++){
+		if(sharedarea[i].tag[0]!='\0'&&strcmp(sharedarea[i].tag,tag)==0)
+			return &sharedarea[i];
+	}
+	return NULL;
+}
+
+/**************************************************************************************************************************************
+CreateSharedArea
+//make a new shared area with zeroed free frames, the frames are pinned until the
+//last sharer is gone, the caller holds the frametable lock
+
+in: tag, page count
+out: the area, NULL if there is no empty area or not enough free frames
+**************************************************************************************************************************************/
+SharedArea *CreateSharedArea(char *tag, INT32 page_count){
+	SharedArea *parea = NULL;
+	int i;
+
+	for(i=0;i<SharedAreaLimit&&parea==NULL;i++){
+		if(sharedarea[i].tag[0]=='\0')
+			parea = &sharedarea[i];
+	}
+	if(parea==NULL||freeframecount<page_count||framepinnedcount+page_count>PhysMemPages/2){
+		return NULL;
+	}
+	memset(parea, 0, sizeof(SharedArea));
+	strncpy(parea->tag, tag, sizeof(parea->tag)-1);
+	parea->page_count = page_count;
+	for(i=0;i<page_count;i++){
+		parea->frames[i] = GetFreeFrame();
+		SetFrameOwner(parea->frames[i], CURRENTPCB->Processid, 0); //MapPages gives the real page
+		framemap[parea->frames[i]].pinned |= FRAME_SHARED;
+		framepinnedcount++;
+		memset(&MEMORY[parea->frames[i]*PGSIZE], 0, PGSIZE); //the area starts zeroed
+	}
+	return parea;
+}
+
+/**************************************************************************************************************************************
+ReleaseSharedAreas
+//the process is gone, drop it from the areas it shares, the frames of an area
+//go back to the frame table with the last sharer, the caller has the frametable locked
+
+in: process id
+out: 
+**************************************************************************************************************************************/
+void ReleaseSharedAreas(INT32 pid){
+	int i, j;
+
+	if(pid<0||pid>=ProcessTableSize){
+		return;
+	}
+	for(i=0;i<SharedAreaLimit;i++){
+		if(sharedarea[i].tag[0]=='\0'||sharedarea[i].sharer[pid]!=1)
+			continue;
+		sharedarea[i].sharer[pid] = 0;
+		sharedarea[i].refcount--;
+		if(sharedarea[i].refcount==0){
+			for(j=0;j<sharedarea[i].page_count;j++){
+				framemap[sharedarea[i].frames[j]].pinned &= ~FRAME_SHARED;
+				FreeFrame(sharedarea[i].frames[j]);
+				framepinnedcount--;
+			}
+			sharedarea[i].tag[0] = '\0';
+		}
+	}
+}
+
+/**************************************************************************************************************************************
+AllocFrameTables
+//the hardware tells the size of the memory only when it starts, so the tables of frames are made here, before the policy and the
+//free list use them
+
+in: PhysMemPages
+out: halt if there is no room for them
+**************************************************************************************************************************************/
+void AllocFrameTables(){
+	framemap = (FrameEntry *)calloc( sizeof(FrameEntry), PhysMemPages );
+	frameage = (INT32 *)calloc( sizeof(INT32), PhysMemPages );
+	framelist = (INT32 *)calloc( sizeof(INT32), PhysMemPages );
+	listnext = (INT32 *)calloc( sizeof(INT32), PhysMemPages );
+	listprev = (INT32 *)calloc( sizeof(INT32), PhysMemPages );
+	ghostpages[0] = (SwapOwner *)calloc( sizeof(SwapOwner), PhysMemPages );
+	ghostpages[1] = (SwapOwner *)calloc( sizeof(SwapOwner), PhysMemPages );
+	framelastuse = (INT32 *)calloc( sizeof(INT32), PhysMemPages );
+	if(framemap==NULL||frameage==NULL||framelist==NULL||listnext==NULL||listprev==NULL||ghostpages[0]==NULL||ghostpages[1]==NULL||framelastuse==NULL){
+		printf("ERROR! No room for the tables of %d frames\n", PhysMemPages);
+		CALL(Z502Halt());
+	}
+}
+
+/**************************************************************************************************************************************
+InitFrameMap
+//all frames are free at the beginning, the free list keeps them in order so frame 0 goes first
+
+in: 
+out: 
+**************************************************************************************************************************************/
+void InitFrameMap(){
+	int i;
+	freeframehead = -1;
+	freeframecount = 0;
+	for(i=PhysMemPages-1;i>=0;i--){
+		framemap[i].pinned = 0;
+		framemap[i].pid = -1;
+		FreeFrame(i);
+	}
+}
+
+/**************************************************************************************************************************************
+IsFreeFrameExist
+//judge is there any free frame in frame table
+
+in: 
+out:1 if have free frame, 0 if no free frame
+**************************************************************************************************************************************/
+INT32 IsFreeFrameExist(){
+	if(freeframecount>0)
+		return 1;
+	return 0;
+}
+
+/**************************************************************************************************************************************
+GetFreeFrame
+//take the first frame of the free list, the caller gives it an owner with SetFrameOwner
+
+in: 
+out: free frame number, -1 if there is none
+**************************************************************************************************************************************/
+INT32 GetFreeFrame(){
+	INT32 frame_number = freeframehead;
+
+	if(frame_number==-1){
+		return -1;
+	}
+	freeframehead = framemap[frame_number].nextfree;
+	framemap[frame_number].nextfree = -1;
+	freeframecount--;
+	return frame_number;
+}
+
+/**************************************************************************************************************************************
+SetFrameOwner
+//record which page of which process is in the frame, the replacement policy hears of it
+
+in: frame number, process id, virtual page
+out: 
+**************************************************************************************************************************************/
+void SetFrameOwner(INT32 frame_number, INT32 pid, INT32 vpn){
+	if(framemap[frame_number].pid!=-1)
+		residentcount[framemap[frame_number].pid]--;
+	residentcount[pid]++;
+	framemap[frame_number].pid = pid;
+	framemap[frame_number].vpn = vpn;
+	framelastuse[frame_number] = wstick;
+	replacepolicy->pagein(frame_number);
+}
+
+/**************************************************************************************************************************************
+FreeFrame
+//give the frame back, it goes to the head of the free list
+
+in: frame number
+out: 
+**************************************************************************************************************************************/
+void FreeFrame(INT32 frame_number){
+	if(replacepolicy->release!=NULL)
+		replacepolicy->release(frame_number);
+	if(framemap[frame_number].pid!=-1)
+		residentcount[framemap[frame_number].pid]--;
+	framemap[frame_number].pid = -1;
+	framemap[frame_number].vpn = 0;
+	framemap[frame_number].nextfree = freeframehead;
+	freeframehead = frame_number;
+	freeframecount++;
+}
+
+/**************************************************************************************************************************************
+Below are the routines for page replacement, the fault handler only asks replacepolicy for a victim, the policies
+see the frames come and go through SetFrameOwner and FreeFrame
+
+	SelectReplacePolicy, PrintPagingReport, SamplePages, ListAppend, ListUnlink, GhostFind, GhostAdd, GhostRemove, AnyUnpinnedFrame, IsVictimRefused,
+	ClockInit, ClockPageIn, ClockVictim, WSClockPageIn, WSClockVictim, AgingFault, AgingPageIn, AgingVictim,
+	ListInit, ListRelease, TwoQPageIn, TwoQVictim, ARCPageIn, ARCVictim
+**************************************************************************************************************************************/
+
+/**************************************************************************************************************************************
+SelectReplacePolicy
+//find the policy by name, the clock if there is no such one
+
+in: policy name
+out: 
+**************************************************************************************************************************************/
+void SelectReplacePolicy(char *name){
+	int i;
+	for(i=0;i<ReplacePolicyCount;i++){
+		if(strcmp(replacepolicies[i].name, name)==0){
+			replacepolicy = &replacepolicies[i];
+			return;
+		}
+	}
+	printf("ERROR! There is no replacement policy %s, use clock. The policies are:", name);
+	for(i=0;i<ReplacePolicyCount;i++)
+		printf(" %s", replacepolicies[i].name);
+	printf("\n");
+	replacepolicy = &replacepolicies[0];
+}
+
+/**************************************************************************************************************************************
+PrintPagingReport
+//print what the policy cost us, only when a policy is given on the command line,
+//the hardware statistics after it give the faults per 1000 references
+
+in: pagingstats
+out: 
+**************************************************************************************************************************************/
+void PrintPagingReport(){
+	if(pagingreport!=1)
+		return;
+	printf("Paging report: policy = %s: Frames = %d: Faults = %d: Page ins = %d: Page outs = %d: Clean evictions = %d: Readaheads = %d: Load swaps = %d: Cleaner writes = %d: Peak table leaves = %d\n",
+		replacepolicy->name, PhysMemPages, pagingstats.faults, pagingstats.pageins, pagingstats.pageouts, pagingstats.cleanevictions,
+		pagingstats.readaheads, pagingstats.loadswaps, pagingstats.cleanerwrites, pagingstats.peakleaves);
+}
+
+/**************************************************************************************************************************************
+SamplePages
+//shift the reference bit of every page into its age and clear it, aging runs this on every fault
+
+in: 
+out: 
+**************************************************************************************************************************************/
+void SamplePages(){
+	int i;
+	for(i=0;i<PhysMemPages;i++){
+		if(framemap[i].pid==-1||IsFramePinned(i)==1)
+			continue;
+		frameage[i] >>= 1;
+		if((*FramePTE(i)&PTBL_REFERENCED_BIT)!=0){
+			frameage[i] |= 0x80;
+			*FramePTE(i) &= ~PTBL_REFERENCED_BIT;
+		}
+	}
+}
+
+/**************************************************************************************************************************************
+ListAppend
+//put the frame at the tail of the list, 2Q and ARC keep their resident pages in two lists
+
+in: list, frame number
+out: 
+**************************************************************************************************************************************/
+void ListAppend(INT32 list, INT32 frame_number){
+	framelist[frame_number] = list;
+	listnext[frame_number] = -1;
+	listprev[frame_number] = listtail[list];
+	if(listtail[list]!=-1)
+		listnext[listtail[list]] = frame_number;
+	else listhead[list] = frame_number;
+	listtail[list] = frame_number;
+	listsize[list]++;
+}
+
+/**************************************************************************************************************************************
+ListUnlink
+//take the frame out of its list, nothing if it is in none
+
+in: frame number
+out: 
+**************************************************************************************************************************************/
+void ListUnlink(INT32 frame_number){
+	INT32 list = framelist[frame_number];
+
+	if(list==-1)
+		return;
+	if(listprev[frame_number]!=-1)
+		listnext[listprev[frame_number]] = listnext[frame_number];
+	else listhead[list] = listnext[frame_number];
+	if(listnext[frame_number]!=-1)
+		listprev[listnext[frame_number]] = listprev[frame_number];
+	else listtail[list] = listprev[frame_number];
+	framelist[frame_number] = -1;
+	listsize[list]--;
+}
+
+/**************************************************************************************************************************************
+GhostFind
+//find the page in the ghost list, the ghosts are pages that left memory not long ago, oldest first
+
+in: ghost list, process id, virtual page
+out: the index, -1 if not there
+**************************************************************************************************************************************/
+INT32 GhostFind(INT32 ghost, INT32 pid, INT32 vpn){
+	int i;
+	for(i=0;i<ghostcount[ghost];i++){
+		if(ghostpages[ghost][i].pid==pid&&ghostpages[ghost][i].vpn==vpn)
+			return i;
+	}
+	return -1;
+}
+
+/**************************************************************************************************************************************
+GhostRemove
+//forget the ghost at the index
+
+in: ghost list, index
+out: 
+**************************************************************************************************************************************/
+void GhostRemove(INT32 ghost, INT32 index){
+	memmove(&ghostpages[ghost][index], &ghostpages[ghost][index+1], sizeof(SwapOwner)*(ghostcount[ghost]-index-1));
+	ghostcount[ghost]--;
+}
+
+/**************************************************************************************************************************************
+GhostAdd
+//remember the page that leaves the frame, the oldest ghost goes when the list is full
+
+in: ghost list, frame number
+out: 
+**************************************************************************************************************************************/
+void GhostAdd(INT32 ghost, INT32 frame_number){
+	if(ghostcount[ghost]==PhysMemPages)
+		GhostRemove(ghost, 0);
+	ghostpages[ghost][ghostcount[ghost]].pid = framemap[frame_number].pid;
+	ghostpages[ghost][ghostcount[ghost]].vpn = framemap[frame_number].vpn;
+	ghostcount[ghost]++;
+}
+
+/**************************************************************************************************************************************
+AnyUnpinnedFrame
+//the last way out of a policy that finds nothing in its lists
+
+in: 
+out: the first frame that is not pinned
+**************************************************************************************************************************************/
+INT32 AnyUnpinnedFrame(){
+	int i;
+	for(i=0;i<PhysMemPages;i++){
+		if(framemap[i].pid!=-1&&IsFramePinned(i)!=1)
+			return i;
+	}
+	return 0;
+}
+
+/**************************************************************************************************************************************
+IsVictimRefused
+//readahead only takes a victim that needs no write, the policy keeps its choice for the next fault then
+
+in: victim frame number, 1 for a clean victim only
+out: 1 if the victim cant be used
+**************************************************************************************************************************************/
+INT32 IsVictimRefused(INT32 frame_number, INT32 cleanonly){
+	if(cleanonly==1&&IsFrameDirty(frame_number)==1)
+		return 1;
+	return 0;
+}
+
+/**************************************************************************************************************************************
+ClockInit
+//the hand starts at frame 0
+
+in: 
+out: 
+**************************************************************************************************************************************/
+void ClockInit(){
+	currentvictim = 0;
+}
+
+/**************************************************************************************************************************************
+ClockPageIn
+//the hand stays at the frame that was just filled
+
+in: frame number
+out: 
+**************************************************************************************************************************************/
+void ClockPageIn(INT32 frame_number){
+	currentvictim = frame_number;
+}
+
+/**************************************************************************************************************************************
+ClockVictim
+//second chance, the hand clears the reference bits until it finds a page without one
+
+in: 1 for a clean victim only
+out: victim frame number, -1 if it has to be clean and is not
+**************************************************************************************************************************************/
+INT32 ClockVictim(INT32 cleanonly){
+	INT32 frame_number;
+
+	for(frame_number = currentvictim;frame_number<PhysMemPages;){
+		if(IsFramePinned(frame_number)||(*FramePTE(frame_number)&PTBL_REFERENCED_BIT)>>13==1)
+		{
+			if(IsFramePinned(frame_number)!=1) *FramePTE(frame_number)&=(~PTBL_REFERENCED_BIT);
+			if(frame_number==PhysMemPages-1){
+				frame_number = 0;
+			}
+			else frame_number++;
+		}
+		else break;
+	}
+	currentvictim = frame_number;
+	if(IsVictimRefused(frame_number, cleanonly)==1)
+		return -1;
+	return frame_number;
+}
+
+/**************************************************************************************************************************************
+WSClockPageIn
+//the page was used now, the time is counted in faults
+
+in: frame number
+out: 
+**************************************************************************************************************************************/
+void WSClockPageIn(INT32 frame_number){
+	frameage[frame_number] = pagingstats.faults;
+}
+
+/**************************************************************************************************************************************
+WSClockVictim
+//the clock over the working set, a page used in the last WSClockWindow faults stays, an old clean page goes
+//first because it needs no write, else the first old dirty page, else the oldest page
+
+in: 1 for a clean victim only
+out: victim frame number, -1 if it has to be clean and is not
+**************************************************************************************************************************************/
+INT32 WSClockVictim(INT32 cleanonly){
+	INT32 i, frame_number;
+	INT32 olddirty = -1, oldest = -1;
+
+	for(i=0;i<PhysMemPages;i++){
+		frame_number = (currentvictim+i)%PhysMemPages;
+		if(framemap[frame_number].pid==-1||IsFramePinned(frame_number)==1)
+			continue;
+		if((*FramePTE(frame_number)&PTBL_REFERENCED_BIT)!=0){ //in the working set
+			*FramePTE(frame_number) &= ~PTBL_REFERENCED_BIT;
+			frameage[frame_number] = pagingstats.faults;
+		}
+		else if(pagingstats.faults-frameage[frame_number]>WSClockWindow){ //out of the working set
+			if(IsFrameDirty(frame_number)!=1){
+				currentvictim = (frame_number+1)%PhysMemPages;
+				return frame_number;
+			}
+			if(olddirty==-1)
+				olddirty = frame_number;
+		}
+		if(oldest==-1||frameage[frame_number]<frameage[oldest])
+			oldest = frame_number;
+	}
+	frame_number = (olddirty!=-1) ? olddirty : oldest;
+	if(frame_number==-1)
+		frame_number = AnyUnpinnedFrame();
+	if(IsVictimRefused(frame_number, cleanonly)==1)
+		return -1;
+	currentvictim = (frame_number+1)%PhysMemPages;
+	return frame_number;
+}
+
+/**************************************************************************************************************************************
+AgingFault
+//every fault is a sampling point of the reference bits
+
+in: 
+out: 
+**************************************************************************************************************************************/
+void AgingFault(){
+	SamplePages();
+}
+
+/**************************************************************************************************************************************
+AgingPageIn
+//a new page counts as just used
+
+in: frame number
+out: 
+**************************************************************************************************************************************/
+void AgingPageIn(INT32 frame_number){
+	frameage[frame_number] = 0x80;
+}
+
+/**************************************************************************************************************************************
+AgingVictim
+//the page with the smallest age is the least used lately, the search starts after the last victim so
+//pages with the same age take turns
+
+in: 1 for a clean victim only
+out: victim frame number, -1 if it has to be clean and is not
+**************************************************************************************************************************************/
+INT32 AgingVictim(INT32 cleanonly){
+	INT32 i, frame_number, victim = -1;
+
+	for(i=0;i<PhysMemPages;i++){
+		frame_number = (currentvictim+i)%PhysMemPages;
+		if(framemap[frame_number].pid==-1||IsFramePinned(frame_number)==1)
+			continue;
+		if(victim==-1||frameage[frame_number]<frameage[victim])
+			victim = frame_number;
+	}
+	if(victim==-1)
+		victim = AnyUnpinnedFrame();
+	if(IsVictimRefused(victim, cleanonly)==1)
+		return -1;
+	currentvictim = (victim+1)%PhysMemPages;
+	return victim;
+}
+
+/**************************************************************************************************************************************
+ListInit
+//empty lists and ghosts for 2Q and ARC
+
+in: 
+out: 
+**************************************************************************************************************************************/
+void ListInit(){
+	int i;
+	for(i=0;i<2;i++){
+		listhead[i] = -1;
+		listtail[i] = -1;
+		listsize[i] = 0;
+		ghostcount[i] = 0;
+	}
+	for(i=0;i<PhysMemPages;i++)
+		framelist[i] = -1;
+	arctarget = 0;
+}
+
+/**************************************************************************************************************************************
+ListRelease
+//the frame is free again, it leaves its list
+
+in: frame number
+out: 
+**************************************************************************************************************************************/
+void ListRelease(INT32 frame_number){
+	ListUnlink(frame_number);
+}
+
+/**************************************************************************************************************************************
+TwoQPageIn
+//a page seen again after it left A1in goes to Am, a new page to A1in
+
+in: frame number
+out: 
+**************************************************************************************************************************************/
+void TwoQPageIn(INT32 frame_number){
+	INT32 index;
+
+	ListUnlink(frame_number);
+	index = GhostFind(0, framemap[frame_number].pid, framemap[frame_number].vpn);
+	if(index!=-1){
+		GhostRemove(0, index);
+		ListAppend(1, frame_number); //Am
+	}
+	else ListAppend(0, frame_number); //A1in
+}
+
+/**************************************************************************************************************************************
+TwoQVictim
+//A1in is a fifo of pages used once, it gives its oldest page when it has more than its share and
+//remembers it in A1out, else Am gives a page by second chance
+
+in: 1 for a clean victim only
+out: victim frame number, -1 if it has to be clean and is not
+**************************************************************************************************************************************/
+INT32 TwoQVictim(INT32 cleanonly){
+	INT32 i, frame_number;
+
+	if(listsize[0]>PhysMemPages/TwoQInRatio||listsize[1]==0){
+		for(frame_number=listhead[0];frame_number!=-1;frame_number=listnext[frame_number]){
+			if(IsFramePinned(frame_number)!=1){
+				if(IsVictimRefused(frame_number, cleanonly)==1)
+					return -1;
+				GhostAdd(0, frame_number); //A1out
+				ListUnlink(frame_number);
+				return frame_number;
+			}
+		}
+	}
+	for(i=0;i<2*listsize[1]+1&&listhead[1]!=-1;i++){
+		frame_number = listhead[1];
+		if(IsFramePinned(frame_number)==1||(*FramePTE(frame_number)&PTBL_REFERENCED_BIT)!=0){
+			if(IsFramePinned(frame_number)!=1) *FramePTE(frame_number) &= ~PTBL_REFERENCED_BIT;
+			ListUnlink(frame_number);
+			ListAppend(1, frame_number);
+			continue;
+		}
+		if(IsVictimRefused(frame_number, cleanonly)==1)
+			return -1;
+		ListUnlink(frame_number);
+		return frame_number;
+	}
+	for(frame_number=listhead[0];frame_number!=-1;frame_number=listnext[frame_number]){
+		if(IsFramePinned(frame_number)!=1){
+			if(IsVictimRefused(frame_number, cleanonly)==1)
+				return -1;
+			GhostAdd(0, frame_number);
+			ListUnlink(frame_number);
+			return frame_number;
+		}
+	}
+	if(cleanonly==1)
+		return -1;
+	return AnyUnpinnedFrame();
+}
+
+/**************************************************************************************************************************************
+ARCPageIn
+//a page in ghost B1 or B2 goes to T2 and moves the target size of T1 to the side that missed it, a new page
+//goes to T1, the ghosts are cut so T1+B1 and all four lists stay inside memory and twice memory
+
+in: frame number
+out: 
+**************************************************************************************************************************************/
+void ARCPageIn(INT32 frame_number){
+	INT32 index, delta;
+
+	ListUnlink(frame_number);
+	if((index = GhostFind(0, framemap[frame_number].pid, framemap[frame_number].vpn))!=-1){ //B1, T1 was too small
+		delta = (ghostcount[0]>=ghostcount[1]) ? 1 : ghostcount[1]/ghostcount[0];
+		arctarget = (arctarget+delta>PhysMemPages) ? PhysMemPages : arctarget+delta;
+		GhostRemove(0, index);
+		ListAppend(1, frame_number);
+	}
+	else if((index = GhostFind(1, framemap[frame_number].pid, framemap[frame_number].vpn))!=-1){ //B2, T2 was too small
+		delta = (ghostcount[1]>=ghostcount[0]) ? 1 : ghostcount[0]/ghostcount[1];
+		arctarget = (arctarget-delta<0) ? 0 : arctarget-delta;
+		GhostRemove(1, index);
+		ListAppend(1, frame_number);
+	}
+	else{
+		if(listsize[0]+ghostcount[0]>=PhysMemPages&&ghostcount[0]>0)
+			GhostRemove(0, 0);
+		else if(listsize[0]+listsize[1]+ghostcount[0]+ghostcount[1]>=2*PhysMemPages&&ghostcount[1]>0)
+			GhostRemove(1, 0);
+		ListAppend(0, frame_number);
+	}
+}
+
+/**************************************************************************************************************************************
+ARCVictim
+//T1 gives a page while it is larger than its target, else T2, the hardware only gives reference bits so a
+//referenced page in T1 moves to T2 and one in T2 goes round, the way CAR does it
+
+in: 1 for a clean victim only
+out: victim frame number, -1 if it has to be clean and is not
+**************************************************************************************************************************************/
+INT32 ARCVictim(INT32 cleanonly){
+	INT32 i, frame_number, list;
+
+	for(i=0;i<4*PhysMemPages;i++){
+		list = (listsize[0]>0&&(listsize[0]>=arctarget||listsize[1]==0)) ? 0 : 1;
+		frame_number = listhead[list];
+		if(frame_number==-1)
+			break;
+		if(IsFramePinned(frame_number)==1){
+			ListUnlink(frame_number);
+			ListAppend(list, frame_number);
+			continue;
+		}
+		if((*FramePTE(frame_number)&PTBL_REFERENCED_BIT)!=0){
+			*FramePTE(frame_number) &= ~PTBL_REFERENCED_BIT;
+			ListUnlink(frame_number);
+			ListAppend(1, frame_number);
+			continue;
+		}
+		if(IsVictimRefused(frame_number, cleanonly)==1)
+			return -1;
+		GhostAdd(list, frame_number); //B1 or B2
+		ListUnlink(frame_number);
+		return frame_number;
+	}
+	if(cleanonly==1)
+		return -1;
+	return AnyUnpinnedFrame();
+}
+
+/**************************************************************************************************************************************
+Below are the routines for readahead, a fault that goes on a stride of the last fault reads the next pages of the stride on the disks
+that are free, a swap-in without a stride takes its neighbour page with it, a request that comes for the disk later waits in its queue,
+the page is only valid when the interrupt of its disk says the read is done
+
+	IsDiskFree, StartDiskRead, UnmapFrame, ReadAhead, FinishReadAhead, WaitForReadAhead, CancelReadAhead
+**************************************************************************************************************************************/
+
+/**************************************************************************************************************************************
+IsDiskFree
+//ask the disk if it is free, no request waits for it and the interrupt of its last request or readahead is handled,
+//only then it may take a background request
+
+in: disk id
+out: 1 if free, 0 if in use
+**************************************************************************************************************************************/
+INT32 IsDiskFree(INT32 disk_id){
+	INT32	Temp;
+
+	MEM_WRITE(Z502DiskSetID, &disk_id);
+	MEM_READ(Z502DiskStatus, &Temp);
+	if(Temp==DEVICE_FREE&&diskqueue[disk_id].count==0&&diskqueue[disk_id].active.pid==-1&&diskqueue[disk_id].readahead==-1)
+		return 1;
+	return 0;
+}
+
+/**************************************************************************************************************************************
+StartDiskRead
+//start the read on a free disk, nobody is suspended for it
+
+in: disk id, sector, data
+out: 
+**************************************************************************************************************************************/
+void StartDiskRead(INT32 disk_id, INT32 sector, char *char_data){
+	IssueDiskIO(disk_id, sector, 0, 0, char_data);
+}
+
+/**************************************************************************************************************************************
+UnmapFrame
+//take the page out of the page table of its owner, it has to be clean, its copy is in the swap slot
+
+in: frame number
+out: 
+**************************************************************************************************************************************/
+void UnmapFrame(INT32 frame_number){
+	*FramePTE(frame_number) &= ~(PTBL_VALID_BIT|PTBL_MODIFIED_BIT);
+	*FramePTE(frame_number) |= PTBL_SWAPPED_BIT;
+	Z502InvalidateTLB(framemap[frame_number].vpn);
+}
+
+/**************************************************************************************************************************************
+ReadAhead
+//learn the stride of the faults of the process, when the same stride comes twice read up to ReadAheadPages pages ahead, free
+//frames first, then clean victims, a swap-in alone only reads SwapClusterPages neighbours into free frames,
+//a page is only read if it is on disk and its disk is free, it stays invalid and its frame busy until FinishReadAhead,
+//the frame of the fault is busy until the loop ends so we dont take it back
+
+in: process id, virtual page of the fault
+out: 
+**************************************************************************************************************************************/
+void ReadAhead(INT32 pid, INT32 vpn){
+	UINT16	**table = GetPageTable(pid);
+	INT32	stride, count, cleanvictims;
+	INT32	i, next, slot, frame_number, faulted;
+
+	if(vpn-lastfault[pid]!=0&&vpn-lastfault[pid]==faultstride[pid])
+		stridehits[pid]++;
+	else{
+		faultstride[pid] = vpn-lastfault[pid];
+		stridehits[pid] = 0;
+	}
+	lastfault[pid] = vpn;
+	if(stridehits[pid]>=1){
+		stride = faultstride[pid];
+		count = ReadAheadPages;
+		cleanvictims = 1;
+	}
+	else if((PeekTableEntry(table, vpn)&PTBL_SWAPPED_BIT)!=0){
+		stride = 1;
+		count = SwapClusterPages;
+		cleanvictims = 0;
+	}
+	else return;
+
+	faulted = PeekTableEntry(table, vpn)&PTBL_PHYS_PG_NO;
+	framemap[faulted].pinned |= FRAME_BUSY;
+	for(i=1;i<=count;i++){
+		next = vpn+stride*i;
+		if(next<0||next>=VIRTUAL_MEM_PGS)
+			break;
+		if((PeekTableEntry(table, next)&PTBL_VALID_BIT)!=0||(PeekTableEntry(table, next)&PTBL_SWAPPED_BIT)==0)
+			continue;
+		slot = SwapSlotOf(pid, next);
+		if(slot==-1||IsDiskFree(SwapDisk(slot))!=1)
+			continue;
+		frame_number = GetFreeFrame();
+		if(frame_number==-1){
+			if(cleanvictims!=1)
+				break;
+			frame_number = replacepolicy->victim(1);
+			if(frame_number==-1)
+				break;
+			UnmapFrame(frame_number);
+		}
+		StartDiskRead(SwapDisk(slot), SwapSector(slot), (char *) &MEMORY[frame_number*PGSIZE]);
+		SetFrameOwner(frame_number, pid, next);
+		framemap[frame_number].pinned |= FRAME_BUSY;
+		diskqueue[SwapDisk(slot)].readahead = frame_number;
+		pagingstats.readaheads++;
+	}
+	framemap[faulted].pinned &= ~FRAME_BUSY;
+}
+
+/**************************************************************************************************************************************
+FinishReadAhead
+//called by the disk interrupt for a free disk, the readahead on it is done, its page becomes valid unless the page got another
+//frame or its process is gone meanwhile, or the read failed, then the frame is free again, the caller holds the frametable lock
+
+in: disk id, status of the interrupt
+out: 
+**************************************************************************************************************************************/
+void FinishReadAhead(INT32 disk_id, INT32 status){
+	INT32	frame_number = diskqueue[disk_id].readahead;
+
+	if(frame_number==-1)
+		return;
+	diskqueue[disk_id].readahead = -1;
+	framemap[frame_number].pinned &= ~FRAME_BUSY;
+	if(diskqueue[disk_id].readaheadstale==1||status!=ERR_SUCCESS){
+		diskqueue[disk_id].readaheadstale = 0;
+		FreeFrame(frame_number);
+		return;
+	}
+	*FramePTE(frame_number) = (UINT16)frame_number|PTBL_VALID_BIT|PTBL_SWAPPED_BIT; //the copy on disk stays good until we write the page
+}
+
+/**************************************************************************************************************************************
+WaitForReadAhead
+//the fault is on a page a readahead still reads, idle until the interrupt of its disk is handled, the caller holds the frametable
+//lock, it is given up while we idle
+
+in: process id, virtual page
+out: 1 if the page is valid now, 0 if there was no readahead or it brought nothing, the fault reads the page itself then
+**************************************************************************************************************************************/
+INT32 WaitForReadAhead(INT32 pid, INT32 vpn){
+	INT32	LockResult;
+	INT32	disk_id, frame_number;
+
+	for(disk_id=1;disk_id<=MAX_NUMBER_OF_DISKS;disk_id++){
+		frame_number = diskqueue[disk_id].readahead;
+		if(frame_number!=-1&&framemap[frame_number].pid==pid&&framemap[frame_number].vpn==vpn)
+			break;
+	}
+	if(disk_id>MAX_NUMBER_OF_DISKS)
+		return 0;
+	READ_MODIFY(MEMORY_INTERLOCK_BASE+4, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //frametable
+	while(diskqueue[disk_id].readahead==frame_number){
+		CALL(Z502Idle());
+	}
+	READ_MODIFY(MEMORY_INTERLOCK_BASE+4, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //frametable
+	if((PeekTableEntry(GetPageTable(pid), vpn)&PTBL_VALID_BIT)!=0)
+		return 1;
+	return 0;
+}
+
+/**************************************************************************************************************************************
+CancelReadAhead
+//the page gets another frame or its process is gone, a readahead for it must not make it valid when its read is done,
+//the caller holds the frametable lock
+
+in: process id, virtual page, -1 for all pages of the process
+out: 
+**************************************************************************************************************************************/
+void CancelReadAhead(INT32 pid, INT32 vpn){
+	INT32	disk_id, frame_number;
+
+	for(disk_id=1;disk_id<=MAX_NUMBER_OF_DISKS;disk_id++){
+		frame_number = diskqueue[disk_id].readahead;
+		if(frame_number!=-1&&framemap[frame_number].pid==pid&&(vpn==-1||framemap[frame_number].vpn==vpn))
+			diskqueue[disk_id].readaheadstale = 1;
+	}
+}
+
+/**************************************************************************************************************************************
+Below are the routines for working set, the timer interrupt samples the reference bits, a page used in the last WorkingSetTicks samples
+is in the working set of its process, the working set gives the frame quota of the process, and the load controller keeps
+the sum of the working sets inside the memory by taking processes out of the readyqueue
+
+	SampleWorkingSets, ChooseVictim, LocalVictim, LoadControl, IsLoadSwapped
+**************************************************************************************************************************************/
+
+/**************************************************************************************************************************************
+SampleWorkingSets
+//one sample, the reference bits go into the last use of the frames, then count the working set and set the quota of every process,
+//the quota is the working set with some slack but never less than the fair share of the memory, the sample sees only a few
+//references of a process that waits for the disk most of the time
+
+in: 
+out: 
+**************************************************************************************************************************************/
+void SampleWorkingSets(){
+	int i;
+	INT32 active = 0, share;
+
+	wstick++;
+	for(i=0;i<ProcessTableSize;i++)
+		workingset[i] = 0;
+	for(i=0;i<PhysMemPages;i++){
+		if(framemap[i].pid==-1||IsFramePinned(i)==1)
+			continue;
+		if((*FramePTE(i)&PTBL_REFERENCED_BIT)!=0){
+			*FramePTE(i) &= ~PTBL_REFERENCED_BIT;
+			framelastuse[i] = wstick;
+		}
+		if(wstick-framelastuse[i]<WorkingSetTicks)
+			workingset[framemap[i].pid]++;
+	}
+	for(i=0;i<ProcessTableSize;i++){
+		if(residentcount[i]>0&&loadswapped[i]!=1)
+			active++;
+	}
+	share = (active>0) ? PhysMemPages/active : PhysMemPages;
+	for(i=0;i<ProcessTableSize;i++){
+		if(residentcount[i]==0)
+			framequota[i] = 0;
+		else if(workingset[i]+WorkingSetSlack>PhysMemPages)
+			framequota[i] = PhysMemPages;
+		else if(workingset[i]+WorkingSetSlack<share)
+			framequota[i] = share;
+		else framequota[i] = workingset[i]+WorkingSetSlack;
+	}
+}
+
+/**************************************************************************************************************************************
+ChooseVictim
+//a process that has its quota gives up one of its own pages, else the process most over its quota gives one, when nobody
+//is over the quota, or before the first sample, the replacement policy chooses
+
+in: process id of the fault
+out: victim frame number
+**************************************************************************************************************************************/
+INT32 ChooseVictim(INT32 pid){
+	INT32 i, frame_number, target = -1;
+
+	if(framequota[pid]>0&&residentcount[pid]>=framequota[pid])
+		target = pid;
+	else{
+		for(i=0;i<ProcessTableSize;i++){
+			if(framequota[i]>0&&residentcount[i]>framequota[i]
+				&&(target==-1||residentcount[i]-framequota[i]>residentcount[target]-framequota[target]))
+				target = i;
+		}
+	}
+	if(target!=-1){
+		frame_number = LocalVictim(target);
+		if(frame_number!=-1)
+			return frame_number;
+	}
+	return replacepolicy->victim(0);
+}
+
+/**************************************************************************************************************************************
+LocalVictim
+//second chance over the frames of the process
+
+in: process id
+out: victim frame number, -1 if it has none to give
+**************************************************************************************************************************************/
+INT32 LocalVictim(INT32 pid){
+	INT32 i, frame_number;
+
+	for(i=0;i<2*PhysMemPages;i++){
+		frame_number = (localhand+i)%PhysMemPages;
+		if(framemap[frame_number].pid!=pid||IsFramePinned(frame_number)==1)
+			continue;
+		if((*FramePTE(frame_number)&PTBL_REFERENCED_BIT)!=0){
+			*FramePTE(frame_number) &= ~PTBL_REFERENCED_BIT;
+			continue;
+		}
+		localhand = (frame_number+1)%PhysMemPages;
+		return frame_number;
+	}
+	return -1;
+}
+
+/**************************************************************************************************************************************
+LoadControl
+//while the working sets of the running processes are more than the memory, the ready process with the largest one goes to
+//the suspendqueue as swapped, its pages are not used any more and the replacement takes them, a swapped process comes back
+//when its working set fits again, or when nothing else is ready, the caller has the readyqueue and suspendqueue locked
+
+in: 
+out: 
+**************************************************************************************************************************************/
+void LoadControl(){
+	PCBNode	pnode;
+	Process_Control_Block	pcbtemp;
+	INT32	i, pid, target, total = 0;
+
+	for(pid=0;pid<ProcessTableSize;pid++){
+		if(loadswapped[pid]==1&&IsPidExist(suspendqueue, pid)!=1)
+			loadswapped[pid] = 0; //someone else resumed it
+		if(loadswapped[pid]!=1)
+			total += workingset[pid];
+	}
+	while(total>PhysMemPages){
+		target = -1;
+		pnode = readyqueue->front;
+		for(i=1;pnode!=NULL&&i<=readyqueue->size;i++,pnode=pnode->next){
+			pid = pnode->data.Processid;
+			if(pid==CURRENTPCB->Processid)
+				continue;
+			if(target==-1||workingset[pid]>workingset[target])
+				target = pid;
+		}
+		if(target==-1||workingset[target]==0)
+			break;
+		pcbtemp = GetPcbByPid(target);
+		AddToSuspendQueue(suspendqueue, &pcbtemp);
+		RemoveQueueByPid(readyqueue, target);
+		loadswapped[target] = 1;
+		swappedset[target] = workingset[target];
+		total -= workingset[target];
+		pagingstats.loadswaps++;
+	}
+	while(1){
+		target = -1;
+		for(pid=0;pid<ProcessTableSize;pid++){
+			if(loadswapped[pid]==1&&(target==-1||swappedset[pid]<swappedset[target]))
+				target = pid;
+		}
+		if(target==-1)
+			break;
+		if(total+swappedset[target]>PhysMemPages&&IsEmpty(readyqueue)!=1)
+			break;
+		pcbtemp = GetPcbByPid(target);
+		AddToReadyQueueByPriority(readyqueue, &pcbtemp);
+		RemoveQueueByPid(suspendqueue, target);
+		loadswapped[target] = 0;
+		total += swappedset[target];
+	}
+}
+
+/**************************************************************************************************************************************
+IsLoadSwapped
+//is the process in the suspendqueue because of the load controller, the disk interrupt must not wake it
+
+in: process id
+out: 1 if yes, 0 if no
+**************************************************************************************************************************************/
+INT32 IsLoadSwapped(INT32 pid){
+	if(pid>=0&&pid<ProcessTableSize&&loadswapped[pid]==1)
+		return 1;
+	return 0;
+}
+
+/**************************************************************************************************************************************
+Below are the routines for the page cleaner, when the cpu idles and there are less than CleanFrameReserve free or clean frames,
+the cleaner writes dirty pages that were not used since the last scan to the free disks, so the next victims need no write
+
+	PageCleaner, CountCleanFrames, StartDiskWrite
+**************************************************************************************************************************************/
+
+/**************************************************************************************************************************************
+PageCleaner
+//called before every idle of a process that waits, it goes round from the clock hand, so the next victims are cleaned first,
+//a page is only written to the slot under the swap cursor when that slot is free and its disk is free, then it has no write to wait for,
+//it stops at the reserve or at the first busy disk, the write is waited for like a readahead, the count before the lock
+//is only a guess, but the idle loop must not wait for the lock when there is nothing to do, an interrupt would be lost before the idle
+
+in: 
+out: the writes started
+**************************************************************************************************************************************/
+INT32 PageCleaner(){
+	INT32	LockResult;
+	INT32	i, frame_number, slot, clean, started = 0;
+
+	if(freeframecount>=CleanFrameReserve||CountCleanFrames()>=CleanFrameReserve)
+		return 0;
+	READ_MODIFY(MEMORY_INTERLOCK_BASE+4, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //frametable
+	clean = CountCleanFrames();
+	for(i=0;i<PhysMemPages&&clean<CleanFrameReserve;i++){
+		frame_number = (currentvictim+i)%PhysMemPages;
+		if(framemap[frame_number].pid==-1||IsFramePinned(frame_number)==1)
+			continue;
+		if(IsFrameDirty(frame_number)!=1||(*FramePTE(frame_number)&PTBL_REFERENCED_BIT)!=0)
+			continue;
+		if((swapbitmap[swapcursor/32]&(1u<<(swapcursor%32)))!=0||IsDiskFree(SwapDisk(swapcursor))!=1)
+			break;
+		slot = GetSwapSlot(framemap[frame_number].pid, framemap[frame_number].vpn);
+		StartDiskWrite(SwapDisk(slot), SwapSector(slot), (char *) &MEMORY[frame_number*PGSIZE]);
+		*FramePTE(frame_number) &= ~PTBL_MODIFIED_BIT; //the disk has the page as it is now, a new write sets the bit again
+		*FramePTE(frame_number) |= PTBL_SWAPPED_BIT;
+		pagingstats.cleanerwrites++;
+		clean++;
+		started++;
+	}
+	READ_MODIFY(MEMORY_INTERLOCK_BASE+4, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //frametable
+	return started;
+}
+
+/**************************************************************************************************************************************
+CountCleanFrames
+//the frames a fault can have without a write, free ones and unpinned ones that are good on disk
+
+in: 
+out: number of frames
+**************************************************************************************************************************************/
+INT32 CountCleanFrames(){
+	INT32 i, count = freeframecount;
+
+	for(i=0;i<PhysMemPages;i++){
+		if(framemap[i].pid!=-1&&IsFramePinned(i)!=1&&IsFrameDirty(i)!=1)
+			count++;
+	}
+	return count;
+}
+
+/**************************************************************************************************************************************
+StartDiskWrite
+//start the write on a free disk, nobody is suspended for it, the disk copies the data when it starts
+
+in: disk id, sector, data
+out: 
+**************************************************************************************************************************************/
+void StartDiskWrite(INT32 disk_id, INT32 sector, char *char_data){
+	IssueDiskIO(disk_id, sector, 1, 0, char_data);
+}
+
+/**************************************************************************************************************************************
+Below are the routines for swap space
+
+	InitSwapSpace, GetSwapSlot, FreeSwapSlot, SwapDisk, SwapSector, ReleaseSwapSlots
+**************************************************************************************************************************************/
+
+/**************************************************************************************************************************************
+InitSwapSpace
+//all swap slots are free at the beginning, the stripe starts at the first disk
+
+in: 
+out: 
+**************************************************************************************************************************************/
+void InitSwapSpace(){
+	int i;
+	memset(swapbitmap, 0, sizeof(swapbitmap));
+	for(i=0;i<SwapSlotCount;i++){
+		swapowner[i].pid = -1;
+		swapowner[i].vpn = 0;
+	}
+	swapcursor = 0;
+}
+
+/**************************************************************************************************************************************
+GetSwapSlot
+//give the page a new slot to be written to, the old one is freed, the search goes on from the
+//slot after the last one given out, so the page-outs one after another go to different disks
+
+in: process id, virtual page
+out: slot number, halt if the swap space is full
+**************************************************************************************************************************************/
+INT32 GetSwapSlot(INT32 pid, INT32 vpn){
+	INT32 i, slot;
+
+	if(SwapSlotOf(pid, vpn)!=-1){
+		FreeSwapSlot(SwapSlotOf(pid, vpn));
+	}
+	for(i=0;i<SwapSlotCount;i++){
+		slot = (swapcursor+i)%SwapSlotCount;
+		if(swapbitmap[slot/32]==0xFFFFFFFF){ //the word is full, jump to the next one
+			i += 31-slot%32;
+			continue;
+		}
+		if((swapbitmap[slot/32]&(1u<<(slot%32)))==0){
+			swapbitmap[slot/32] |= 1u<<(slot%32);
+			swapowner[slot].pid = pid;
+			swapowner[slot].vpn = vpn;
+			SetSwapSlot(pid, vpn, (INT16)slot);
+			swapcursor = (slot+1)%SwapSlotCount;
+			return slot;
+		}
+	}
+	printf("ERROR! The swap space is full\n");
+	CALL(Z502Halt());
+	return -1;
+}
+
+/**************************************************************************************************************************************
+FreeSwapSlot
+//give the slot back to the bitmap
+
+in: slot number
+out: 
+**************************************************************************************************************************************/
+void FreeSwapSlot(INT32 slot){
+	if(swapowner[slot].pid!=-1){
+		SetSwapSlot(swapowner[slot].pid, swapowner[slot].vpn, -1);
+	}
+	swapbitmap[slot/32] &= ~(1u<<(slot%32));
+	swapowner[slot].pid = -1;
+	swapowner[slot].vpn = 0;
+}
+
+/**************************************************************************************************************************************
+SwapDisk
+//the disk of the slot, the slots next to each other are on disks next to each other
+
+in: slot number
+out: disk id, 1 to MAX_NUMBER_OF_DISKS
+**************************************************************************************************************************************/
+INT32 SwapDisk(INT32 slot){
+	return slot%MAX_NUMBER_OF_DISKS+1;
+}
+
+/**************************************************************************************************************************************
+SwapSector
+//the sector of the slot, in the swap part at the end of the disk
+
+in: slot number
+out: sector
+**************************************************************************************************************************************/
+INT32 SwapSector(INT32 slot){
+	return SwapFirstSector+slot/MAX_NUMBER_OF_DISKS;
+}
+
+/**************************************************************************************************************************************
+ReleaseSwapSlots
+//the process is gone, all its slots go back to the bitmap and the leaves of its swap map are freed
+
+in: process id
+out: 
+**************************************************************************************************************************************/
+void ReleaseSwapSlots(INT32 pid){
+	int i, j;
+
+	if(pid<0||pid>=ProcessTableSize||swapmap[pid]==NULL){
+		return;
+	}
+	for(i=0;i<PTBL_DIR_SIZE;i++){
+		if(swapmap[pid][i]==NULL)
+			continue;
+		for(j=0;j<PTBL_LEAF_PGS;j++){
+			if(swapmap[pid][i][j]!=-1)
+				FreeSwapSlot(swapmap[pid][i][j]);
+		}
+		free(swapmap[pid][i]);
+		swapmap[pid][i] = NULL;
+		pagingstats.tableleaves--;
+	}
+}
+
+/**************************************************************************************************************************************
+Below are the routines for disk handle, every disk has a queue, a request that finds its disk in use waits there, the interrupt of a
+disk finishes its active request, wakes exactly the process that asked for it and starts the next one the disk policy picks
+
+	ReadFromDisk, WriteToDisk, ReadSectorsFromDisk, WriteSectorsToDisk, InitDiskQueues, SubmitDiskRequest, QueueDiskRequest, IssueDiskIO, StartDiskRequest, FinishDiskRequest,
+	DispatchDiskRequest, WaitForDiskStart,
+	SelectDiskPolicy, PrintDiskReport, CompareServiceTime, FCFSPick, SSTFPick, SCANPick, CLOOKPick
+**************************************************************************************************************************************/
+
+/**************************************************************************************************************************************
+ReadFromDisk
+//read data from target disk in specified sector, the caller is put on the suspendqueue
+
+in: disk id, sector, data
+out: 1 if the read started, 0 if it waits in the queue of the disk
+**************************************************************************************************************************************/
+INT32 ReadFromDisk(INT32 disk_id, INT32 sector, char *char_data){
+	return SubmitDiskRequest(disk_id, sector, 0, 0, char_data);
+}
+
+/**************************************************************************************************************************************
+WriteToDisk
+//write data to target disk in specified sector, the caller is put on the suspendqueue
+
+in: disk id, sector, data
+out: 1 if the write started, 0 if it waits in the queue of the disk
+**************************************************************************************************************************************/
+INT32 WriteToDisk(INT32 disk_id, INT32 sector, char *char_data){
+	return SubmitDiskRequest(disk_id, sector, 1, 0, char_data);
+}
+
+/**************************************************************************************************************************************
+ReadSectorsFromDisk
+//read count sectors from the sector on into their buffers with one request, the caller is put on the suspendqueue
+
+in: disk id, sector, count, list of count buffers
+out: 1 if the read started, 0 if it waits in the queue of the disk
+**************************************************************************************************************************************/
+INT32 ReadSectorsFromDisk(INT32 disk_id, INT32 sector, INT32 count, char **buffer_list){
+	return SubmitDiskRequest(disk_id, sector, 0, count, (char *)buffer_list);
+}
+
+/**************************************************************************************************************************************
+WriteSectorsToDisk
+//write count buffers to the sectors from the sector on with one request, the caller is put on the suspendqueue
+
+in: disk id, sector, count, list of count buffers
+out: 1 if the write started, 0 if it waits in the queue of the disk
+**************************************************************************************************************************************/
+INT32 WriteSectorsToDisk(INT32 disk_id, INT32 sector, INT32 count, char **buffer_list){
+	return SubmitDiskRequest(disk_id, sector, 1, count, (char *)buffer_list);
+}
+
+/**************************************************************************************************************************************
+InitDiskQueues
+//all the queues empty, no request on a disk, the arms at sector 0 like the hardware
+
+in:
+out:
+**************************************************************************************************************************************/
+void InitDiskQueues(){
+	int i;
+	for(i=0;i<=MAX_NUMBER_OF_DISKS;i++){
+		diskqueue[i].count = 0;
+		diskqueue[i].active.pid = -1;
+		diskqueue[i].readahead = -1;
+		diskqueue[i].readaheadstale = 0;
+		diskqueue[i].headsector = 0;
+		diskqueue[i].direction = 1;
+	}
+}
+
+/**************************************************************************************************************************************
+SubmitDiskRequest
+//start the request when its disk is free, nobody waits for it and the interrupt of the last request is handled,
+//else put it into the queue of the disk, the caller goes to the suspendqueue in both cases, the interrupt that
+//finishes its request wakes it
+
+in: disk id, sector, 0 read or 1 write, 0 or the count of a vector, data
+out: 1 if started, 0 if queued
+**************************************************************************************************************************************/
+INT32 SubmitDiskRequest(INT32 disk_id, INT32 sector, INT32 action, INT32 count, char *char_data){
+	INT32		LockResult;
+	INT32		started = 0;
+	DiskRequest	request;
+
+	request.pid = CURRENTPCB->Processid;
+	request.sector = sector;
+	request.action = action;
+	request.count = count;
+	request.data = char_data;
+	request.async = 0;
+	request.userdata = 0;
+	READ_MODIFY(MEMORY_INTERLOCK_BASE+5, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //diskqueue
+	started = QueueDiskRequest(disk_id, &request);
+	READ_MODIFY(MEMORY_INTERLOCK_BASE+0, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //readyqueue
+	READ_MODIFY(MEMORY_INTERLOCK_BASE+2, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //suspendqueue
+
+	CALL(AddToSuspendQueue(suspendqueue,CURRENTPCB));
+	CALL(RemoveQueueByPid(readyqueue,CURRENTPCB->Processid));
+
+	READ_MODIFY(MEMORY_INTERLOCK_BASE+2, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //suspendqueue
+	READ_MODIFY(MEMORY_INTERLOCK_BASE+0, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //readyqueue
+	READ_MODIFY(MEMORY_INTERLOCK_BASE+5, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //diskqueue
+	return started;
+}
+
+/**************************************************************************************************************************************
+QueueDiskRequest
+//start the request on its disk when the disk is free and nobody waits for it, else put it at the end of the queue of the disk,
+//the caller holds the diskqueue lock
+
+in: disk id, request
+out: 1 if started, 0 if queued
+**************************************************************************************************************************************/
+INT32 QueueDiskRequest(INT32 disk_id, DiskRequest *request){
+	INT32	Temp;
+
+	MEM_WRITE(Z502DiskSetID, &disk_id);
+	MEM_READ(Z502DiskStatus, &Temp);
+	if(Temp == ERR_BAD_DEVICE_ID){
+		printf("ERROR! You have to init disk first\n");
+		CALL(Z502Halt());
+	}
+	else if(Temp != DEVICE_FREE && Temp != DEVICE_IN_USE){
+		printf("ERROR!\n");
+		CALL(Z502Halt());
+	}
+	request->queuetime = 0;
+	if(diskreport == 1)
+		MEM_READ(Z502ClockStatus, &request->queuetime);
+	if(Temp == DEVICE_FREE && diskqueue[disk_id].count == 0 && diskqueue[disk_id].active.pid == -1 && diskqueue[disk_id].readahead == -1){
+		StartDiskRequest(disk_id, request); //a readahead waits for its interrupt, a request started before it would hide it
+		return 1;
+	}
+	if(diskqueue[disk_id].count >= DiskQueueSize){
+		printf("ERROR! The queue of disk %d is full\n", disk_id);
+		CALL(Z502Halt());
+	}
+	diskqueue[disk_id].request[diskqueue[disk_id].count++] = *request; //a pending interrupt of a free disk starts it soon
+	if(request->async == 0) //the fault handler waits for the start of its own one only
+		diskqueued[request->pid] = 1;
+	diskstats.queued++;
+	return 0;
+}
+
+/**************************************************************************************************************************************
+IssueDiskIO
+//give the disk the read or write, the disk has to be free, the arm ends at the last sector of the run
+
+in: disk id, sector, 0 read or 1 write, 0 for one sector or the count of a vector, data or the list of buffers
+out:
+**************************************************************************************************************************************/
+void IssueDiskIO(INT32 disk_id, INT32 sector, INT32 action, INT32 count, char *char_data){
+	INT32	Temp;
+
+	MEM_WRITE(Z502DiskSetID, &disk_id);
+	MEM_WRITE(Z502DiskSetSector, &sector);
+	MEM_WRITE(Z502DiskSetBuffer, (INT32 * )char_data);
+	MEM_WRITE(Z502DiskSetAction, &action);
+	if(count!=0)
+		MEM_WRITE(Z502DiskSetCount, &count);
+	Temp = 0;                        // Must be set to 0
+	MEM_WRITE(Z502DiskStart, &Temp);
+	diskqueue[disk_id].headsector = (count!=0)? sector+count-1 : sector;
+}
+
+/**************************************************************************************************************************************
+StartDiskRequest
+//start the request of a process on the free disk, it stays the active one of the disk until the disk is free again
+
+in: disk id, request
+out:
+**************************************************************************************************************************************/
+void StartDiskRequest(INT32 disk_id, DiskRequest *request){
+	diskstats.seeksectors += abs(diskqueue[disk_id].headsector-request->sector);
+	IssueDiskIO(disk_id, request->sector, request->action, request->count, request->data);
+	diskqueue[disk_id].active = *request;
+}
+
+/**************************************************************************************************************************************
+FinishDiskRequest
+//the disk is free, so its active request is done, count it for the report
+
+in: disk id
+out: the pid that asked for it, -1 if there was none
+**************************************************************************************************************************************/
+INT32 FinishDiskRequest(INT32 disk_id){
+	INT32	Time;
+	INT32	pid = diskqueue[disk_id].active.pid;
+
+	if(pid == -1)
+		return -1;
+	diskstats.requests++;
+	if(diskreport == 1){ //the clock costs time, it is only read for the report
+		MEM_READ(Z502ClockStatus, &Time);
+		Time -= diskqueue[disk_id].active.queuetime;
+		diskstats.servicetotal += Time;
+		if(diskstats.servicecount < DiskSampleLimit)
+			diskservice[diskstats.servicecount++] = Time;
+	}
+	diskqueue[disk_id].active.pid = -1;
+	return pid;
+}
+
+/**************************************************************************************************************************************
+DispatchDiskRequest
+//called by the disk interrupt for a free disk, it has finished its active request, the process that asked for it is woken
+//unless the load controller keeps it out, a ring request only completes in the ring and wakes a process that waits for enough
+//of them, and the policy picks the next one from the queue of the disk, the caller holds the diskqueue, readyqueue and
+//suspendqueue locks
+
+in: disk id, status of the interrupt
+out: the woken pid, -1 if nobody is woken
+**************************************************************************************************************************************/
+INT32 DispatchDiskRequest(INT32 disk_id, INT32 status){
+	INT32		index;
+	INT32		pid;
+	DiskRequest	request;
+	DiskRequest	finished;
+	Process_Control_Block	pcbtemp;
+
+	finished = diskqueue[disk_id].active;
+	pid = FinishDiskRequest(disk_id);
+	if(pid != -1 && finished.async == 0)
+		diskstatus[pid] = status;
+	if(pid != -1 && finished.async == 1)
+		pid = CompleteRingRequest(&finished, status);
+	if(pid != -1 && IsPidExist(suspendqueue, pid) && IsLoadSwapped(pid) != 1){
+		pcbtemp = GetPcbByPid(pid);
+		AddToReadyQueueByPriority(readyqueue, &pcbtemp);
+		RemoveQueueByPid(suspendqueue, pid);
+	}
+	else pid = -1;
+	if(diskqueue[disk_id].count == 0)
+		return pid;
+	index = diskpolicy->pick(disk_id);
+	request = diskqueue[disk_id].request[index];
+	diskqueue[disk_id].count--;
+	for(;index<diskqueue[disk_id].count;index++) //the queue stays in the order the requests came, fcfs takes the first
+		diskqueue[disk_id].request[index] = diskqueue[disk_id].request[index+1];
+	if(request.async == 0)
+		diskqueued[request.pid] = 0;
+	StartDiskRequest(disk_id, &request);
+	return pid;
+}
+
+/**************************************************************************************************************************************
+WaitForDiskStart
+//the fault handler needs the page before it goes on, idle until the disk interrupt starts the queued request, that request
+//is on a busy disk, so there is always an interrupt to come
+
+in: process id
+out:
+**************************************************************************************************************************************/
+void WaitForDiskStart(INT32 pid){
+	while(diskqueued[pid] == 1){
+		CALL(Z502Idle());
+	}
+}
+
+/**************************************************************************************************************************************
+SelectDiskPolicy
+//find the disk policy by name, fcfs if there is no such one
+
+in: policy name
+out:
+**************************************************************************************************************************************/
+void SelectDiskPolicy(char *name){
+	int i;
+	for(i=0;i<DiskPolicyCount;i++){
+		if(strcmp(diskpolicies[i].name, name)==0){
+			diskpolicy = &diskpolicies[i];
+			return;
+		}
+	}
+	printf("ERROR! There is no disk policy %s, use fcfs. The policies are:", name);
+	for(i=0;i<DiskPolicyCount;i++)
+		printf(" %s", diskpolicies[i].name);
+	printf("\n");
+	diskpolicy = &diskpolicies[0];
+}
+
+/**************************************************************************************************************************************
+PrintDiskReport
+//print what the disk policy cost us, only when a disk policy is given on the command line, the throughput is in requests
+//per 1000 ticks, the service time is from asking to the interrupt that finds the disk free again
+
+in: diskstats
+out:
+**************************************************************************************************************************************/
+void PrintDiskReport(){
+	INT32	Time, p99 = 0;
+
+	if(diskreport!=1)
+		return;
+	MEM_READ(Z502ClockStatus, &Time);
+	if(diskstats.servicecount>0){
+		qsort(diskservice, diskstats.servicecount, sizeof(INT32), CompareServiceTime);
+		p99 = diskservice[(diskstats.servicecount*99-1)/100];
+	}
+	printf("Disk report: policy = %s: Requests = %d: Queued = %d: Throughput = %d per 1000: Mean service = %d: P99 service = %d: Seek sectors = %d\n",
+		diskpolicy->name, diskstats.requests, diskstats.queued, Time>0 ? (INT32)((long)diskstats.requests*1000/Time) : 0,
+		diskstats.requests>0 ? (INT32)(diskstats.servicetotal/diskstats.requests) : 0, p99, diskstats.seeksectors);
+}
+
+/**************************************************************************************************************************************
+CompareServiceTime
+//order two service times for qsort
+
+in: two service times
+out: <0, 0, >0
+**************************************************************************************************************************************/
+int CompareServiceTime(const void *a, const void *b){
+	return *(const INT32 *)a - *(const INT32 *)b;
+}
+
+/**************************************************************************************************************************************
+FCFSPick
+//the oldest request
+
+in: disk id
+out: index in the queue
+**************************************************************************************************************************************/
+INT32 FCFSPick(INT32 disk_id){
+	(void)disk_id; //the oldest is first on every disk
+	return 0;
+}
+
+/**************************************************************************************************************************************
+SSTFPick
+//the request nearest to the arm, the oldest one of those that are as near
+
+in: disk id
+out: index in the queue
+**************************************************************************************************************************************/
+INT32 SSTFPick(INT32 disk_id){
+	DiskQueue	*pqueue = &diskqueue[disk_id];
+	INT32		i, best = 0;
+
+	for(i=1;i<pqueue->count;i++){
+		if(abs(pqueue->request[i].sector-pqueue->headsector)<abs(pqueue->request[best].sector-pqueue->headsector))
+			best = i;
+	}
+	return best;
+}
+
+/**************************************************************************************************************************************
+SCANPick
+//the elevator, the nearest request on the way the arm goes, it turns at the last request on that way, the arm only moves
+//for a request, so there is no sense in going on to the edge of the disk
+
+in: disk id
+out: index in the queue
+**************************************************************************************************************************************/
+INT32 SCANPick(INT32 disk_id){
+	DiskQueue	*pqueue = &diskqueue[disk_id];
+	INT32		i, turn, best, distance;
+
+	for(turn=0;turn<2;turn++){
+		best = -1;
+		for(i=0;i<pqueue->count;i++){
+			distance = (pqueue->request[i].sector-pqueue->headsector)*pqueue->direction;
+			if(distance<0)
+				continue;
+			if(best==-1||distance<(pqueue->request[best].sector-pqueue->headsector)*pqueue->direction)
+				best = i;
+		}
+		if(best!=-1)
+			return best;
+		pqueue->direction = -pqueue->direction; //nothing more on this way
+	}
+	return 0;
+}
+
+/**************************************************************************************************************************************
+CLOOKPick
+//the nearest request at or above the arm, when there is none the arm goes back to the lowest request
+
+in: disk id
+out: index in the queue
+**************************************************************************************************************************************/
+INT32 CLOOKPick(INT32 disk_id){
+	DiskQueue	*pqueue = &diskqueue[disk_id];
+	INT32		i, best = -1, lowest = 0;
+
+	for(i=0;i<pqueue->count;i++){
+		if(pqueue->request[i].sector<pqueue->request[lowest].sector)
+			lowest = i;
+		if(pqueue->request[i].sector<pqueue->headsector)
+			continue;
+		if(best==-1||pqueue->request[i].sector<pqueue->request[best].sector)
+			best = i;
+	}
+	if(best==-1)
+		return lowest;
+	return best;
+}
+
+/**************************************************************************************************************************************
+Below are the routines for buffer cache, the DISK_READ and DISK_WRITE of the processes go through a cache of sectors, a hash on
+<disk, sector> finds the buffer of a sector and all buffers are in a list from the most to the least recently used. A write only
+goes into its buffer and the disk gets it later, when the buffer is old, when the cpu idles or when the buffer is taken for another
+sector, so a write and a read that hits never wait for the disk. The page faults do not use the cache, the frames are their cache
+
+	InitBufferCache, CacheHash, FindBuffer, TouchBuffer, UnhashBuffer, TakeBuffer, WriteBackBuffer, CacheRead, CacheWrite, CacheFill,
+	CacheReadSectors, NextDiskRun, CacheWriteSectors, FlushBufferCache, CountDirtyBuffers, AreDisksQuiet, DrainBufferCache, ReportCacheStats
+**************************************************************************************************************************************/
+
+/**************************************************************************************************************************************
+InitBufferCache
+//all buffers empty, in the lru list in their order, no hash chain has one
+
+in:
+out:
+**************************************************************************************************************************************/
+void InitBufferCache(){
+	int i;
+	for(i=0;i<BufferHashSize;i++)
+		bufferhash[i] = -1;
+	for(i=0;i<BufferCacheSize;i++){
+		buffercache[i].disk_id = -1;
+		buffercache[i].dirty = 0;
+		buffercache[i].hashnext = -1;
+		buffercache[i].prev = i-1;
+		buffercache[i].next = (i+1<BufferCacheSize)? i+1 : -1;
+	}
+	lruhead = 0;
+	lrutail = BufferCacheSize-1;
+}
+
+/**************************************************************************************************************************************
+CacheHash
+//the chain of a sector, the sectors of one disk follow each other over the chains
+
+in: disk id, sector
+out: index in bufferhash
+**************************************************************************************************************************************/
+INT32 CacheHash(INT32 disk_id, INT32 sector){
+	return (disk_id*NUM_LOGICAL_SECTORS+sector)&(BufferHashSize-1);
+}
+
+/**************************************************************************************************************************************
+FindBuffer
+//look for the sector in its hash chain, the caller has the buffercache locked
+
+in: disk id, sector
+out: the buffer, -1 if the sector is not in the cache
+**************************************************************************************************************************************/
+INT32 FindBuffer(INT32 disk_id, INT32 sector){
+	INT32 i;
+
+	for(i=bufferhash[CacheHash(disk_id, sector)];i!=-1;i=buffercache[i].hashnext){
+		if(buffercache[i].disk_id==disk_id&&buffercache[i].sector==sector)
+			return i;
+	}
+	return -1;
+}
+
+/**************************************************************************************************************************************
+TouchBuffer
+//the buffer was used, it goes to the head of the lru list
+
+in: buffer
+out:
+**************************************************************************************************************************************/
+void TouchBuffer(INT32 i){
+	if(lruhead==i)
+		return;
+	buffercache[buffercache[i].prev].next = buffercache[i].next; //not the head, so there is one before it
+	if(buffercache[i].next!=-1)
+		buffercache[buffercache[i].next].prev = buffercache[i].prev;
+	else lrutail = buffercache[i].prev;
+	buffercache[i].prev = -1;
+	buffercache[i].next = lruhead;
+	buffercache[lruhead].prev = i;
+	lruhead = i;
+}
+
+/**************************************************************************************************************************************
+UnhashBuffer
+//take the buffer out of its hash chain, it is empty after that
+
+in: buffer
+out:
+**************************************************************************************************************************************/
+void UnhashBuffer(INT32 i){
+	INT32 *link;
+
+	if(buffercache[i].disk_id==-1)
+		return;
+	link = &bufferhash[CacheHash(buffercache[i].disk_id, buffercache[i].sector)];
+	while(*link!=i)
+		link = &buffercache[*link].hashnext;
+	*link = buffercache[i].hashnext;
+	buffercache[i].hashnext = -1;
+	buffercache[i].disk_id = -1;
+}
+
+/**************************************************************************************************************************************
+TakeBuffer
+//find a buffer for a sector that is not in the cache, from the tail of the lru list the first one that is empty, clean or can be
+//written back now, a dirty one whose disk is busy stays
+
+in:
+out: the empty buffer, -1 if every buffer is dirty on a busy disk
+**************************************************************************************************************************************/
+INT32 TakeBuffer(){
+	INT32 i;
+
+	for(i=lrutail;i!=-1;i=buffercache[i].prev){
+		if(buffercache[i].disk_id==-1||buffercache[i].dirty==0||WriteBackBuffer(i)==1){
+			UnhashBuffer(i);
+			return i;
+		}
+	}
+	return -1;
+}
+
+/**************************************************************************************************************************************
+WriteBackBuffer
+//start the write of a dirty buffer when its disk is free, the disk copies the data when it starts, so the buffer is clean at once
+
+in: buffer
+out: 1 if the write started, 0 if the disk is busy
+**************************************************************************************************************************************/
+INT32 WriteBackBuffer(INT32 i){
+	INT32	LockResult;
+	INT32	started = 0;
+
+	READ_MODIFY(MEMORY_INTERLOCK_BASE+5, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //diskqueue
+	if(IsDiskFree(buffercache[i].disk_id)==1){
+		StartDiskWrite(buffercache[i].disk_id, buffercache[i].sector, buffercache[i].data);
+		buffercache[i].dirty = 0;
+		cachestats.writebacks++;
+		started = 1;
+	}
+	READ_MODIFY(MEMORY_INTERLOCK_BASE+5, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //diskqueue
+	return started;
+}
+
+/**************************************************************************************************************************************
+CacheRead
+//DISK_READ of a sector in the cache, copied out of its buffer without the disk
+
+in: disk id, sector, data
+out: 1 on a hit, 0 when the disk has to read it
+**************************************************************************************************************************************/
+INT32 CacheRead(INT32 disk_id, INT32 sector, char *char_data){
+	INT32	LockResult;
+	INT32	i;
+
+	if(disk_id<1||disk_id>MAX_NUMBER_OF_DISKS||sector<0||sector>=NUM_LOGICAL_SECTORS) //the disk gives the error
+		return 0;
+	READ_MODIFY(MEMORY_INTERLOCK_BASE+6, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //buffercache
+	cachetick++;
+	i = FindBuffer(disk_id, sector);
+	if(i!=-1){
+		memcpy(char_data, buffercache[i].data, PGSIZE);
+		TouchBuffer(i);
+		cachestats.hits++;
+	}
+	else cachestats.misses++;
+	READ_MODIFY(MEMORY_INTERLOCK_BASE+6, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //buffercache
+	FlushBufferCache(BufferFlushAge);
+	return (i!=-1)? 1 : 0;
+}
+
+/**************************************************************************************************************************************
+CacheWrite
+//DISK_WRITE into the buffer of the sector, a sector not in the cache takes the least recently used buffer it can have
+
+in: disk id, sector, data
+out: 1 if the cache has it, 0 when there is no buffer and the disk has to write it now
+**************************************************************************************************************************************/
+INT32 CacheWrite(INT32 disk_id, INT32 sector, char *char_data){
+	INT32	LockResult;
+	INT32	i;
+
+	if(disk_id<1||disk_id>MAX_NUMBER_OF_DISKS||sector<0||sector>=NUM_LOGICAL_SECTORS)
+		return 0;
+	READ_MODIFY(MEMORY_INTERLOCK_BASE+6, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //buffercache
+	cachetick++;
+	i = FindBuffer(disk_id, sector);
+	if(i!=-1)
+		cachestats.hits++;
+	else{
+		cachestats.misses++;
+		i = TakeBuffer();
+		if(i==-1){
+			READ_MODIFY(MEMORY_INTERLOCK_BASE+6, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //buffercache
+			return 0;
+		}
+		buffercache[i].disk_id = disk_id;
+		buffercache[i].sector = sector;
+		buffercache[i].hashnext = bufferhash[CacheHash(disk_id, sector)];
+		bufferhash[CacheHash(disk_id, sector)] = i;
+	}
+	memcpy(buffercache[i].data, char_data, PGSIZE);
+	if(buffercache[i].dirty==0){ //the age counts from the first write the disk does not have
+		buffercache[i].dirty = 1;
+		buffercache[i].dirtytick = cachetick;
+	}
+	TouchBuffer(i);
+	READ_MODIFY(MEMORY_INTERLOCK_BASE+6, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //buffercache
+	FlushBufferCache(BufferFlushAge);
+	return 1;
+}
+
+/**************************************************************************************************************************************
+CacheFill
+//the disk read a sector that missed, keep a clean copy, a write that came while we waited is newer and stays
+
+in: disk id, sector, data
+out:
+**************************************************************************************************************************************/
+void CacheFill(INT32 disk_id, INT32 sector, char *char_data){
+	INT32	LockResult;
+	INT32	i;
+
+	if(disk_id<1||disk_id>MAX_NUMBER_OF_DISKS||sector<0||sector>=NUM_LOGICAL_SECTORS)
+		return;
+	READ_MODIFY(MEMORY_INTERLOCK_BASE+6, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //buffercache
+	if(FindBuffer(disk_id, sector)==-1&&(i = TakeBuffer())!=-1){
+		buffercache[i].disk_id = disk_id;
+		buffercache[i].sector = sector;
+		buffercache[i].hashnext = bufferhash[CacheHash(disk_id, sector)];
+		bufferhash[CacheHash(disk_id, sector)] = i;
+		memcpy(buffercache[i].data, char_data, PGSIZE);
+		buffercache[i].dirty = 0;
+		TouchBuffer(i);
+	}
+	READ_MODIFY(MEMORY_INTERLOCK_BASE+6, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //buffercache
+}
+
+/**************************************************************************************************************************************
+CacheReadSectors
+//DISK_READV copies the cached sectors of the run at once and builds the list for the disk, a clean cached sector is read into the
+//scratch buffer so the disk still does one run and cannot put an older copy over the cached one, a dirty one gets NULL, the disk
+//may never have had it and would fail the whole run, a vector does not fill the cache
+
+in: disk id, sector, count, buffers of the process, list for the disk, scratch buffer
+out: number of cached sectors, count when the disk is not needed
+**************************************************************************************************************************************/
+INT32 CacheReadSectors(INT32 disk_id, INT32 sector, INT32 count, char **user_list, char **disk_list, char *scratch){
+	INT32	LockResult;
+	INT32	i, index, hits = 0;
+
+	READ_MODIFY(MEMORY_INTERLOCK_BASE+6, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //buffercache
+	cachetick++;
+	for(index=0;index<count;index++){
+		i = FindBuffer(disk_id, sector+index);
+		if(i!=-1){
+			memcpy(user_list[index], buffercache[i].data, PGSIZE);
+			TouchBuffer(i);
+			disk_list[index] = (buffercache[i].dirty==1)? NULL : scratch;
+			cachestats.hits++;
+			hits++;
+		}
+		else{
+			disk_list[index] = user_list[index];
+			cachestats.misses++;
+		}
+	}
+	READ_MODIFY(MEMORY_INTERLOCK_BASE+6, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //buffercache
+	FlushBufferCache(BufferFlushAge);
+	return hits;
+}
+
+/**************************************************************************************************************************************
+NextDiskRun
+//the next sectors of the vector the disk has to read, from a missed sector to the last missed one before a dirty cached sector
+//or the end, the clean cached ones between them go to the scratch buffer so the run stays one request
+
+in: count, first index to look at, buffers of the process, list for the disk, return the number of sectors of the run
+out: the index of the first sector of the run, -1 when no missed sector is left
+**************************************************************************************************************************************/
+INT32 NextDiskRun(INT32 count, INT32 from, char **user_list, char **disk_list, INT32 *runcount){
+	INT32 index, last;
+
+	while(from<count&&disk_list[from]!=user_list[from]) //skip the cached ones
+		from++;
+	if(from==count)
+		return -1;
+	last = from;
+	for(index=from;index<count&&disk_list[index]!=NULL;index++){
+		if(disk_list[index]==user_list[index])
+			last = index;
+	}
+	*runcount = last-from+1;
+	return from;
+}
+
+/**************************************************************************************************************************************
+CacheWriteSectors
+//DISK_WRITEV went to the disk, the cached sectors of the run get the new data and are clean, the write is already submitted so
+//no write back of theirs can pass it
+
+in: disk id, sector, count, buffers of the process
+out:
+**************************************************************************************************************************************/
+void CacheWriteSectors(INT32 disk_id, INT32 sector, INT32 count, char **user_list){
+	INT32	LockResult;
+	INT32	i, index;
+
+	READ_MODIFY(MEMORY_INTERLOCK_BASE+6, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //buffercache
+	for(index=0;index<count;index++){
+		i = FindBuffer(disk_id, sector+index);
+		if(i!=-1){
+			memcpy(buffercache[i].data, user_list[index], PGSIZE);
+			buffercache[i].dirty = 0;
+			TouchBuffer(i);
+		}
+	}
+	READ_MODIFY(MEMORY_INTERLOCK_BASE+6, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //buffercache
+}
+
+/**************************************************************************************************************************************
+FlushBufferCache
+//write back the dirty buffers that waited age cache ticks or more and whose disk is free, the DISK_READ and DISK_WRITE flush the
+//old ones, the idle cpu flushes all of them
+
+in: age, 0 for every dirty buffer
+out: number of writes started
+**************************************************************************************************************************************/
+INT32 FlushBufferCache(INT32 age){
+	INT32	LockResult;
+	INT32	i, started = 0;
+
+	READ_MODIFY(MEMORY_INTERLOCK_BASE+6, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //buffercache
+	for(i=lrutail;i!=-1;i=buffercache[i].prev){ //the least recently used are written first
+		if(buffercache[i].disk_id==-1||buffercache[i].dirty==0||cachetick-buffercache[i].dirtytick<age)
+			continue;
+		started += WriteBackBuffer(i);
+	}
+	READ_MODIFY(MEMORY_INTERLOCK_BASE+6, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //buffercache
+	return started;
+}
+
+/**************************************************************************************************************************************
+CountDirtyBuffers
+//the buffers whose data the disk does not have yet
+
+in:
+out: number of dirty buffers
+**************************************************************************************************************************************/
+INT32 CountDirtyBuffers(){
+	INT32	LockResult;
+	INT32	i, dirty = 0;
+
+	READ_MODIFY(MEMORY_INTERLOCK_BASE+6, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //buffercache
+	for(i=0;i<BufferCacheSize;i++){
+		if(buffercache[i].disk_id!=-1&&buffercache[i].dirty==1)
+			dirty++;
+	}
+	READ_MODIFY(MEMORY_INTERLOCK_BASE+6, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //buffercache
+	return dirty;
+}
+
+/**************************************************************************************************************************************
+AreDisksQuiet
+//no disk does a request, none waits in a queue and every interrupt is handled
+
+in:
+out: 1 if all disks are free, 0 if one is busy
+**************************************************************************************************************************************/
+INT32 AreDisksQuiet(){
+	INT32	LockResult;
+	INT32	disk_id, quiet = 1;
+
+	READ_MODIFY(MEMORY_INTERLOCK_BASE+5, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //diskqueue
+	for(disk_id=1;disk_id<=MAX_NUMBER_OF_DISKS&&quiet==1;disk_id++)
+		quiet = IsDiskFree(disk_id);
+	READ_MODIFY(MEMORY_INTERLOCK_BASE+5, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //diskqueue
+	return quiet;
+}
+
+/**************************************************************************************************************************************
+DrainBufferCache
+//the run ends, write back every dirty buffer and idle until the disks have them all, a buffer on a busy disk is written when the
+//disk is free again, the caller holds no lock so the disk interrupts can come
+
+in:
+out:
+**************************************************************************************************************************************/
+void DrainBufferCache(){
+	FlushBufferCache(0);
+	while(CountDirtyBuffers()>0||AreDisksQuiet()!=1){
+		CALL(Z502Idle());
+		FlushBufferCache(0);
+	}
+}
+
+/**************************************************************************************************************************************
+ReportCacheStats
+//give the counters of the cache to the hardware, it prints them with its statistics when it halts
+
+in: cachestats
+out:
+**************************************************************************************************************************************/
+void ReportCacheStats(){
+	Z502ReportCacheStats(cachestats.hits, cachestats.misses, cachestats.writebacks);
+}
+
+/**************************************************************************************************************************************
+Below are the routines for disk rings, a process puts its requests into the submission half of its ring without a trap, one
+IO_RING_ENTER gives all of them to the disk queues, the disk interrupt puts the completion of every one into the completion half,
+so one process can have a request on every disk and reaps them together. The interrupt uses the ring under the diskqueue lock
+
+	SetupIORing, SubmitIORing, RingCompletions, PostCompletion, CompleteRingRequest, SuspendForRing, ReleaseIORing
+**************************************************************************************************************************************/
+
+/**************************************************************************************************************************************
+SetupIORing
+//share the ring of the process with the OS, both halves empty
+
+in: process id, ring
+out: ERR_SUCCESS, ERR_BAD_PARAM when there is no ring or the old one still has requests on a disk
+**************************************************************************************************************************************/
+INT32 SetupIORing(INT32 pid, IO_RING *ring){
+	INT32	LockResult;
+	INT32	error = ERR_SUCCESS;
+
+	if(ring==NULL)
+		return ERR_BAD_PARAM;
+	READ_MODIFY(MEMORY_INTERLOCK_BASE+5, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //diskqueue
+	if(ringinflight[pid]!=0)
+		error = ERR_BAD_PARAM;
+	else{
+		ring->sq_head = 0;
+		ring->sq_tail = 0;
+		ring->cq_head = 0;
+		ring->cq_tail = 0;
+		ioring[pid] = ring;
+		ringwant[pid] = 0;
+	}
+	READ_MODIFY(MEMORY_INTERLOCK_BASE+5, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //diskqueue
+	return error;
+}
+
+/**************************************************************************************************************************************
+SubmitIORing
+//take the new entries of the submission half, each one gets a completion, so no more are taken than the completion half has room
+//for, a bad entry and a read the cache has complete now, the others go to their disk queues, a write refreshes its cached copy
+
+in: process id
+out: number of entries taken
+**************************************************************************************************************************************/
+INT32 SubmitIORing(INT32 pid){
+	INT32		LockResult;
+	INT32		taken = 0;
+	IO_RING		*ring = ioring[pid];
+	IO_RING_SQE	*sqe;
+	DiskRequest	request;
+
+	while(ring->sq_head!=ring->sq_tail){
+		READ_MODIFY(MEMORY_INTERLOCK_BASE+5, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //diskqueue
+		if(ringinflight[pid]+RingCompletions(pid)>=IO_RING_ENTRIES){ //the rest waits for the process to reap
+			READ_MODIFY(MEMORY_INTERLOCK_BASE+5, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //diskqueue
+			break;
+		}
+		READ_MODIFY(MEMORY_INTERLOCK_BASE+5, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //diskqueue
+		sqe = &ring->sq[ring->sq_head&(IO_RING_ENTRIES-1)];
+		request.pid = pid;
+		request.sector = sqe->sector;
+		request.action = sqe->opcode;
+		request.count = 0;
+		request.data = sqe->buffer;
+		request.async = 1;
+		request.userdata = sqe->user_data;
+		ring->sq_head++;
+		taken++;
+		if(sqe->disk_id<1||sqe->disk_id>MAX_NUMBER_OF_DISKS||sqe->sector<0||sqe->sector>=NUM_LOGICAL_SECTORS
+			||(sqe->opcode!=IO_RING_READ&&sqe->opcode!=IO_RING_WRITE)||sqe->buffer==NULL){
+			READ_MODIFY(MEMORY_INTERLOCK_BASE+5, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //diskqueue
+			PostCompletion(pid, request.userdata, ERR_BAD_PARAM);
+			READ_MODIFY(MEMORY_INTERLOCK_BASE+5, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //diskqueue
+			continue;
+		}
+		if(request.action==IO_RING_READ&&CacheRead(sqe->disk_id, request.sector, request.data)==1){
+			READ_MODIFY(MEMORY_INTERLOCK_BASE+5, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //diskqueue
+			PostCompletion(pid, request.userdata, ERR_SUCCESS);
+			READ_MODIFY(MEMORY_INTERLOCK_BASE+5, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //diskqueue
+			continue;
+		}
+		READ_MODIFY(MEMORY_INTERLOCK_BASE+5, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //diskqueue
+		QueueDiskRequest(sqe->disk_id, &request);
+		ringinflight[pid]++;
+		READ_MODIFY(MEMORY_INTERLOCK_BASE+5, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //diskqueue
+		if(request.action==IO_RING_WRITE) //after the submit, an old dirty buffer cannot get to the disk first
+			CacheWriteSectors(sqe->disk_id, request.sector, 1, &request.data);
+	}
+	return taken;
 }
 
 /**************************************************************************************************************************************
-Memory Print routine
+RingCompletions
+//the completions in the ring that the process has not taken
 
-Memory_Print
-//get information of the physical memeory, target pid and the virtual memeory address
+in: process id
+out: number of completions
+**************************************************************************************************************************************/
+INT32 RingCompletions(INT32 pid){
+	return (INT32)(ioring[pid]->cq_tail-ioring[pid]->cq_head);
+}
 
-in: global varible
+/**************************************************************************************************************************************
+PostCompletion
+//put a completion at the tail of the completion half, the entry is written before the tail moves, the submit keeps room for it,
+//the caller holds the diskqueue lock
+
+in: process id, user data of the entry, result
 out:
 **************************************************************************************************************************************/
-void Memory_Print(){
-	INT32 Temp;
-	for (Temp = 0; Temp < 64; Temp = Temp + 2) {
-		if (frametable[Temp]!=NULL){
-			//line number,pid number,vpn, 13-15 bit of virtual page
-			MP_setup( (INT32)Temp, (INT32)pidprint[Temp], (INT32)frametable[Temp], (Z502_PAGE_TBL_ADDR[frametable[Temp]]&0xe000)>>13);
-		}	
-	}
-	MP_print_line();
+void PostCompletion(INT32 pid, long userdata, INT32 result){
+	IO_RING	*ring = ioring[pid];
+	UINT32	tail = ring->cq_tail;
+
+	ring->cq[tail&(IO_RING_ENTRIES-1)].user_data = userdata;
+	ring->cq[tail&(IO_RING_ENTRIES-1)].result = result;
+	ring->cq_tail = tail+1;
 }
 
 /**************************************************************************************************************************************
-Below are the routines for memory manager
+CompleteRingRequest
+//the disk finished a ring request, its completion goes into the ring, the process is only woken when it waits in IO_RING_ENTER
+//and has what it waits for, the caller holds the diskqueue lock
 
-	IsFreeFrameExist, GetFreeFrame
+in: the finished request, status of the disk
+out: the pid to wake, -1 for none
 **************************************************************************************************************************************/
+INT32 CompleteRingRequest(DiskRequest *request, INT32 status){
+	INT32	pid = request->pid;
+
+	PostCompletion(pid, request->userdata, status);
+	ringinflight[pid]--;
+	if(ringwant[pid]==0||(RingCompletions(pid)<ringwant[pid]&&ringinflight[pid]>0))
+		return -1;
+	ringwant[pid] = 0;
+	return pid;
+}
 
 /**************************************************************************************************************************************
-IsFreeFrameExist
-//judge is there any free frame in frame table
+SuspendForRing
+//IO_RING_ENTER waits for min completions, the process goes to the suspendqueue unless it has them or nothing more can come,
+//the last completion it needs wakes it, all under the diskqueue lock so that completion cannot be missed
 
-in: 
-out:1 if have free frame, 0 if no free frame
+in: process id, min completions
+out: 1 if suspended, the caller switches away, 0 if it goes on
 **************************************************************************************************************************************/
-INT32 IsFreeFrameExist(){
-	int i;
-	for(i=0;i<64;i++){
-		if(frametable[i]==NULL)
-			return 1;
+INT32 SuspendForRing(INT32 pid, INT32 min){
+	INT32	LockResult;
+	INT32	suspended = 0;
+
+	READ_MODIFY(MEMORY_INTERLOCK_BASE+5, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //diskqueue
+	ringwant[pid] = 0;
+	if(RingCompletions(pid)<min&&ringinflight[pid]>0){
+		ringwant[pid] = min;
+		READ_MODIFY(MEMORY_INTERLOCK_BASE+0, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //readyqueue
+		READ_MODIFY(MEMORY_INTERLOCK_BASE+2, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //suspendqueue
+
+		CALL(AddToSuspendQueue(suspendqueue,CURRENTPCB));
+		CALL(RemoveQueueByPid(readyqueue,pid));
+
+		READ_MODIFY(MEMORY_INTERLOCK_BASE+2, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //suspendqueue
+		READ_MODIFY(MEMORY_INTERLOCK_BASE+0, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //readyqueue
+		suspended = 1;
 	}
-	return 0;
+	READ_MODIFY(MEMORY_INTERLOCK_BASE+5, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //diskqueue
+	return suspended;
 }
 
 /**************************************************************************************************************************************
-GetFreeFrame
-//find a free frame in frame table and return
+ReleaseIORing
+//the process is gone, the reads of its ring that still wait in a disk queue are dropped, the disk would copy into its buffers,
+//a queued write still goes, the buffer cache has its data as clean already, then idle until the requests on the disks are done,
+//their interrupts only post into the ring, after that the pid has no ring, the caller holds no lock
 
-in: 
-out: free frame number i
+in: process id, -1 for none
+out:
 **************************************************************************************************************************************/
-INT32 GetFreeFrame(){
-	int i;
-	for(i=0;i<64;i++){
-		if(frametable[i]==NULL)
-			return i;
+void ReleaseIORing(INT32 pid){
+	INT32		LockResult;
+	INT32		disk_id, index, kept;
+	DiskRequest	*request;
+
+	if(pid<0||pid>=ProcessTableSize||ioring[pid]==NULL)
+		return;
+	READ_MODIFY(MEMORY_INTERLOCK_BASE+5, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //diskqueue
+	ringwant[pid] = 0;
+	for(disk_id=1;disk_id<=MAX_NUMBER_OF_DISKS;disk_id++){
+		kept = 0;
+		for(index=0;index<diskqueue[disk_id].count;index++){ //the queue keeps its order
+			request = &diskqueue[disk_id].request[index];
+			if(request->async==1&&request->pid==pid&&request->action==IO_RING_READ){
+				ringinflight[pid]--;
+				continue;
+			}
+			diskqueue[disk_id].request[kept++] = *request;
+		}
+		diskqueue[disk_id].count = kept;
 	}
+	READ_MODIFY(MEMORY_INTERLOCK_BASE+5, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //diskqueue
+	while(ringinflight[pid]>0){
+		CALL(Z502Idle());
+	}
+	READ_MODIFY(MEMORY_INTERLOCK_BASE+5, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //diskqueue
+	ioring[pid] = NULL;
+	ringwant[pid] = 0;
+	READ_MODIFY(MEMORY_INTERLOCK_BASE+5, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //diskqueue
 }
 
 /**************************************************************************************************************************************
-Below are the routines for disk handle
+Below are the routines for message handle
 
-	ReadFromDisk, WriteToDisk
+	InitMailbox, GetMailbox, AddToMailbox, GetMessageAt, FindInMailbox, FindMessage, 
+	RemoveFromMailbox, ReleaseMessagePages, ReleaseMessages, IsSourcePidExsit, BeginReceiveWait, EndReceiveWait,
+	FindBroadcastWaiter
+
+	every target pid has its own mailbox and broadcasts go to one more, so a receiver
+	only looks at its own mailbox and the broadcast one. The messages of a mailbox are
+	chained in sending order and again per source, so the oldest message, and the oldest
+	one from a source, are taken in O(1). Each mailbox holds MailboxSize messages, there
+	is no limit on all the messages together
 **************************************************************************************************************************************/
 
-/**************************************************************************************************************************************
-ReadFromDisk
-//read data from target disk in specified sector
+/************************************************************************
+InitMailbox
+//empty the mailbox, all the slots are chained as free ones
 
-in: disk id, sector, data
+in: mailbox
 out: 
-**************************************************************************************************************************************/
-INT32 ReadFromDisk(INT32 disk_id, INT32 sector, char *char_data){
-	INT32	Temp;
-	INT32	LockResult;//return the result for read_modify
-	INT32	Time,starttime;
+************************************************************************/
+void InitMailbox(Mailbox *pbox){
+	INT32 i;
+	for(i=0;i<MailboxSize;i++){
+		pbox->slot[i].next = i+1;
+	}
+	pbox->slot[MailboxSize-1].next = -1;
+	pbox->freeslot = 0;
+	pbox->head = -1;
+	pbox->tail = -1;
+	pbox->count = 0;
+	for(i=0;i<ProcessTableSize;i++){
+		pbox->fromhead[i] = -1;
+		pbox->fromtail[i] = -1;
+	}
+}
 
-	//READ_MODIFY(MEMORY_INTERLOCK_BASE+4, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //disk
-	MEM_WRITE(Z502DiskSetID, &disk_id);
-	MEM_READ(Z502DiskStatus, &Temp);
-	if (Temp == DEVICE_FREE){ 
-		//printf("Device is free.\n");
-		//READ_MODIFY(MEMORY_INTERLOCK_BASE+4, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //disk
-
-		MEM_WRITE(Z502DiskSetSector, &sector);
-		//MEM_WRITE(Z502DiskSetBuffer, (INT32 * )disk_buffer_read);
-		MEM_WRITE(Z502DiskSetBuffer, (INT32 * )char_data);
-		Temp = 0;                        // Specify a read
-		MEM_WRITE(Z502DiskSetAction, &Temp);
-		Temp = 0;                        // Must be set to 0
-		//MEM_READ( Z502ClockStatus, &Time );
-		MEM_WRITE(Z502DiskStart, &Temp);
-		//printf("start disktimer!!!Temp:%i diskid:%i sector:%i Time:%i\n",Temp,disk_id,sector,Time);
-		//debug
-		/*if(Temp != DEVICE_IN_USE){
-			printf(":deviceid:%d,is not in use.it is %i\n",disk_id,Temp);
-			printf("diskid:%i,sector:%i,char_data:%s\n",disk_id,sector,char_data[2]);
-			Z502Halt();
-		}
-		if(disk_id>10){
-			printf(":deviceid:%d,wwwwwwwwwwwwwwwwwwww.\n",disk_id);
-		}*/
-		//lock
-		READ_MODIFY(MEMORY_INTERLOCK_BASE+0, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //readyqueue
-		READ_MODIFY(MEMORY_INTERLOCK_BASE+2, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //suspendqueue
-		
-		CALL(AddToSuspendQueue(suspendqueue,CURRENTPCB));
-		CALL(RemoveQueueByPid(readyqueue,CURRENTPCB->Processid));
-		
-		READ_MODIFY(MEMORY_INTERLOCK_BASE+2, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //suspendqueue
-		READ_MODIFY(MEMORY_INTERLOCK_BASE+0, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //readyqueue
-		//READ_MODIFY(MEMORY_INTERLOCK_BASE+4, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //disk
-		//CALL(dospprint("RDISK", CURRENTPCB->Processid, CURRENTPCB)); //after memcpy CURRENTPCB, print ok now
+/************************************************************************
+GetMailbox
+//get the mailbox of the target pid, -1 is the broadcast mailbox
+
+in: target pid
+out: mailbox
+************************************************************************/
+Mailbox *GetMailbox(INT32 target_pid){
+	if(target_pid==-1){
+		return &broadcastbox;
 	}
-	else if (Temp == DEVICE_IN_USE){ 
-		//printf("Device is in use.\n");
-		//READ_MODIFY(MEMORY_INTERLOCK_BASE+4, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //disk
-		//READ_MODIFY(MEMORY_INTERLOCK_BASE+4, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult);  //disk
-		READ_MODIFY(MEMORY_INTERLOCK_BASE+0, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //readyqueue
-		READ_MODIFY(MEMORY_INTERLOCK_BASE+2, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //suspendqueue
-		
-		CALL(AddToSuspendQueue(suspendqueue,CURRENTPCB));
-		CALL(RemoveQueueByPid(readyqueue,CURRENTPCB->Processid));
+	if(mailbox[target_pid]==NULL){
+		mailbox[target_pid] = (Mailbox *)calloc(1, sizeof(Mailbox));
+		InitMailbox(mailbox[target_pid]);
+	}
+	return mailbox[target_pid];
+}
 
-		READ_MODIFY(MEMORY_INTERLOCK_BASE+2, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //suspendqueue
-		READ_MODIFY(MEMORY_INTERLOCK_BASE+0, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //readyqueue
-		//READ_MODIFY(MEMORY_INTERLOCK_BASE+4, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult);  //disk
-		//CALL(dospprint("RDISK", CURRENTPCB->Processid, CURRENTPCB)); //after memcpy CURRENTPCB, print ok now
+/************************************************************************
+AddToMailbox
+//put the message at the end of the mailbox of the target pid, 
+//the source is CURRENTPCB. With page_count, msg_buffer is the virtual
+//address of the pages, their frames go with the message and the sender
+//loses them, nothing is copied. The caller has the mailbox lock
+
+in: target pid, message, send length, page count
+out: INT32(1/0), 0 if the mailbox is full
+************************************************************************/
+INT32 AddToMailbox(INT32 target_pid, char *msg_buffer, INT32 send_length, INT32 page_count){
+	Mailbox *pbox = GetMailbox(target_pid);
+	INT32 source_pid = CURRENTPCB->Processid;
+	INT32 index;
+	Messagestr *pmessage;
+
+	if(pbox->freeslot<0){
+		return 0;
 	}
-	else if(Temp == ERR_BAD_DEVICE_ID){
-		printf("ERROR! You have to init disk first\n");
-		CALL(Z502Halt());
+	index = pbox->freeslot;
+	pmessage = &pbox->slot[index];
+	pbox->freeslot = pmessage->next;
+	pmessage->loop_count = 0; //no use
+	pmessage->order = messageorder++;
+	pmessage->page_count = page_count;
+	if(page_count>0){
+		DetachPages((INT32)((long)msg_buffer/PGSIZE), page_count, pmessage->frames);
+		pmessage->actual_send_length = send_length;
+		pmessage->msg_buffer[0] = '\0';
 	}
 	else{
-		printf("ERROR!\n");
-		CALL(Z502Halt());
+		pmessage->actual_send_length = strlen(msg_buffer);
+		strcpy(pmessage->msg_buffer,msg_buffer);
+	}
+	pmessage->actual_source_pid = source_pid;
+	pmessage->receive_length = 0; //no use
+	pmessage->send_length = send_length;
+	pmessage->source_pid = source_pid;
+	pmessage->target_pid = target_pid; //store -1 here, well, sp print cant show it
+	//the newest one of the mailbox and of its source
+	pmessage->prev = pbox->tail;
+	pmessage->next = -1;
+	pmessage->nextfrom = -1;
+	if(pbox->tail>=0){
+		pbox->slot[pbox->tail].next = index;
 	}
-	//READ_MODIFY(MEMORY_INTERLOCK_BASE+4, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //disk
+	else pbox->head = index;
+	pbox->tail = index;
+	if(pbox->fromtail[source_pid]>=0){
+		pbox->slot[pbox->fromtail[source_pid]].nextfrom = index;
+	}
+	else pbox->fromhead[source_pid] = index;
+	pbox->fromtail[source_pid] = index;
+	pbox->count++;
+	return 1;
 }
 
-/**************************************************************************************************************************************
-WriteToDisk
-//write data to target disk in specified sector
+/************************************************************************
+GetMessageAt
+//get the message in the slot of the mailbox
 
-in: disk id, sector, data
-out: 
-**************************************************************************************************************************************/
-INT32 WriteToDisk(INT32 disk_id, INT32 sector, char *char_data){
-	INT32	Temp;
-	INT32	LockResult;//return the result for read_modify
-	INT32	Time,starttime;
+in: mailbox, slot
+out: message
+************************************************************************/
+Messagestr *GetMessageAt(Mailbox *pbox, INT32 index){
+	return &pbox->slot[index];
+}
 
-	//READ_MODIFY(MEMORY_INTERLOCK_BASE+4, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //disk
-	/* Do the hardware call to put data on disk */
-	MEM_WRITE(Z502DiskSetID, &disk_id);
-	MEM_READ(Z502DiskStatus, &Temp);
-	if (Temp == DEVICE_FREE){        // Disk hasn't been used - should be free
-		//printf("Disk is free.\n");
-		//READ_MODIFY(MEMORY_INTERLOCK_BASE+4, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //disk
-
-		MEM_WRITE(Z502DiskSetSector, &sector);
-		//MEM_WRITE(Z502DiskSetBuffer, (INT32 * )disk_buffer_write);
-		MEM_WRITE(Z502DiskSetBuffer, (INT32 * )char_data);
-		Temp = 1;                        // Specify a write
-		MEM_WRITE(Z502DiskSetAction, &Temp);
-		Temp = 0;                        // Must be set to 0
-		
-		//MEM_READ( Z502ClockStatus, &Time );
-		MEM_WRITE(Z502DiskStart, &Temp);
-		//printf("start disktimer!!!Temp:%i diskid:%i sector:%i Time:%i\n",Temp,disk_id,sector,Time);
-		/*This action starts the disk. Its required that youve previously given a Device ID and also set the sector 
-		and specified the action. If you havent done all these correctly, then the disk will not be started.If you gave 
-		an illegal disk ID previously, this request is ignored.Cautious programming suggests that after you start 
-		the disk you should check it is actually running C that way you always know that you got it going correctly.*/
-		//MEM_READ(Z502DiskStatus, &Temp);
-		//debug
-		/*if(Temp != DEVICE_IN_USE){
-			printf(":deviceid:%d,is not in use.it is %i\n",disk_id,Temp);
-			printf("diskid:%i,sector:%i,char_data:%s\n",disk_id,sector,char_data[2]);
-			Z502Halt();
-		}
-		if(disk_id>10){
-			printf(":deviceid:%d,wwwwwwwwwwwwwwwwwwww.\n",disk_id);
-		}*/
-		// Disk should now be started - let's see
-		//lock
-		READ_MODIFY(MEMORY_INTERLOCK_BASE+0, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //readyqueue
-		READ_MODIFY(MEMORY_INTERLOCK_BASE+2, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //suspendqueue
-		
-		CALL(AddToSuspendQueue(suspendqueue,CURRENTPCB));
-		CALL(RemoveQueueByPid(readyqueue,CURRENTPCB->Processid));
+/************************************************************************
+FindInMailbox
+//find the oldest message from the source pid in the mailbox
 
-		
-		READ_MODIFY(MEMORY_INTERLOCK_BASE+2, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //suspendqueue
-		READ_MODIFY(MEMORY_INTERLOCK_BASE+0, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //readyqueue
-		//READ_MODIFY(MEMORY_INTERLOCK_BASE+4, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //disk
-		//CALL(dospprint("WDISK", CURRENTPCB->Processid, CURRENTPCB)); //after memcpy CURRENTPCB, print ok now
-		//MEM_WRITE(Z502DiskStart, &Temp);
-		//memcpy(CURRENTPCB, &readyqueue->front->data,sizeof(Process_Control_Block));
-		//CALL(Z502SwitchContext( SWITCH_CONTEXT_SAVE_MODE, &readyqueue->front->data.context)); //switch to first one in readyqueue*/
+in: mailbox, source pid
+out: slot, -1 if there is none
+************************************************************************/
+INT32 FindInMailbox(Mailbox *pbox, INT32 source_pid){
+	if(source_pid<0||source_pid>=ProcessTableSize){
+		return -1;
+	}
+	return pbox->fromhead[source_pid];
+}
+
+/************************************************************************
+FindMessage
+//find the message the target pid should receive next. When the source
+//is -1, it is the older one of the target mailbox head and the 
+//broadcast mailbox head, otherwise the oldest one from that source
+
+in: target pid, source pid, return slot
+out: mailbox, NULL if there is no message
+************************************************************************/
+Mailbox *FindMessage(INT32 target_pid, INT32 source_pid, INT32 *index){
+	Mailbox *pbox = GetMailbox(target_pid);
 
+	if(source_pid!=-1){
+		*index = FindInMailbox(pbox, source_pid);
+		if(*index<0){
+			return NULL;
+		}
+		return pbox;
 	}
-	else if(Temp == DEVICE_IN_USE){
-		//printf("Device is in use.\n");
-		//READ_MODIFY(MEMORY_INTERLOCK_BASE+4, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //disk
-		//READ_MODIFY(MEMORY_INTERLOCK_BASE+4, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //disk
-		READ_MODIFY(MEMORY_INTERLOCK_BASE+0, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //readyqueue
-		READ_MODIFY(MEMORY_INTERLOCK_BASE+2, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //suspendqueue
-		
-		CALL(AddToSuspendQueue(suspendqueue,CURRENTPCB));
-		CALL(RemoveQueueByPid(readyqueue,CURRENTPCB->Processid));
+	if(pbox->head<0&&broadcastbox.head<0){
+		return NULL;
+	}
+	if(pbox->head<0||(broadcastbox.head>=0&&GetMessageAt(&broadcastbox, broadcastbox.head)->order<GetMessageAt(pbox, pbox->head)->order)){
+		*index = broadcastbox.head;
+		return &broadcastbox;
+	}
+	*index = pbox->head;
+	return pbox;
+}
 
-		READ_MODIFY(MEMORY_INTERLOCK_BASE+2, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //suspendqueue
-		READ_MODIFY(MEMORY_INTERLOCK_BASE+0, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //readyqueue
-		//READ_MODIFY(MEMORY_INTERLOCK_BASE+4, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //disk
-		//CALL(dospprint("WDISK", CURRENTPCB->Processid, CURRENTPCB)); //after memcpy CURRENTPCB, print ok now
+/************************************************************************
+RemoveFromMailbox
+//unlink the message in the slot and free the slot. A receive always
+//takes the oldest message of its source, that is O(1), only a terminate
+//takes one from the middle of the source chain
 
-	}		
-	else if(Temp == ERR_BAD_DEVICE_ID){
-		printf("ERROR! You have to init disk first\n");
-		CALL(Z502Halt());
+in: mailbox, slot
+out: 
+************************************************************************/					
+void RemoveFromMailbox(Mailbox *pbox, INT32 index){  
+	Messagestr *pmessage;
+	INT32 source_pid;
+	INT32 before;
+	if(pbox->count==0){ //if mailbox is empty
+		printf("WARN, your mailbox is empty, there is nothing to remove\n");
+		return;
+	}
+	pmessage = GetMessageAt(pbox, index);
+	source_pid = pmessage->source_pid;
+	if(pmessage->prev>=0){
+		pbox->slot[pmessage->prev].next = pmessage->next;
+	}
+	else pbox->head = pmessage->next;
+	if(pmessage->next>=0){
+		pbox->slot[pmessage->next].prev = pmessage->prev;
+	}
+	else pbox->tail = pmessage->prev;
+	if(pbox->fromhead[source_pid]==index){
+		pbox->fromhead[source_pid] = pmessage->nextfrom;
+		before = -1;
 	}
 	else{
-		printf("ERROR!\n");
-		CALL(Z502Halt());
+		before = pbox->fromhead[source_pid];
+		while(pbox->slot[before].nextfrom!=index){
+			before = pbox->slot[before].nextfrom;
+		}
+		pbox->slot[before].nextfrom = pmessage->nextfrom;
 	}
-	//READ_MODIFY(MEMORY_INTERLOCK_BASE+4, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //disk
+	if(pmessage->nextfrom<0){
+		pbox->fromtail[source_pid] = before;
+	}
+	pmessage->next = pbox->freeslot;
+	pbox->freeslot = index;
+	pbox->count--;
 }
 
-/**************************************************************************************************************************************
-Below are the routines for message handle
+/************************************************************************
+ReleaseMessagePages
+//no one will receive the message, the frames it hands over go back to
+//the frame table
 
-	Addtomessagelist, removefrommessagelist, IsSourcePidExsit
-**************************************************************************************************************************************/
+in: message
+out: 
+************************************************************************/
+void ReleaseMessagePages(Messagestr *pmessage){
+	INT32 i;
+	INT32 LockResult;
+
+	READ_MODIFY(MEMORY_INTERLOCK_BASE+4, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //frametable
+	for(i=0;i<pmessage->page_count;i++){
+		framemap[pmessage->frames[i]].pinned &= ~FRAME_HANDOFF;
+		FreeFrame(pmessage->frames[i]);
+		framepinnedcount--;
+	}
+	pmessage->page_count = 0;
+	READ_MODIFY(MEMORY_INTERLOCK_BASE+4, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //frametable
+}
 
 /************************************************************************
-Addtomessagelist
-//insert the data to messagelist, too much arguments, didnt use it
+ReleaseMessages
+//the process is gone. Its mailbox is dropped with all it holds, and the
+//pages it handed over that no one took yet are taken back like the
+//rest of its memory, a short message from it is a copy and stays. The
+//mailbox lock comes before the frametable one as in a send, so the
+//caller holds neither
 
-in: long target_pid, long source_pid, long actual_source_pid, long send_length, 
-	long receive_length, long actual_send_length, long loop_count, char *msg_buffer
+in: process id
 out: 
 ************************************************************************/
-void Addtomessagelist(long target_pid, long source_pid, long actual_source_pid, long send_length, 
-	long receive_length, long actual_send_length, long loop_count, char *msg_buffer){
-	if(messagecount>MessageLimit){ //limit number 100
-		printf("ERROR! the limit of messagecount is 100\n");
+void ReleaseMessages(INT32 pid){
+	Mailbox *pbox;
+	INT32 i, index, next;
+	INT32 LockResult;
+
+	if(pid<0||pid>=ProcessTableSize){
+		return;
 	}
-	else{
-		messagelist[messagecount].actual_send_length = actual_send_length; 
-		messagelist[messagecount].actual_source_pid = actual_source_pid;
-		messagelist[messagecount].loop_count = loop_count;
-		strcpy(messagelist[0].msg_buffer,msg_buffer);
-		messagelist[messagecount].receive_length = receive_length;
-		messagelist[messagecount].send_length = send_length;
-		messagelist[messagecount].source_pid = source_pid;
-		messagelist[messagecount].target_pid = target_pid;
-		messagecount++;
-	}	
+	READ_MODIFY(MEMORY_INTERLOCK_BASE+3, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //mailbox
+	pbox = mailbox[pid];
+	if(pbox!=NULL){
+		for(index=pbox->head;index>=0;index=pbox->slot[index].next){
+			ReleaseMessagePages(&pbox->slot[index]);
+		}
+		free(pbox);
+		mailbox[pid] = NULL;
+	}
+	for(i=-1;i<ProcessTableSize;i++){ //-1 is the broadcast mailbox
+		if(i>=0&&mailbox[i]==NULL){
+			continue;
+		}
+		pbox = GetMailbox(i);
+		for(index=pbox->fromhead[pid];index>=0;index=next){
+			next = pbox->slot[index].nextfrom;
+			if(pbox->slot[index].page_count>0){
+				ReleaseMessagePages(&pbox->slot[index]);
+				RemoveFromMailbox(pbox, index);
+			}
+		}
+	}
+	READ_MODIFY(MEMORY_INTERLOCK_BASE+3, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //mailbox
+}
+
+/************************************************************************
+IsHandoffBuffer
+//judge if the buffer of a page message is page aligned and inside the
+//virtual memory, the caller said it is a virtual address with MESSAGE_PAGES
+
+in: virtual address, length
+out: INT32(1/0)
+************************************************************************/
+INT32 IsHandoffBuffer(long address, INT32 length){
+	if(address<0||address%PGSIZE!=0||length<=0){
+		return 0;
+	}
+	if((length+PGSIZE-1)/PGSIZE>HandoffPageLimit){
+		return 0;
+	}
+	if(address+length>VIRTUAL_MEM_PGS*PGSIZE){
+		return 0;
+	}
+	return 1;
+}
+
+/************************************************************************
+IsMessageFit
+//judge if the message can be received with the receive length, handed
+//over pages only go to a MESSAGE_PAGES buffer, a normal message only to
+//a normal one
+
+in: message, receive length, page flag of the receive
+out: INT32(1/0)
+************************************************************************/
+INT32 IsMessageFit(Messagestr *pmessage, INT32 receivelength, INT32 pageflag){
+	if(pmessage->page_count>0){
+		return pageflag==MESSAGE_PAGES&&receivelength>=pmessage->page_count*PGSIZE;
+	}
+	if(pageflag==MESSAGE_PAGES||receivelength>64||receivelength<(INT32)strlen(pmessage->msg_buffer)){
+		return 0;
+	}
+	return 1;
+}
+
+/************************************************************************
+IsPageResident
+//judge if all the pages are in memory, only those can be handed over
+
+in: first virtual page, page count
+out: INT32(1/0)
+************************************************************************/
+INT32 IsPageResident(INT32 vpn, INT32 page_count){
+	INT32 i;
+	if(Z502_PAGE_TBL_ADDR==NULL||vpn+page_count>Z502_PAGE_TBL_LENGTH){
+		return 0;
+	}
+	for(i=0;i<page_count;i++){
+		if((PeekTableEntry(Z502_PAGE_TBL_ADDR, vpn+i)&PTBL_VALID_BIT)==0){
+			return 0;
+		}
+	}
+	return 1;
 }
 
 /************************************************************************
-removefrommessagelist
-//remove all the match element in messagelist
+DetachPages
+//take the frames out of the current page table, they belong to no one
+//until AttachPages, the clock and GetFreeFrame skip them. The swap slots
+//of the pages go too, the sender has nothing there any more
 
-in: position
+in: first virtual page, page count, return frames
 out: 
-************************************************************************/					
-void removefrommessagelist(INT32 icount){  
-	INT32 pcount = icount;
-	if(messagecount==0){ //if messagelist is empty
-		printf("WARN, your messagelist is empty, there is nothing to remove\n");
+************************************************************************/
+void DetachPages(INT32 vpn, INT32 page_count, UINT16 *frames){
+	INT32 i;
+	INT32 LockResult;
+
+	READ_MODIFY(MEMORY_INTERLOCK_BASE+4, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //frametable
+	for(i=0;i<page_count;i++){
+		frames[i] = PeekTableEntry(Z502_PAGE_TBL_ADDR, vpn+i)&PTBL_PHYS_PG_NO;
+		framemap[frames[i]].pinned |= FRAME_HANDOFF;
+		framepinnedcount++;
+		*TableEntry(Z502_PAGE_TBL_ADDR, vpn+i) = 0;
+		Z502InvalidateTLB(vpn+i);
+		if(SwapSlotOf(CURRENTPCB->Processid, vpn+i)!=-1){
+			FreeSwapSlot(SwapSlotOf(CURRENTPCB->Processid, vpn+i));
+		}
 	}
-	while(pcount<messagecount){//if its not the last element
-		messagelist[pcount] = messagelist[pcount+1];
-		pcount++;
+	READ_MODIFY(MEMORY_INTERLOCK_BASE+4, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //frametable
+}
+
+/************************************************************************
+AttachPages
+//put the handed over frames into the current page table
+
+in: first virtual page, page count, frames
+out: 
+************************************************************************/
+void AttachPages(INT32 vpn, INT32 page_count, UINT16 *frames){
+	INT32 i;
+	INT32 LockResult;
+
+	READ_MODIFY(MEMORY_INTERLOCK_BASE+4, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //frametable
+	MapPages(vpn, page_count, frames);
+	for(i=0;i<page_count;i++){
+		framemap[frames[i]].pinned &= ~FRAME_HANDOFF;
+		framepinnedcount--;
 	}
-	messagecount--;
+	READ_MODIFY(MEMORY_INTERLOCK_BASE+4, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //frametable
 }
 
 /************************************************************************
 IsSourcePidExsit
-//judge if the pid is in messagelist
+//judge if the source pid has any message for the target not yet received,
+//the caller has the mailbox lock
 
-in: process id
+in: target pid, source pid
 out: INT32(1/0)
 ************************************************************************/	
-INT32 IsSourcePidExsit(INT32 pid){  
-	INT32 i;
-	for(i=0;i<messagecount;i++){
-		if(messagelist[i].source_pid==pid){
-			return 1;
-		}	
+INT32 IsSourcePidExsit(INT32 target_pid, INT32 source_pid){  
+	if(FindInMailbox(GetMailbox(target_pid), source_pid)>=0){
+		return 1;
 	}
 	return 0;
 }
 
+/************************************************************************
+BeginReceiveWait
+//the pid suspends in RECEIVE_MESSAGE, one waiting for anyone goes to the
+//end of the broadcast waiters. The caller has the readyqueue and the
+//suspendqueue locks
+
+in: process id, source pid it waits for
+out: 
+************************************************************************/	
+void BeginReceiveWait(INT32 pid, INT32 source_pid){
+	receivewaiting[pid] = 1;
+	receivesource[pid] = source_pid;
+	if(source_pid!=-1){
+		return;
+	}
+	anywaitnext[pid] = -1;
+	anywaitprev[pid] = anywaittail;
+	if(anywaittail>=0){
+		anywaitnext[anywaittail] = pid;
+	}
+	else anywaithead = pid;
+	anywaittail = pid;
+}
+
+/************************************************************************
+EndReceiveWait
+//the pid no longer waits, it leaves the broadcast waiters if it is there.
+//The caller has the readyqueue and the suspendqueue locks
+
+in: process id
+out: 
+************************************************************************/	
+void EndReceiveWait(INT32 pid){
+	if(receivewaiting[pid]==1&&receivesource[pid]==-1){
+		if(anywaitprev[pid]>=0){
+			anywaitnext[anywaitprev[pid]] = anywaitnext[pid];
+		}
+		else anywaithead = anywaitnext[pid];
+		if(anywaitnext[pid]>=0){
+			anywaitprev[anywaitnext[pid]] = anywaitprev[pid];
+		}
+		else anywaittail = anywaitprev[pid];
+	}
+	receivewaiting[pid] = 0;
+}
+
+/************************************************************************
+FindBroadcastWaiter
+//take the process that waits longest in RECEIVE_MESSAGE from anyone, a
+//broadcast wakes it up directly. One a direct send resumed already is
+//on its way to receive again, it only leaves the list
+
+in: 
+out: process id, -1 if no one is waiting
+************************************************************************/	
+INT32 FindBroadcastWaiter(void){  
+	INT32 pid;
+	while(anywaithead>=0){
+		pid = anywaithead;
+		EndReceiveWait(pid);
+		if(IsPidExist(suspendqueue, pid)){
+			return pid;
+		}
+	}
+	return -1;
+}
+
 /************************************************************************
 messageprocess
 //the routine for test1m, I make two message process here, first one is 
@@ -2438,24 +5772,14 @@ void messageprocess( char *message ){
 		}
 	}
 	else if(flag == 2){
-		READ_MODIFY(MEMORY_INTERLOCK_BASE+3, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //messagelist
-		if(messagecount>MessageLimit-1){ //limit message number 100
-			printf("ERROR! The limit number of messages is 100\n");
-		}
-		else{
-			for(icount = 0;icount<atoi(dd);icount++){
-				messagelist[messagecount].actual_send_length = strlen(messagebuff);  
-				messagelist[messagecount].actual_source_pid = CURRENTPCB->Processid;
-				messagelist[messagecount].loop_count = 0; //no use
-				strcpy(messagelist[messagecount].msg_buffer,messagebuff);
-				messagelist[messagecount].receive_length = 0; //no use
-				messagelist[messagecount].send_length = strlen(messagebuff);
-				messagelist[messagecount].source_pid = CURRENTPCB->Processid;
-				messagelist[messagecount].target_pid = 0;
-				messagecount++;
+		READ_MODIFY(MEMORY_INTERLOCK_BASE+3, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //mailbox
+		for(icount = 0;icount<atoi(dd);icount++){
+			if(AddToMailbox(0, messagebuff, strlen(messagebuff), 0)!=1){
+				printf("ERROR! The limit number of messages is %d\n", MailboxSize);
+				break;
 			}
 		}
-		READ_MODIFY(MEMORY_INTERLOCK_BASE+3, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //messagelist
+		READ_MODIFY(MEMORY_INTERLOCK_BASE+3, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult); //mailbox
 	}
 	else{
 	
@@ -2684,6 +6008,22 @@ INT32 OSCreateProcess(char *processname, void *processaddress, INT32 processprio
 			start_PCB->Priority = processpriority;
 			sprintf(start_PCB->Name , "%s", processname);
 		}
+		else if( strcmp( (char *)processaddress, "test2i" ) == 0 ){
+			CALL(Z502MakeContext( &next_context, (void *) test2i, KERNEL_MODE ));
+			start_PCB = (Process_Control_Block *) calloc(1, sizeof(Process_Control_Block));
+			start_PCB->context = next_context;
+			start_PCB->Processid = PCBcount;
+			start_PCB->Priority = processpriority;
+			sprintf(start_PCB->Name , "%s", processname);
+		}
+		else if( strcmp( (char *)processaddress, "test2j" ) == 0 ){
+			CALL(Z502MakeContext( &next_context, (void *) test2j, KERNEL_MODE ));
+			start_PCB = (Process_Control_Block *) calloc(1, sizeof(Process_Control_Block));
+			start_PCB->context = next_context;
+			start_PCB->Processid = PCBcount;
+			start_PCB->Priority = processpriority;
+			sprintf(start_PCB->Name , "%s", processname);
+		}
 		//its for the text1x and test1j_echo
 		else{
 			CALL(Z502MakeContext( &next_context, (void *) processaddress, KERNEL_MODE ));
@@ -2694,6 +6034,9 @@ INT32 OSCreateProcess(char *processname, void *processaddress, INT32 processprio
 		PCB->Processid = PCBcount++;
 		PCB->Priority = processpriority;
 		sprintf(PCB->Name , "%s", processname); //need to sprintf a point value
+		if(PCB->Processid<ProcessTableSize){ //every process has its own address space
+			GetPageTable(PCB->Processid);
+		}
 		READ_MODIFY(MEMORY_INTERLOCK_BASE+0, DO_LOCK, SUSPEND_UNTIL_LOCKED, &LockResult);
 		CALL(AddToReadyQueueByPriority(readyqueue, PCB));//insert by priority
 		READ_MODIFY(MEMORY_INTERLOCK_BASE+0, DO_UNLOCK, SUSPEND_UNTIL_LOCKED, &LockResult);
@@ -2714,9 +6057,24 @@ osInit
 void    osInit( INT32 argc, char *argv[]  ) {
     INT32	i;
 	//init three queues
-	timerqueue = InitQueue(); 
-	readyqueue = InitQueue();
+	timerqueue = InitTimerQueue(); 
+	readyqueue = InitPriorityQueue();
 	suspendqueue = InitQueue();
+	if(argc>2){ //the second argument names the page replacement policy
+		SelectReplacePolicy(argv[2]);
+		pagingreport = 1;
+	}
+	if(argc>3){ //the third one the disk scheduling policy
+		SelectDiskPolicy(argv[3]);
+		diskreport = 1;
+	}
+	AllocFrameTables();
+	replacepolicy->init();
+	InitFrameMap();
+	InitSwapSpace();
+	InitDiskQueues();
+	InitBufferCache();
+	InitMailbox(&broadcastbox);
 
 	//freopen("filename.txt", "w", stdout); //for debug
 
@@ -51,7 +51,7 @@ void get_skewed_random_number(long *, long);
 void DoSleep(INT32 millisecs);
 int CreateAThread(void *ThreadStartAddress, INT32 *data);
 
-extern UINT16 *Z502_PAGE_TBL_ADDR;
+extern UINT16 **Z502_PAGE_TBL_ADDR;
 extern INT16 Z502_PAGE_TBL_LENGTH;
 
 char Success[] = "      Action Failed\0        Action Succeeded";
@@ -333,10 +333,12 @@ void sample_code(void) {
 	 *********************************************************************/
 
 	Z502_PAGE_TBL_LENGTH = 64;
-	Z502_PAGE_TBL_ADDR = (UINT16 *) calloc(sizeof(UINT16),
-			Z502_PAGE_TBL_LENGTH);
+	Z502_PAGE_TBL_ADDR = (UINT16 **) calloc(sizeof(UINT16 *),
+			PTBL_DIR_SIZE);
+	Z502_PAGE_TBL_ADDR[0] = (UINT16 *) calloc(sizeof(UINT16),
+			PTBL_LEAF_PGS);
 	i = PTBL_VALID_BIT;
-	Z502_PAGE_TBL_ADDR[0] = (UINT16) i;
+	Z502_PAGE_TBL_ADDR[0][0] = (UINT16) i;
 	i = 73;
 	MEM_WRITE(0, &i);
 	MEM_READ(0, &j);
@@ -43,6 +43,10 @@
 #define         SYSNUM_DISK_READ                       13
 #define         SYSNUM_DISK_WRITE                      14
 #define         SYSNUM_DEFINE_SHARED_AREA              15
+#define         SYSNUM_DISK_READV                      16
+#define         SYSNUM_DISK_WRITEV                     17
+#define         SYSNUM_IO_RING_SETUP                   18
+#define         SYSNUM_IO_RING_ENTER                   19
 
 // This structure defines the format used for all system calls.
 // For each call, the structure is filled in and then its address
@@ -55,6 +59,40 @@ typedef struct    {
     long *Argument[MAX_NUMBER_ARGUMENTS];
 } SYSTEM_CALL_DATA;
 
+// A process that does its disk I/O without waiting for every request
+// shares one IO_RING with the OS.  It fills the entry at sq_tail and
+// moves sq_tail on, IO_RING_ENTER hands all new entries to the disks
+// with one trap.  The OS puts a completion at cq_tail when a request
+// is done, the process takes them from cq_head and moves cq_head on.
+// The heads and tails only grow, an index is taken modulo the size.
+// A buffer must stay as it is until its completion comes.
+
+#define         IO_RING_ENTRIES                        16     // a power of 2
+#define         IO_RING_READ                           0
+#define         IO_RING_WRITE                          1
+
+typedef struct    {
+    INT32   opcode;                  // IO_RING_READ or IO_RING_WRITE
+    INT32   disk_id;
+    INT32   sector;
+    char    *buffer;                 // one sector, PGSIZE bytes
+    long    user_data;               // given back in the completion
+} IO_RING_SQE;
+
+typedef struct    {
+    long    user_data;
+    INT32   result;                  // ERR_SUCCESS or the error of the disk
+} IO_RING_CQE;
+
+typedef struct    {
+    volatile UINT32      sq_head;    // moved by the OS
+    volatile UINT32      sq_tail;    // moved by the process
+    IO_RING_SQE          sq[IO_RING_ENTRIES];
+    volatile UINT32      cq_head;    // moved by the process
+    volatile UINT32      cq_tail;    // moved by the OS
+    volatile IO_RING_CQE cq[IO_RING_ENTRIES];
+} IO_RING;
+
 
 extern void ChargeTimeAndCheckEvents(INT32);
 extern int BaseThread();
@@ -249,6 +287,53 @@ extern int BaseThread();
                 free(SystemCallData);                                          \
                 }                                                              \
 
+// SEND_MESSAGE_PAGES and RECEIVE_MESSAGE_PAGES take the same arguments as
+// SEND_MESSAGE and RECEIVE_MESSAGE, but the buffer is a page-aligned
+// address in the virtual memory of the process.  The pages of the send
+// are handed to the receiver instead of being copied, so they must be in
+// memory, and the sender loses them.  Their frames replace whatever the
+// receive buffer had.
+
+#define         MESSAGE_PAGES                          1
+
+#define         SEND_MESSAGE_PAGES( arg1, arg2, arg3, arg4 )   {               \
+                SYSTEM_CALL_DATA *SystemCallData =                             \
+                     (SYSTEM_CALL_DATA *)calloc(1, sizeof (SYSTEM_CALL_DATA)); \
+                SystemCallData->NumberOfArguments = 6;                         \
+                SystemCallData->SystemCallNumber = SYSNUM_SEND_MESSAGE;        \
+                SystemCallData->Argument[0] = (long *)arg1;                    \
+                SystemCallData->Argument[1] = (long *)arg2;                    \
+                SystemCallData->Argument[2] = (long *)arg3;                    \
+                SystemCallData->Argument[3] = (long *)arg4;                    \
+                SystemCallData->Argument[4] = (long *)MESSAGE_PAGES;           \
+                ChargeTimeAndCheckEvents( COST_OF_SOFTWARE_TRAP );             \
+                Z502_MODE = KERNEL_MODE;                                       \
+                svc(SystemCallData);                                           \
+                Z502_MODE = USER_MODE;                                         \
+                free(SystemCallData);                                          \
+                }                                                              \
+
+
+#define         RECEIVE_MESSAGE_PAGES( arg1, arg2, arg3, arg4, arg5, arg6 ) {  \
+                SYSTEM_CALL_DATA *SystemCallData =                             \
+                     (SYSTEM_CALL_DATA *)calloc(1, sizeof (SYSTEM_CALL_DATA)); \
+                SystemCallData->NumberOfArguments = 8;                         \
+                SystemCallData->SystemCallNumber = SYSNUM_RECEIVE_MESSAGE;     \
+                SystemCallData->Argument[0] = (long *)arg1;                    \
+                SystemCallData->Argument[1] = (long *)arg2;                    \
+                SystemCallData->Argument[2] = (long *)arg3;                    \
+                SystemCallData->Argument[3] = (long *)arg4;                    \
+                SystemCallData->Argument[4] = (long *)arg5;                    \
+                SystemCallData->Argument[5] = (long *)arg6;                    \
+                SystemCallData->Argument[6] = (long *)MESSAGE_PAGES;           \
+                ChargeTimeAndCheckEvents( COST_OF_SOFTWARE_TRAP );             \
+                Z502_MODE = KERNEL_MODE;                                       \
+                svc(SystemCallData);                                           \
+                Z502_MODE = USER_MODE;                                         \
+                free(SystemCallData);                                          \
+                }                                                              \
+
+
 
 #define         DISK_READ( arg1, arg2, arg3)   {                               \
                 SYSTEM_CALL_DATA *SystemCallData =                             \
@@ -300,6 +385,73 @@ extern int BaseThread();
                 }                                                              \
 
 
+#define         DISK_READV( arg1, arg2, arg3, arg4, arg5)   {                  \
+                SYSTEM_CALL_DATA *SystemCallData =                             \
+                     (SYSTEM_CALL_DATA *)calloc(1, sizeof (SYSTEM_CALL_DATA)); \
+                SystemCallData->NumberOfArguments = 6;                         \
+                SystemCallData->SystemCallNumber = SYSNUM_DISK_READV;          \
+                SystemCallData->Argument[0] = (long *)arg1;                    \
+                SystemCallData->Argument[1] = (long *)arg2;                    \
+                SystemCallData->Argument[2] = (long *)arg3;                    \
+                SystemCallData->Argument[3] = (long *)arg4;                    \
+                SystemCallData->Argument[4] = (long *)arg5;                    \
+                ChargeTimeAndCheckEvents( COST_OF_SOFTWARE_TRAP );             \
+                Z502_MODE = KERNEL_MODE;                                       \
+                svc(SystemCallData);                                           \
+                Z502_MODE = USER_MODE;                                         \
+                free(SystemCallData);                                          \
+                }                                                              \
+
+
+#define         DISK_WRITEV( arg1, arg2, arg3, arg4, arg5)   {                 \
+                SYSTEM_CALL_DATA *SystemCallData =                             \
+                     (SYSTEM_CALL_DATA *)calloc(1, sizeof (SYSTEM_CALL_DATA)); \
+                SystemCallData->NumberOfArguments = 6;                         \
+                SystemCallData->SystemCallNumber = SYSNUM_DISK_WRITEV;         \
+                SystemCallData->Argument[0] = (long *)arg1;                    \
+                SystemCallData->Argument[1] = (long *)arg2;                    \
+                SystemCallData->Argument[2] = (long *)arg3;                    \
+                SystemCallData->Argument[3] = (long *)arg4;                    \
+                SystemCallData->Argument[4] = (long *)arg5;                    \
+                ChargeTimeAndCheckEvents( COST_OF_SOFTWARE_TRAP );             \
+                Z502_MODE = KERNEL_MODE;                                       \
+                svc(SystemCallData);                                           \
+                Z502_MODE = USER_MODE;                                         \
+                free(SystemCallData);                                          \
+                }                                                              \
+
+
+#define         IO_RING_SETUP( arg1, arg2 )   {                                \
+                SYSTEM_CALL_DATA *SystemCallData =                             \
+                     (SYSTEM_CALL_DATA *)calloc(1, sizeof (SYSTEM_CALL_DATA)); \
+                SystemCallData->NumberOfArguments = 3;                         \
+                SystemCallData->SystemCallNumber = SYSNUM_IO_RING_SETUP;       \
+                SystemCallData->Argument[0] = (long *)arg1;                    \
+                SystemCallData->Argument[1] = (long *)arg2;                    \
+                ChargeTimeAndCheckEvents( COST_OF_SOFTWARE_TRAP );             \
+                Z502_MODE = KERNEL_MODE;                                       \
+                svc(SystemCallData);                                           \
+                Z502_MODE = USER_MODE;                                         \
+                free(SystemCallData);                                          \
+                }                                                              \
+
+
+#define         IO_RING_ENTER( arg1, arg2, arg3 )   {                          \
+                SYSTEM_CALL_DATA *SystemCallData =                             \
+                     (SYSTEM_CALL_DATA *)calloc(1, sizeof (SYSTEM_CALL_DATA)); \
+                SystemCallData->NumberOfArguments = 4;                         \
+                SystemCallData->SystemCallNumber = SYSNUM_IO_RING_ENTER;       \
+                SystemCallData->Argument[0] = (long *)arg1;                    \
+                SystemCallData->Argument[1] = (long *)arg2;                    \
+                SystemCallData->Argument[2] = (long *)arg3;                    \
+                ChargeTimeAndCheckEvents( COST_OF_SOFTWARE_TRAP );             \
+                Z502_MODE = KERNEL_MODE;                                       \
+                svc(SystemCallData);                                           \
+                Z502_MODE = USER_MODE;                                         \
+                free(SystemCallData);                                          \
+                }                                                              \
+
+
 /*      This section includes items needed in the scheduler printer.
  It's also useful for those routines that want to communicate
  with the scheduler printer.                                       */
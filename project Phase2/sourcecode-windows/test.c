@@ -66,6 +66,9 @@ extern INT16 Z502_MODE;
 void   test1x(void);
 void   test1j_echo(void);
 void   test2hx(void);
+void   test2jx(void);
+void   test2j_submit(IO_RING *, INT32, INT32, INT32, char *, long);
+void   test2j_reap(IO_RING *, INT32, INT32 *);
 void   ErrorExpected(INT32, char[]);
 void   SuccessExpected(INT32, char[]);
 void   get_skewed_random_number( long *, long );
@@ -1958,6 +1961,307 @@ void test2hx(void) {
 
 }                                // End of test2hx   
 
+/**************************************************************************
+
+ Test2i exercises DISK_WRITEV and DISK_READV.
+
+ A vector of sectors is written and read back with one request each,
+ so the seek is paid once and every further sector only adds its
+ transfer.  Then one sector in the middle of a run is left in the
+ buffer cache only, the vector read around it must still return all
+ of the run.  Last come a run that was never written and runs that
+ leave the disk, those give errors.
+
+ Z502_REG4  - process id of this process.
+
+ **************************************************************************/
+
+#define         TEST2I_SECTOR                   300
+#define         TEST2I_ONE_REQUEST_TIME         400     // one access, a seek and 15 transfers
+#define         TEST2I_SANITY                   4321
+
+void test2i(void) {
+    DISK_DATA *data_written;
+    DISK_DATA *data_read;
+    char      *write_list[MAX_DISK_VECTOR];
+    char      *read_list[MAX_DISK_VECTOR];
+    long       disk_id;
+    long       sector;
+    INT32      error;
+    INT32      start_time, end_time;
+    int        Index;
+
+    data_written = (DISK_DATA *) calloc(MAX_DISK_VECTOR, sizeof(DISK_DATA));
+    data_read = (DISK_DATA *) calloc(MAX_DISK_VECTOR, sizeof(DISK_DATA));
+    if (data_read == 0)
+        printf("Something screwed up allocating space in test2i\n");
+
+    GET_PROCESS_ID("", &Z502_REG4, &Z502_REG9);
+    printf("\n\nRelease %s:Test 2i: Pid %ld\n", CURRENT_REL, Z502_REG4);
+    disk_id = (Z502_REG4 / 2) % MAX_NUMBER_OF_DISKS + 1;
+    sector = TEST2I_SECTOR;
+
+    for (Index = 0; Index < MAX_DISK_VECTOR; Index++) {
+        data_written[Index].int_data[0] = disk_id;
+        data_written[Index].int_data[1] = TEST2I_SANITY;
+        data_written[Index].int_data[2] = sector + Index;
+        data_written[Index].int_data[3] = (int) Z502_REG4;
+        write_list[Index] = data_written[Index].char_data;
+        read_list[Index] = data_read[Index].char_data;
+    }
+
+    // The whole vector goes out and comes back in one request each
+
+    GET_TIME_OF_DAY(&start_time);
+    DISK_WRITEV(disk_id, sector, MAX_DISK_VECTOR, write_list, &error);
+    GET_TIME_OF_DAY(&end_time);
+    SuccessExpected(error, "DISK_WRITEV");
+    printf("DISK_WRITEV of %d sectors took %d\n", MAX_DISK_VECTOR,
+            end_time - start_time);
+    if (end_time - start_time > TEST2I_ONE_REQUEST_TIME)
+        printf("AN ERROR HAS OCCURRED.  The write was not one request.\n");
+
+    GET_TIME_OF_DAY(&start_time);
+    DISK_READV(disk_id, sector, MAX_DISK_VECTOR, read_list, &error);
+    GET_TIME_OF_DAY(&end_time);
+    SuccessExpected(error, "DISK_READV");
+    printf("DISK_READV of %d sectors took %d\n", MAX_DISK_VECTOR,
+            end_time - start_time);
+    if (end_time - start_time > TEST2I_ONE_REQUEST_TIME)
+        printf("AN ERROR HAS OCCURRED.  The read was not one request.\n");
+    for (Index = 0; Index < MAX_DISK_VECTOR; Index++) {
+        if (memcmp(data_read[Index].char_data, data_written[Index].char_data,
+                PGSIZE) != 0)
+            printf("AN ERROR HAS OCCURRED.  Sector %ld read wrong.\n",
+                    sector + Index);
+    }
+
+    // The sector in the middle of the next run is only in the buffer
+    // cache, the disk never had it
+
+    sector = TEST2I_SECTOR + MAX_DISK_VECTOR;
+    for (Index = 0; Index < MAX_DISK_VECTOR; Index++) {
+        data_written[Index].int_data[2] = sector + Index;
+        memset(data_read[Index].char_data, 0, PGSIZE);
+    }
+    DISK_WRITEV(disk_id, sector, (MAX_DISK_VECTOR / 2 - 1), write_list, &error);
+    SuccessExpected(error, "DISK_WRITEV");
+    DISK_WRITEV(disk_id, (sector + MAX_DISK_VECTOR / 2), (MAX_DISK_VECTOR / 2),
+            &write_list[MAX_DISK_VECTOR / 2], &error);
+    SuccessExpected(error, "DISK_WRITEV");
+    DISK_WRITE(disk_id, (sector + MAX_DISK_VECTOR / 2 - 1),
+            write_list[MAX_DISK_VECTOR / 2 - 1]);
+    DISK_READV(disk_id, sector, MAX_DISK_VECTOR, read_list, &error);
+    SuccessExpected(error, "DISK_READV");
+    for (Index = 0; Index < MAX_DISK_VECTOR; Index++) {
+        if (memcmp(data_read[Index].char_data, data_written[Index].char_data,
+                PGSIZE) != 0)
+            printf("AN ERROR HAS OCCURRED.  Sector %ld read wrong.\n",
+                    sector + Index);
+    }
+
+    // Sectors nobody wrote, and runs that are not on the disk
+
+    DISK_READV(disk_id, (NUM_LOGICAL_SECTORS - MAX_DISK_VECTOR), MAX_DISK_VECTOR,
+            read_list, &error);
+    ErrorExpected(error, "DISK_READV");
+    DISK_READV(disk_id, (NUM_LOGICAL_SECTORS - 1), 2, read_list, &error);
+    ErrorExpected(error, "DISK_READV");
+    DISK_WRITEV(disk_id, sector, 0, write_list, &error);
+    ErrorExpected(error, "DISK_WRITEV");
+    DISK_READV(disk_id, sector, (MAX_DISK_VECTOR + 1), read_list, &error);
+    ErrorExpected(error, "DISK_READV");
+
+    GET_TIME_OF_DAY(&end_time);
+    printf("Test2i, PID %ld, Ends at Time %d\n", Z502_REG4, end_time);
+    TERMINATE_PROCESS(-2, &Z502_REG9);
+
+}                                       // End of test2i
+
+/**************************************************************************
+
+ Test2j exercises IO_RING_SETUP and IO_RING_ENTER.
+
+ One write goes to every disk with a single IO_RING_ENTER, so all
+ of the disks are busy at once, and two bad entries complete with
+ ERR_BAD_PARAM.  The completions are reaped a few at a time.  Then
+ the sectors are read back the same way.  Last, a child gives its
+ ring several reads on one disk and terminates before they are
+ done, only the read the disk already started may fill its buffers.
+
+ Z502_REG4  - process id of this process.
+
+ **************************************************************************/
+
+#define         TEST2J_SECTOR                   500
+#define         TEST2J_BAD_ENTRIES              2
+#define         TEST2J_BATCH                    4       // completions reaped at a time
+#define         TEST2J_ALL_DISKS_TIME           400     // one request, all disks side by side
+#define         TEST2J_CHILD_READS              4
+#define         TEST2J_UNTOUCHED                0x5A
+#define         SLEEP_TIME_2J                   2000
+
+IO_RING   test2j_child_ring;
+DISK_DATA test2j_child_data[TEST2J_CHILD_READS];
+
+void test2j_submit(IO_RING *ring, INT32 opcode, INT32 disk_id, INT32 sector,
+        char *buffer, long user_data) {
+    IO_RING_SQE *sqe;
+
+    sqe = &ring->sq[ring->sq_tail & (IO_RING_ENTRIES - 1)];
+    sqe->opcode = opcode;
+    sqe->disk_id = disk_id;
+    sqe->sector = sector;
+    sqe->buffer = buffer;
+    sqe->user_data = user_data;
+    ring->sq_tail++;
+}                                       // End of test2j_submit
+
+// Reap count completions, TEST2J_BATCH at a time.  user_data of an
+// entry is its index, results keeps what the disk said.
+
+void test2j_reap(IO_RING *ring, INT32 count, INT32 *results) {
+    IO_RING_CQE *cqe;
+    INT32        submitted;
+    INT32        error;
+    INT32        reaped = 0;
+    INT32        wanted;
+
+    while (reaped < count) {
+        wanted = count - reaped;
+        if (wanted > TEST2J_BATCH)
+            wanted = TEST2J_BATCH;
+        IO_RING_ENTER(wanted, &submitted, &error);
+        if (error != ERR_SUCCESS)
+            printf("AN ERROR HAS OCCURRED.  IO_RING_ENTER gave %d\n", error);
+        while (ring->cq_head != ring->cq_tail) {
+            cqe = (IO_RING_CQE *) &ring->cq[ring->cq_head & (IO_RING_ENTRIES - 1)];
+            results[cqe->user_data] = cqe->result;
+            ring->cq_head++;
+            reaped++;
+        }
+    }
+}                                       // End of test2j_reap
+
+void test2j(void) {
+    IO_RING   *ring;
+    DISK_DATA *data_written;
+    DISK_DATA *data_read;
+    INT32      results[IO_RING_ENTRIES];
+    INT32      submitted;
+    INT32      error;
+    INT32      start_time, end_time;
+    INT32      trash;
+    int        Index;
+
+    ring = (IO_RING *) calloc(1, sizeof(IO_RING));
+    data_written = (DISK_DATA *) calloc(MAX_NUMBER_OF_DISKS, sizeof(DISK_DATA));
+    data_read = (DISK_DATA *) calloc(MAX_NUMBER_OF_DISKS, sizeof(DISK_DATA));
+    if (data_read == 0)
+        printf("Something screwed up allocating space in test2j\n");
+
+    GET_PROCESS_ID("", &Z502_REG4, &Z502_REG9);
+    printf("\n\nRelease %s:Test 2j: Pid %ld\n", CURRENT_REL, Z502_REG4);
+    IO_RING_SETUP(ring, &error);
+    SuccessExpected(error, "IO_RING_SETUP");
+
+    // A write on every disk, they all run at the same time
+
+    for (Index = 0; Index < MAX_NUMBER_OF_DISKS; Index++) {
+        data_written[Index].int_data[0] = Index + 1;
+        data_written[Index].int_data[1] = TEST2J_SECTOR;
+        data_written[Index].int_data[2] = (int) Z502_REG4;
+        test2j_submit(ring, IO_RING_WRITE, Index + 1, TEST2J_SECTOR,
+                data_written[Index].char_data, Index);
+    }
+    test2j_submit(ring, IO_RING_WRITE, 0, TEST2J_SECTOR,
+            data_written[0].char_data, MAX_NUMBER_OF_DISKS);
+    test2j_submit(ring, IO_RING_READ, 1, NUM_LOGICAL_SECTORS,
+            data_read[0].char_data, MAX_NUMBER_OF_DISKS + 1);
+
+    GET_TIME_OF_DAY(&start_time);
+    test2j_reap(ring, MAX_NUMBER_OF_DISKS + TEST2J_BAD_ENTRIES, results);
+    GET_TIME_OF_DAY(&end_time);
+    printf("%d ring writes on %d disks took %d\n", MAX_NUMBER_OF_DISKS,
+            MAX_NUMBER_OF_DISKS, end_time - start_time);
+    if (end_time - start_time > TEST2J_ALL_DISKS_TIME)
+        printf("AN ERROR HAS OCCURRED.  The disks did not work together.\n");
+    for (Index = 0; Index < MAX_NUMBER_OF_DISKS; Index++) {
+        if (results[Index] != ERR_SUCCESS)
+            printf("AN ERROR HAS OCCURRED.  Write to disk %d gave %d\n",
+                    Index + 1, results[Index]);
+    }
+    ErrorExpected(results[MAX_NUMBER_OF_DISKS], "IO_RING_WRITE");
+    ErrorExpected(results[MAX_NUMBER_OF_DISKS + 1], "IO_RING_READ");
+
+    // And read back, only submitted first, then reaped
+
+    for (Index = 0; Index < MAX_NUMBER_OF_DISKS; Index++)
+        test2j_submit(ring, IO_RING_READ, Index + 1, TEST2J_SECTOR,
+                data_read[Index].char_data, Index);
+    IO_RING_ENTER(0, &submitted, &error);
+    SuccessExpected(error, "IO_RING_ENTER");
+    if (submitted != MAX_NUMBER_OF_DISKS)
+        printf("AN ERROR HAS OCCURRED.  %d entries were submitted\n", submitted);
+    test2j_reap(ring, MAX_NUMBER_OF_DISKS, results);
+    for (Index = 0; Index < MAX_NUMBER_OF_DISKS; Index++) {
+        if (results[Index] != ERR_SUCCESS
+                || memcmp(data_read[Index].char_data,
+                        data_written[Index].char_data, PGSIZE) != 0)
+            printf("AN ERROR HAS OCCURRED.  Disk %d read wrong.\n", Index + 1);
+    }
+
+    IO_RING_ENTER((IO_RING_ENTRIES + 1), &submitted, &error);
+    ErrorExpected(error, "IO_RING_ENTER");
+
+    // A child leaves reads behind when it terminates
+
+    memset(test2j_child_data, TEST2J_UNTOUCHED, sizeof(test2j_child_data));
+    CREATE_PROCESS("test2j_child", test2jx, 5, &trash, &error);
+    SuccessExpected(error, "CREATE_PROCESS");
+    SLEEP(SLEEP_TIME_2J);
+    if (memcmp(test2j_child_data[0].char_data, data_written[0].char_data,
+            PGSIZE) != 0)
+        printf("AN ERROR HAS OCCURRED.  The started read of the child is lost.\n");
+    for (Index = 1; Index < TEST2J_CHILD_READS; Index++) {
+        if (test2j_child_data[Index].char_data[0] != TEST2J_UNTOUCHED)
+            printf("AN ERROR HAS OCCURRED.  A read of the ended child ran.\n");
+    }
+
+    // The disk queues are clean again
+
+    test2j_submit(ring, IO_RING_READ, 1, TEST2J_SECTOR, data_read[0].char_data, 0);
+    test2j_reap(ring, 1, results);
+    SuccessExpected(results[0], "IO_RING_READ");
+
+    GET_TIME_OF_DAY(&end_time);
+    printf("Test2j, PID %ld, Ends at Time %d\n", Z502_REG4, end_time);
+    TERMINATE_PROCESS(-2, &Z502_REG9);
+
+}                                       // End of test2j
+
+/**************************************************************************
+
+ Test2jx is the child of test2j.  Its reads all go to disk 1, the
+ first one starts and the others wait in the queue of the disk when
+ it terminates.
+
+ **************************************************************************/
+
+void test2jx(void) {
+    INT32 submitted;
+    INT32 error;
+    int   Index;
+
+    IO_RING_SETUP(&test2j_child_ring, &error);
+    for (Index = 0; Index < TEST2J_CHILD_READS; Index++)
+        test2j_submit(&test2j_child_ring, IO_RING_READ, 1, TEST2J_SECTOR,
+                test2j_child_data[Index].char_data, Index);
+    IO_RING_ENTER(0, &submitted, &error);
+    TERMINATE_PROCESS(-1, &error);
+
+}                                       // End of test2jx
+
 /**************************************************************************
 
  get_skewed_random_number   Is a homegrown deterministic random
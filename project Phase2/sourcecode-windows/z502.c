@@ -61,6 +61,16 @@
 //#define                  DEBUG_CONDITION
 // #define                  DEBUG_USER_THREADS
 
+// Uncomment to put near-term events on a timing wheel rather than
+// keeping every pending event on the heap.
+// #define                  EVENT_SCHEDULER_WHEEL
+
+// Uncomment to keep each disk in a memory mapped image file so that what
+// is written survives from one run to the next.  Delete the files to
+// start with blank disks.
+// #define                  DISK_IMAGE_MMAP
+#define                  DISK_IMAGE_NAME   "z502disk%02d.img"
+
 #include                 "global.h"
 #include                 "syscalls.h"
 #include                 "z502.h"
@@ -80,6 +90,10 @@
 #include                 <asm/errno.h>
 #include                 <sys/time.h>
 #include                 <sys/resource.h>
+#ifdef DISK_IMAGE_MMAP
+#include                 <fcntl.h>
+#include                 <sys/mman.h>
+#endif
 #endif
 
 #ifdef MAC
@@ -88,6 +102,10 @@
 #include                 <errno.h>
 #include                 <sys/time.h>
 #include                 <sys/resource.h>
+#ifdef DISK_IMAGE_MMAP
+#include                 <fcntl.h>
+#include                 <sys/mman.h>
+#endif
 #endif
 
 //  These are routines internal to the hardware, not visible to the OS
@@ -103,9 +121,25 @@ void CreateSectorStruct(INT16, INT16, char **);
 void DequeueItemFromEventQueue(EVENT *, INT32 *);
 void DoMemoryDebug(INT16, INT16);
 void DoSleep(INT32 millisecs);
+BOOL EventBefore(EVENT *, EVENT *);
+void EventHeapInsert(EVENT_HEAP *, EVENT *);
+EVENT *EventHeapRemoveAt(EVENT_HEAP *, INT32);
+void EventHeapSiftDown(EVENT_HEAP *, INT32);
+void EventHeapSiftUp(EVENT_HEAP *, INT32);
+void EventSchedulerInit(void);
+void EventSchedulerInsert(EVENT *);
+BOOL EventSchedulerRemove(EVENT *);
+EVENT *EventSchedulerRemoveFirst(void);
+void EventSchedulerSetNextTime(void);
+#ifdef EVENT_SCHEDULER_WHEEL
+EVENT *EventWheelFirst(void);
+void EventWheelInsert(EVENT *);
+BOOL EventWheelUnlink(EVENT *);
+#endif
 int  GetLock(UINT32 RequestedMutex, char *CallingRoutine);
 void GetNextEventTime(INT32 *);
 void GetSectorStructure(INT16, INT16, char **, INT32 *);
+SECTOR *GetSectorSlab(INT16, BOOL);
 void GetNextOrderedEvent(INT32 *, INT16 *, INT16 *, INT32 *);
 int GetMyTid();
 int GetTryLock(UINT32 RequestedMutex, char *CallingRoutine);
@@ -113,13 +147,14 @@ void GoToExit(int);
 void HandleWindowsError();
 void HardwareClock(INT32 *);
 void HardwareTimer(INT32);
-void HardwareReadDisk(INT16, INT16, char *);
-void HardwareWriteDisk(INT16, INT16, char *);
+void HardwareReadDisk(INT16, INT16, INT16, char **);
+void HardwareWriteDisk(INT16, INT16, INT16, char **);
 void HardwareInterrupt(void);
 void HardwareFault(INT16, INT16);
 void HardwareInternalPanic(INT32);
 void MemoryCommon(INT32, char *, BOOL);
 void PhysicalMemoryCommon(INT32, char *, BOOL);
+UINT16 *PageTableEntry(INT16);
 void MemoryMappedIO(INT32, INT32 *, BOOL);
 void PrintRingBuffer(void);
 void PrintHardwareStats(void);
@@ -137,9 +172,11 @@ void Z502Init();
 
 //
 //      This is Physical Memory which is used in part 2 of the project. 
+//      Its size in pages is chosen when the hardware is initialized.
 //  
 
-char MEMORY[PHYS_MEM_PGS * PGSIZE ];
+char *MEMORY = NULL;
+INT32 PhysMemPages = PHYS_MEM_PGS;
 
 //
 //      Declaration of Z502 Registers                 
@@ -147,9 +184,10 @@ char MEMORY[PHYS_MEM_PGS * PGSIZE ];
 //
 
 Z502CONTEXT *Z502_CURRENT_CONTEXT;   // What Context is running
-UINT16 *Z502_PAGE_TBL_ADDR;     // Location of the page table
+UINT16 **Z502_PAGE_TBL_ADDR;    // Location of the page directory
 INT16 Z502_PAGE_TBL_LENGTH;    // Length of the page table
 INT16 Z502_MODE;               // Kernel or user - hardware only
+TLB_ENTRY SoftwareTLB[TLB_SIZE];  // Recent translations, see MemoryCommon
 
 long Z502_REG1;
 long Z502_REG2;
@@ -173,10 +211,20 @@ INT16 Z502Initialized = FALSE;
 UINT32 CurrentSimulationTime = 0;
 INT16 event_ring_buffer_index = 0;
 
-EVENT EventQueue;
+EVENT_HEAP EventHeap;
+UINT32 EventSequence = 0;
+// Time of the earliest pending event, or -1.  Written only while
+// holding EventLock, but read without it by GetNextEventTime.
+volatile INT32 NextEventTime = -1;
+#ifdef EVENT_SCHEDULER_WHEEL
+EVENT *EventWheel[EVENT_WHEEL_SIZE];
+UINT32 EventWheelMap[EVENT_WHEEL_SIZE / 32];
+INT32 EventWheelBase = 0;
+INT32 EventWheelCount = 0;
+#endif
 INT32 NumberOfInterruptsStarted = 0;
 INT32 NumberOfInterruptsCompleted = 0;
-SECTOR sector_queue[MAX_NUMBER_OF_DISKS + 1];
+SECTOR *SectorTable[MAX_NUMBER_OF_DISKS + 1]; // Slab of sectors per disk
 DISK_STATE disk_state[MAX_NUMBER_OF_DISKS + 1];
 TIMER_STATE timer_state;
 HARDWARE_STATS HardwareStats;
@@ -203,6 +251,10 @@ HANDLE LocalEvent[100];
 #if defined LINUX || defined MAC
 pthread_mutex_t LocalMutex[300];
 pthread_cond_t LocalCondition[100];
+// A pthread condition forgets a signal nobody waits for yet, these make
+// it remember one like the auto-reset event on Windows does.
+pthread_mutex_t LocalConditionMutex[100];
+int LocalConditionSignaled[100];
 int NextMutexToAllocate = 0;
 #endif
 
@@ -210,6 +262,8 @@ int NextMutexToAllocate = 0;
  MemoryCommon
 
  This code simulates a memory access.  Actions include:
+ o If the word lies within one page and the TLB holds its translation,
+ copy it straight away and skip the page table checks.
  o Take a page fault if any of the following occur;
  + Illegal virtual address,
  + Page table doesn't exist,
@@ -217,7 +271,8 @@ int NextMutexToAllocate = 0;
  + Page table entry exists, but page is invalid.
  o The page exists in physical memory, so get the physical address.
  Be careful since it may wrap across frame boundaries.
- o Copy data to/from caller's location.
+ o Copy data to/from caller's location.  Remember the translation in
+ the TLB when the word didn't cross a page.
  o Set referenced/modified bit in page table.
  o Advance time and see if an interrupt has occurred.
  *****************************************************************/
@@ -225,12 +280,13 @@ int NextMutexToAllocate = 0;
 void MemoryCommon(INT32 VirtualAddress, char *data_ptr, BOOL read_or_write) {
     INT16 VirtualPageNumber;
     INT32 phys_pg;
-    INT16 PhysicalAddress[4];
+    INT32 PhysicalAddress[4];
     INT32 page_offset;
     INT16 index;
     INT32 ptbl_bits;
     INT16 invalidity;
     BOOL page_is_valid;
+    TLB_ENTRY *tlb_ptr;
     char Debug_Text[32];
 
     strcpy(Debug_Text, "MemoryCommon");
@@ -244,6 +300,29 @@ void MemoryCommon(INT32 VirtualAddress, char *data_ptr, BOOL read_or_write) {
             (VirtualAddress >= 0) ? VirtualAddress / PGSIZE : -1);
     page_offset = VirtualAddress % PGSIZE;
 
+    tlb_ptr = NULL;
+    if (VirtualPageNumber >= 0 && page_offset <= PGSIZE - 4) {
+        tlb_ptr = &SoftwareTLB[VirtualPageNumber & (TLB_SIZE - 1)];
+        if (tlb_ptr->vpn == VirtualPageNumber
+                && tlb_ptr->page_tbl == Z502_PAGE_TBL_ADDR) {
+            HardwareStats.tlb_hits++;
+            Z502_CURRENT_CONTEXT->fault_in_progress = FALSE;
+            if (read_or_write == SYSNUM_MEM_READ) {
+                memcpy(data_ptr, &MEMORY[tlb_ptr->phys_pg * PGSIZE + page_offset],
+                        sizeof(INT32));
+                *tlb_ptr->pte |= PTBL_REFERENCED_BIT;
+            } else {
+                memcpy(&MEMORY[tlb_ptr->phys_pg * PGSIZE + page_offset], data_ptr,
+                        sizeof(INT32));
+                *tlb_ptr->pte |= PTBL_REFERENCED_BIT | PTBL_MODIFIED_BIT;
+            }
+            ChargeTimeAndCheckEvents(COST_OF_MEMORY_ACCESS);
+            ReleaseLock(HardwareLock, Debug_Text);
+            return;
+        }
+        HardwareStats.tlb_misses++;
+    }
+
     page_is_valid = FALSE;
 
     /*  Loop until the virtual page passes all the tests        */
@@ -259,8 +338,9 @@ void MemoryCommon(INT32 VirtualAddress, char *data_ptr, BOOL read_or_write) {
         if (VirtualPageNumber >= Z502_PAGE_TBL_LENGTH)
             invalidity = 4;
         if ((invalidity == 0)
-                && (Z502_PAGE_TBL_ADDR[(UINT16) VirtualPageNumber]
-                        & PTBL_VALID_BIT) == 0)
+                && (PageTableEntry(VirtualPageNumber) == NULL
+                        || (*PageTableEntry(VirtualPageNumber)
+                                & PTBL_VALID_BIT) == 0))
             invalidity = 5;
 
         DoMemoryDebug(invalidity, VirtualPageNumber);
@@ -280,8 +360,8 @@ void MemoryCommon(INT32 VirtualAddress, char *data_ptr, BOOL read_or_write) {
             page_is_valid = TRUE;
     } /* END of while         */
 
-    phys_pg = Z502_PAGE_TBL_ADDR[VirtualPageNumber] & PTBL_PHYS_PG_NO;
-    PhysicalAddress[0] = (INT16) (phys_pg * (INT32) PGSIZE + page_offset);
+    phys_pg = *PageTableEntry(VirtualPageNumber) & PTBL_PHYS_PG_NO;
+    PhysicalAddress[0] = phys_pg * (INT32) PGSIZE + page_offset;
     PhysicalAddress[1] = PhysicalAddress[0] + 1; /* first guess */
     PhysicalAddress[2] = PhysicalAddress[0] + 2; /* first guess */
     PhysicalAddress[3] = PhysicalAddress[0] + 3; /* first guess */
@@ -295,8 +375,10 @@ void MemoryCommon(INT32 VirtualAddress, char *data_ptr, BOOL read_or_write) {
                 invalidity = 6;
             if (VirtualPageNumber + 1 >= Z502_PAGE_TBL_LENGTH)
                 invalidity = 7;
-            if ((Z502_PAGE_TBL_ADDR[(UINT16) VirtualPageNumber + 1]
-                    & PTBL_VALID_BIT) == 0)
+            if ((invalidity == 0)
+                    && (PageTableEntry(VirtualPageNumber + 1) == NULL
+                            || (*PageTableEntry(VirtualPageNumber + 1)
+                                    & PTBL_VALID_BIT) == 0))
                 invalidity = 8;
             DoMemoryDebug(invalidity, (short) (VirtualPageNumber + 1));
             if (invalidity > 0) {
@@ -312,13 +394,13 @@ void MemoryCommon(INT32 VirtualAddress, char *data_ptr, BOOL read_or_write) {
                 page_is_valid = TRUE;
         } /* End of while         */
 
-        phys_pg = Z502_PAGE_TBL_ADDR[VirtualPageNumber + 1] & PTBL_PHYS_PG_NO;
+        phys_pg = *PageTableEntry(VirtualPageNumber + 1) & PTBL_PHYS_PG_NO;
         for (index = PGSIZE - (INT16) page_offset; index <= 3; index++)
-            PhysicalAddress[index] = (INT16) ((phys_pg - 1) * (INT32) PGSIZE
-                    + page_offset + (INT32) index);
+            PhysicalAddress[index] = (phys_pg - 1) * (INT32) PGSIZE
+                    + page_offset + (INT32) index;
     } /* End of if page       */
 
-    if (phys_pg < 0 || phys_pg > PHYS_MEM_PGS - 1) {
+    if (phys_pg < 0 || phys_pg > PhysMemPages - 1) {
         printf("The physical address is invalid in MemoryCommon\n");
         printf("Physical page = %d, Virtual Page = %d\n", phys_pg,
                 VirtualPageNumber);
@@ -331,6 +413,13 @@ void MemoryCommon(INT32 VirtualAddress, char *data_ptr, BOOL read_or_write) {
     }
     Z502_CURRENT_CONTEXT->fault_in_progress = FALSE;
 
+    if (tlb_ptr != NULL) {
+        tlb_ptr->page_tbl = Z502_PAGE_TBL_ADDR;
+        tlb_ptr->vpn = VirtualPageNumber;
+        tlb_ptr->phys_pg = phys_pg;
+        tlb_ptr->pte = PageTableEntry(VirtualPageNumber);
+    }
+
     if (read_or_write == SYSNUM_MEM_READ) {
         data_ptr[0] = MEMORY[PhysicalAddress[0]];
         data_ptr[1] = MEMORY[PhysicalAddress[1]];
@@ -347,15 +436,74 @@ void MemoryCommon(INT32 VirtualAddress, char *data_ptr, BOOL read_or_write) {
         ptbl_bits = PTBL_REFERENCED_BIT | PTBL_MODIFIED_BIT;
     }
 
-    Z502_PAGE_TBL_ADDR[VirtualPageNumber] |= ptbl_bits;
+    *PageTableEntry(VirtualPageNumber) |= ptbl_bits;
     if (page_offset > PGSIZE - 4)
-        Z502_PAGE_TBL_ADDR[VirtualPageNumber + 1] |= ptbl_bits;
+        *PageTableEntry(VirtualPageNumber + 1) |= ptbl_bits;
 
     ChargeTimeAndCheckEvents(COST_OF_MEMORY_ACCESS);
 
     ReleaseLock(HardwareLock, Debug_Text);
 }                      // End of MemoryCommon
 
+/*****************************************************************
+ PageTableEntry
+
+ Walk the two level page table of the running context.  The
+ directory entry of the page gives its leaf, the low bits of the
+ page give the entry in the leaf.  A missing leaf means the page
+ has no entry, and so it is invalid.
+
+ *****************************************************************/
+
+UINT16 *PageTableEntry(INT16 VirtualPageNumber) {
+    UINT16 *leaf;
+
+    leaf = Z502_PAGE_TBL_ADDR[VirtualPageNumber >> PTBL_LEAF_BITS];
+    if (leaf == NULL)
+        return NULL;
+    return &leaf[VirtualPageNumber & (PTBL_LEAF_PGS - 1)];
+}                      // End of PageTableEntry
+
+/*****************************************************************
+ Z502InvalidateTLB
+
+ The OS calls this after it makes a valid page table entry invalid
+ or points it at a different frame.  Any cached translation for
+ this virtual page is dropped, whichever page table it came from.
+ A VirtualPageNumber of -1 empties the whole TLB.
+
+ HardwareLock is not taken since the fault handler can be running
+ with MemoryCommon still holding it.  Each entry is cleared with a
+ single store.
+ *****************************************************************/
+
+void Z502InvalidateTLB(INT32 VirtualPageNumber) {
+    INT32 index;
+
+    if (VirtualPageNumber < 0) {
+        for (index = 0; index < TLB_SIZE; index++)
+            SoftwareTLB[index].vpn = -1;
+        return;
+    }
+    index = VirtualPageNumber & (TLB_SIZE - 1);
+    if (SoftwareTLB[index].vpn == VirtualPageNumber)
+        SoftwareTLB[index].vpn = -1;
+}                      // End of Z502InvalidateTLB
+
+/*****************************************************************
+ Z502ReportCacheStats
+
+ The OS keeps a buffer cache of disk sectors that the hardware
+ knows nothing about.  It hands its counters over here before it
+ halts so they are printed with the rest of the statistics.
+ *****************************************************************/
+
+void Z502ReportCacheStats(INT32 Hits, INT32 Misses, INT32 Writebacks) {
+    HardwareStats.cache_hits = Hits;
+    HardwareStats.cache_misses = Misses;
+    HardwareStats.cache_writebacks = Writebacks;
+}                      // End of Z502ReportCacheStats
+
 /*****************************************************************
  DoMemoryDebug
 
@@ -574,6 +722,7 @@ void MemoryMappedIO(INT32 address, INT32 *data, BOOL read_or_write) {
             MemoryMappedDiskState.sector = -1;
             MemoryMappedDiskState.action = -1;
             MemoryMappedDiskState.buffer = (char *) -1;
+            MemoryMappedDiskState.count = 0;
         } else {
             if (DO_DEVICE_DEBUG) {
                 printf( "------ BEGIN DO_DEVICE DEBUG - IN Z502DiskSetID ---------------- \n");
@@ -601,7 +750,22 @@ void MemoryMappedIO(INT32 address, INT32 *data, BOOL read_or_write) {
 
         break;
     }
-    case Z502DiskSetup4: {
+        /*  A count of n makes the buffer a list of n buffers for
+         *  the sectors from the one that is set on.  It goes back to
+         *  a single buffer after every start.                      */
+    case Z502DiskSetCount: {
+        if (MemoryMappedIODiskDevice != -1)
+            MemoryMappedDiskState.count = (INT16) *data;
+        else {
+            if (DO_DEVICE_DEBUG) {
+                printf(
+                        "------ BEGIN DO_DEVICE DEBUG - IN Z502DiskSetCount ------------- \n");
+                printf(
+                        "ERROR:  You must define the Device ID before setting the count\n");
+                printf(
+                        "-------- END DO_DEVICE DEBUG - ----------------------------------\n");
+            }
+        }
         break;
     }
     case Z502DiskSetAction: {
@@ -637,18 +801,23 @@ void MemoryMappedIO(INT32 address, INT32 *data, BOOL read_or_write) {
         /*  Make sure we have the state properly prepared
          *  and then do a read or write.  Clear the state. */
     case Z502DiskStart: {
+        char **buffer_list = &MemoryMappedDiskState.buffer;
+        INT16 count = 1;
+
+        if (MemoryMappedDiskState.count != 0) {
+            buffer_list = (char **) MemoryMappedDiskState.buffer;
+            count = MemoryMappedDiskState.count;
+        }
         if (*data == 0 && MemoryMappedIODiskDevice != -1
                 && MemoryMappedDiskState.action != -1
                 && MemoryMappedDiskState.buffer != (char *) -1
                 && MemoryMappedDiskState.sector != -1) {
             if (MemoryMappedDiskState.action == 0)
                 HardwareReadDisk((INT16) MemoryMappedIODiskDevice,
-                        MemoryMappedDiskState.sector,
-                        MemoryMappedDiskState.buffer);
+                        MemoryMappedDiskState.sector, count, buffer_list);
             if (MemoryMappedDiskState.action == 1)
                 HardwareWriteDisk((INT16) MemoryMappedIODiskDevice,
-                        MemoryMappedDiskState.sector,
-                        MemoryMappedDiskState.buffer);
+                        MemoryMappedDiskState.sector, count, buffer_list);
         } else {
             if (DO_DEVICE_DEBUG) {
                 printf(
@@ -666,6 +835,7 @@ void MemoryMappedIO(INT32 address, INT32 *data, BOOL read_or_write) {
         MemoryMappedDiskState.action = -1;
         MemoryMappedDiskState.buffer = (char *) -1;
         MemoryMappedDiskState.sector = -1;
+        MemoryMappedDiskState.count = 0;
         break;
     }
     case Z502DiskStatus: {
@@ -702,8 +872,8 @@ void MemoryMappedIO(INT32 address, INT32 *data, BOOL read_or_write) {
 
 void PhysicalMemoryCommon(INT32 PhysicalPageNumber, char *data_ptr,
         BOOL read_or_write) {
-    INT16 PhysicalPageAddress;
-    INT16 index;
+    INT32 PhysicalPageAddress;
+    INT32 index;
     char Debug_Text[32];
 
     strcpy(Debug_Text, "PhysicalMemoryCommon");
@@ -716,7 +886,7 @@ void PhysicalMemoryCommon(INT32 PhysicalPageNumber, char *data_ptr,
     }
     // If the user has asked for an illegal physical page, take a fault
     // then return with no modification to the user's buffer.
-    if (PhysicalPageNumber < 0 || PhysicalPageNumber > PHYS_MEM_PGS) {
+    if (PhysicalPageNumber < 0 || PhysicalPageNumber > PhysMemPages - 1) {
         ReleaseLock(HardwareLock, Debug_Text);
         HardwareFault(INVALID_PHYSICAL_MEMORY, PhysicalPageNumber);
         return;
@@ -763,26 +933,30 @@ void Z502WritePhysicalMemory(INT32 PhysicalPageNumber,
 
  HardwareReadDisk
 
- This code simulates a disk read.  Actions include:
+ This code simulates a disk read of count contiguous sectors, each
+ one into its own buffer of the list.  Actions include:
  o If not in KERNEL_MODE, then cause priv inst trap.
- o Do range check on disk_id, sector; give
+ o Do range check on disk_id, sector, count; give
  interrupt error = ERR_BAD_PARAM if illegal.
  o If an event for this disk already exists ( the disk
  is already busy ), then give interrupt error ERR_DISK_IN_USE.
- o Search for sector structure off of hashed value.
+ o Look up the sector structure, indexed by sector number.
  o If search fails give interrupt error = ERR_NO_PREVIOUS_WRITE
  o Copy data from sector to buffer.
- o From disk_state information, determine how long this request will take.
+ o From disk_state information, determine how long this request will take,
+ the seek is paid once and every further sector adds its transfer.
  o Request a future interrupt for this event.
  o Advance time and see if an interrupt has occurred.
 
  **************************************************************************/
 
-void HardwareReadDisk(INT16 disk_id, INT16 sector, char *buffer_ptr) {
+void HardwareReadDisk(INT16 disk_id, INT16 sector, INT16 count,
+        char **buffer_list) {
     INT32 local_error;
     char *sector_ptr = 0;
     INT32 access_time;
     INT16 error_found;
+    INT16 index;
 
     error_found = 0;
     // We need to be in kernel mode or be in interrupt handler
@@ -795,21 +969,30 @@ void HardwareReadDisk(INT16 disk_id, INT16 sector, char *buffer_ptr) {
         disk_id = 1; /* To aim at legal vector  */
         error_found = ERR_BAD_PARAM;
     }
-    if (sector < 0 || sector >= NUM_LOGICAL_SECTORS)
+    if (count < 1 || count > MAX_DISK_VECTOR)
+        error_found = ERR_BAD_PARAM;
+    if (sector < 0 || sector + count > NUM_DISK_SECTORS)
         error_found = ERR_BAD_PARAM;
 
     if (error_found == 0) {
-        GetSectorStructure(disk_id, sector, &sector_ptr, &local_error);
-        if (local_error != 0)
-            error_found = ERR_NO_PREVIOUS_WRITE;
+        for (index = 0; index < count; index++) {
+            GetSectorStructure(disk_id, sector + index, &sector_ptr,
+                    &local_error);
+            if (local_error != 0)
+                error_found = ERR_NO_PREVIOUS_WRITE;
+        }
 
         if (disk_state[disk_id].disk_in_use == TRUE)
             error_found = ERR_DISK_IN_USE;
     }
 
     /* If we found an error, add an event that will cause an immediate
-     hardware interrupt.                                              */
+     hardware interrupt.  The disk is busy before the event goes in,
+     an immediate event lets the interrupt thread run at once and it
+     frees the disk again.                                            */
 
+    disk_state[disk_id].disk_in_use = TRUE;
+    // printf("1. Setting %d TRUE\n", disk_id );
     if (error_found != 0) {
         if (DO_DEVICE_DEBUG) {
             printf("--- BEGIN DO_DEVICE DEBUG - IN read_disk ----- \n");
@@ -824,10 +1007,15 @@ void HardwareReadDisk(INT16 disk_id, INT16 sector, char *buffer_ptr) {
                 (INT16) (DISK_INTERRUPT + disk_id - 1), error_found,
                 &disk_state[disk_id].event_ptr);
     } else {
-        memcpy(buffer_ptr, sector_ptr, PGSIZE);
+        for (index = 0; index < count; index++) {
+            GetSectorStructure(disk_id, sector + index, &sector_ptr,
+                    &local_error);
+            memcpy(buffer_list[index], sector_ptr, PGSIZE);
+        }
 
-        access_time = CurrentSimulationTime + 100
-                + abs(disk_state[disk_id].last_sector - sector) / 20;
+        access_time = CurrentSimulationTime + DISK_ACCESS_TIME
+                + abs(disk_state[disk_id].last_sector - sector) / 20
+                + (count - 1) * DISK_SECTOR_TRANSFER_TIME;
         HardwareStats.disk_reads[disk_id]++;
         HardwareStats.time_disk_busy[disk_id] += access_time
                 - CurrentSimulationTime;
@@ -840,10 +1028,8 @@ void HardwareReadDisk(INT16 disk_id, INT16 sector, char *buffer_ptr) {
         AddEventToInterruptQueue(access_time,
                 (INT16) (DISK_INTERRUPT + disk_id - 1), (INT16) ERR_SUCCESS,
                 &disk_state[disk_id].event_ptr);
-        disk_state[disk_id].last_sector = sector;
+        disk_state[disk_id].last_sector = sector + count - 1;
     }
-    disk_state[disk_id].disk_in_use = TRUE;
-    // printf("1. Setting %d TRUE\n", disk_id );
     ChargeTimeAndCheckEvents(COST_OF_DISK_ACCESS);
 
 }               // End of HardwareReadDisk   
@@ -852,26 +1038,30 @@ void HardwareReadDisk(INT16 disk_id, INT16 sector, char *buffer_ptr) {
 
  HardwareWriteDisk
 
- This code simulates a disk write.  Actions include:
+ This code simulates a disk write of count contiguous sectors, each
+ one from its own buffer of the list.  Actions include:
  o If not in KERNEL_MODE, then cause priv inst trap.
- o Do range check on disk_id, sector; give interrupt error 
+ o Do range check on disk_id, sector, count; give interrupt error 
  = ERR_BAD_PARAM if illegal.
  o If an event for this disk already exists ( the disk is already busy ), 
  then give interrupt error ERR_DISK_IN_USE.
- o Search for sector structure off of hashed value.
+ o Look up the sector structure, indexed by sector number.
  o If search fails give create a sector on the simulated disk.
  o Copy data from buffer to sector.
- o From disk_state information, determine how long this request will take.
+ o From disk_state information, determine how long this request will take,
+ the seek is paid once and every further sector adds its transfer.
  o Request a future interrupt for this event.
  o Advance time and see if an interrupt has occurred.
 
  *****************************************************************/
 
-void HardwareWriteDisk(INT16 disk_id, INT16 sector, char *buffer_ptr) {
+void HardwareWriteDisk(INT16 disk_id, INT16 sector, INT16 count,
+        char **buffer_list) {
     INT32 local_error;
     char *sector_ptr;
     INT32 access_time;
     INT16 error_found;
+    INT16 index;
 
     error_found = 0;
     // We need to be in kernel mode or be in interrupt handler
@@ -884,12 +1074,17 @@ void HardwareWriteDisk(INT16 disk_id, INT16 sector, char *buffer_ptr) {
         disk_id = 1; /* To aim at legal vector  */
         error_found = ERR_BAD_PARAM;
     }
-    if (sector < 0 || sector >= NUM_LOGICAL_SECTORS)
+    if (count < 1 || count > MAX_DISK_VECTOR)
+        error_found = ERR_BAD_PARAM;
+    if (sector < 0 || sector + count > NUM_DISK_SECTORS)
         error_found = ERR_BAD_PARAM;
 
     if (disk_state[disk_id].disk_in_use == TRUE)
         error_found = ERR_DISK_IN_USE;
 
+    // Busy before the event goes in, see HardwareReadDisk
+    disk_state[disk_id].disk_in_use = TRUE;
+    // printf("2. Setting %d TRUE\n", disk_id );
     if (error_found != 0) {
         if (DO_DEVICE_DEBUG) {
             printf("---- BEGIN DO_DEVICE DEBUG - IN write_disk --- \n");
@@ -904,14 +1099,18 @@ void HardwareWriteDisk(INT16 disk_id, INT16 sector, char *buffer_ptr) {
                 (INT16) (DISK_INTERRUPT + disk_id - 1), error_found,
                 &disk_state[disk_id].event_ptr);
     } else {
-        GetSectorStructure(disk_id, sector, &sector_ptr, &local_error);
-        if (local_error != 0) /* No structure for this sector exists */
-            CreateSectorStruct(disk_id, sector, &sector_ptr);
+        for (index = 0; index < count; index++) {
+            GetSectorStructure(disk_id, sector + index, &sector_ptr,
+                    &local_error);
+            if (local_error != 0) /* No structure for this sector exists */
+                CreateSectorStruct(disk_id, sector + index, &sector_ptr);
 
-        memcpy(sector_ptr, buffer_ptr, PGSIZE);
+            memcpy(sector_ptr, buffer_list[index], PGSIZE);
+        }
 
-        access_time = (INT32) CurrentSimulationTime + 100
-                + abs(disk_state[disk_id].last_sector - sector) / 20;
+        access_time = (INT32) CurrentSimulationTime + DISK_ACCESS_TIME
+                + abs(disk_state[disk_id].last_sector - sector) / 20
+                + (count - 1) * DISK_SECTOR_TRANSFER_TIME;
         HardwareStats.disk_writes[disk_id]++;
         HardwareStats.time_disk_busy[disk_id] += access_time
                 - CurrentSimulationTime;
@@ -925,10 +1124,8 @@ void HardwareWriteDisk(INT16 disk_id, INT16 sector, char *buffer_ptr) {
         AddEventToInterruptQueue(access_time,
                 (INT16) (DISK_INTERRUPT + disk_id - 1), (INT16) ERR_SUCCESS,
                 &disk_state[disk_id].event_ptr);
-        disk_state[disk_id].last_sector = sector;
+        disk_state[disk_id].last_sector = sector + count - 1;
     }
-    disk_state[disk_id].disk_in_use = TRUE;
-    // printf("2. Setting %d TRUE\n", disk_id );
     ChargeTimeAndCheckEvents(COST_OF_DISK_ACCESS);
 
 }                           // End of HardwareWriteDisk   
@@ -1209,6 +1406,8 @@ void Z502DestroyContext(void **IncomingContextPointer) {
 
     (*context_ptr)->structure_id = 0;
     free(*context_ptr);
+    // Its page table may be freed and the address handed out again
+    Z502InvalidateTLB(-1);
     ReleaseLock(HardwareLock, "Z502DestroyContext");
 
 }                   // End of Z502DestroyContext
@@ -1399,7 +1598,6 @@ void ChargeTimeAndCheckEvents(INT32 time_to_charge) {
 
 void HardwareInterrupt(void) {
     INT32 time_of_event;
-    INT32 index;
     INT16 event_type;
     INT16 event_error;
     INT32 local_error;
@@ -1445,22 +1643,11 @@ void HardwareInterrupt(void) {
                 HardwareInternalPanic(ERR_Z502_INTERNAL_BUG);
             }
 
-            //  NOTE:  Here when we take a disk interrupt, we clear the busy of ALL
-            //  disks because we assume that the user will handle all of them with
-            //  the interrupt that's about to be done.
-            for (index = DISK_INTERRUPT ;
-                    index <= DISK_INTERRUPT + MAX_NUMBER_OF_DISKS - 1;
-                    index++) {
-                if ( (STAT_VECTOR[SV_ACTIVE ][index] != 0) 
-                  && (STAT_VECTOR[SV_TID    ][index] == GetMyTid()  ) ) {
-                    // Bugfix 08/2012 - disk_state contains MAX_NUMBER_OF_DISKS elements
-                    // We were spraying some unknown memory locations
-                    disk_state[index - DISK_INTERRUPT ].disk_in_use = FALSE;
-                    // printf("3. Setting %d FALSE\n", index );
-                }
-            }
-            //  We MAYBE should be clearing all these as well - and not just the current one.
-
+            //  NOTE:  Only the disk that interrupts is done.  We used to clear the
+            //  busy of ALL disks with a pending interrupt here (and one disk off at
+            //  that), so a disk still doing its I/O could be started again.  Every
+            //  disk event comes through here on its own, so each disk is freed by
+            //  its own interrupt and all of them can be busy at once.
             disk_state[event_type - DISK_INTERRUPT + 1].disk_in_use = FALSE;
             // printf("3. Setting %d FALSE\n", event_type );
             disk_state[event_type - DISK_INTERRUPT + 1].event_ptr = NULL;
@@ -1617,8 +1804,6 @@ void HardwareInternalPanic(INT32 panic_type) {
 void AddEventToInterruptQueue(INT32 time_of_event, INT16 event_type,
         INT16 event_error, EVENT **returned_event_ptr) {
     EVENT *ep;
-    EVENT *temp_ptr;
-    EVENT *last_ptr;
     INT16 erbi; /* Short for event_ring_buffer_index    */
 
     if (time_of_event < (INT32) CurrentSimulationTime) {
@@ -1640,6 +1825,8 @@ void AddEventToInterruptQueue(INT32 time_of_event, INT16 event_type,
 
     ep->queue = (INT32 *) NULL;
     ep->time_of_event = time_of_event;
+    ep->sequence = EventSequence++;
+    ep->heap_index = -1;
     ep->ring_buffer_location = event_ring_buffer_index;
     ep->structure_id = EVENT_STRUCTURE_ID;
     ep->event_type = event_type;
@@ -1654,24 +1841,8 @@ void AddEventToInterruptQueue(INT32 time_of_event, INT16 event_type,
     event_ring_buffer[erbi].event_error = event_error;
     event_ring_buffer_index = (++erbi) % EVENT_RING_BUFFER_SIZE;
 
-    temp_ptr = &EventQueue; /* The header queue  */
-    temp_ptr->time_of_event = -1;
-    last_ptr = temp_ptr;
-
-    while (1) {
-        if (temp_ptr->time_of_event > time_of_event) /* we're past */
-        {
-            ep->queue = last_ptr->queue;
-            last_ptr->queue = (INT32 *) ep;
-            break;
-        }
-        if (temp_ptr->queue == NULL ) {
-            temp_ptr->queue = (INT32 *) ep;
-            break;
-        }
-        last_ptr = temp_ptr;
-        temp_ptr = (EVENT *) temp_ptr->queue;
-    } /* End of while     */
+    EventSchedulerInsert(ep);
+    EventSchedulerSetNextTime();
     if (ReleaseLock(EventLock, "AddEvent") == FALSE)
         printf("Took error on ReleaseLock in AddEvent\n");
     // PrintEventQueue();
@@ -1712,15 +1883,14 @@ void GetNextOrderedEvent(INT32 *time_of_event, INT16 *event_type,
     INT16 rbl; /* Ring Buffer Location                */
 
     GetLock(EventLock, "get_next_ordered_ev");
-    if (EventQueue.queue == NULL ) {
+    ep = EventSchedulerRemoveFirst();
+    if (ep == NULL ) {
         *local_error = ERR_Z502_INTERNAL_BUG;
         if (ReleaseLock(EventLock, "get_next_ordered_ev") == FALSE)
             printf("Took error on ReleaseLock in GetNextOrderedEvent\n");
         return;
     }
-    ep = (EVENT *) EventQueue.queue;
-    EventQueue.queue = ep->queue;
-    ep->queue = NULL;
+    EventSchedulerSetNextTime();
 
     if (ep->structure_id != EVENT_STRUCTURE_ID) {
         printf("Bad structure id read in GetNextOrderedEvent.\n");
@@ -1748,19 +1918,29 @@ void GetNextOrderedEvent(INT32 *time_of_event, INT16 *event_type,
 
  PrintEventQueue()
 
- Print out the times that are on the event Q.
+ Print out the times that are on the event Q.  The times come out
+ in storage order, which is not necessarily the order of service.
  *****************************************************************/
 
 void PrintEventQueue() {
+    INT32 index;
+#ifdef EVENT_SCHEDULER_WHEEL
     EVENT *ep;
+#endif
 
     GetLock(EventLock, "PrintEventQueue");
     printf("Event Queue: ");
-    ep = (EVENT *) EventQueue.queue;
-    while (ep != NULL ) {
-        printf("  %d", ep->time_of_event);
-        ep = (EVENT *) ep->queue;
+#ifdef EVENT_SCHEDULER_WHEEL
+    for (index = 0; index < EVENT_WHEEL_SIZE; index++) {
+        ep = EventWheel[(EventWheelBase + index) & (EVENT_WHEEL_SIZE - 1)];
+        while (ep != NULL ) {
+            printf("  %d", ep->time_of_event);
+            ep = (EVENT *) ep->queue;
+        }
     }
+#endif
+    for (index = 0; index < EventHeap.count; index++)
+        printf("  %d", EventHeap.entry[index]->time_of_event);
     printf("  NULL\n");
     ReleaseLock(EventLock, "PrintEventQueue");
     return;
@@ -1772,17 +1952,13 @@ void PrintEventQueue() {
 
  Deque a specified item from the event queue.
  Actions include:
- o Start at the head of the queue.
- o Hunt along until we find a matching identifier.
- o Dequeue it.
- o Return the pointer to the structure to the caller.
+ o Let the event scheduler find the item and unlink it.
+ o Refresh the cached time of the next event.
 
  error not 0 means the event wasn't found;
  *****************************************************************/
 
 void DequeueItemFromEventQueue(EVENT *event_ptr, INT32 *error) {
-    EVENT *last_ptr;
-    EVENT *temp_ptr;
 
     // It's possible that HardwareTimer will call us when it
     // thinks there's a timer event, but in fact the
@@ -1799,21 +1975,9 @@ void DequeueItemFromEventQueue(EVENT *event_ptr, INT32 *error) {
 
     GetLock(EventLock, "DequeueItem");
     *error = 0;
-    temp_ptr = (EVENT *) EventQueue.queue;
-    last_ptr = &EventQueue;
-    while (1) {
-        if (temp_ptr == NULL ) {
-            *error = 1;
-            break;
-        }
-        if (temp_ptr == event_ptr) {
-            last_ptr->queue = temp_ptr->queue;
-            event_ptr->queue = (INT32 *) NULL;
-            break;
-        }
-        last_ptr = temp_ptr;
-        temp_ptr = (EVENT *) temp_ptr->queue;
-    } /* End while                */
+    if (EventSchedulerRemove(event_ptr) == FALSE)
+        *error = 1;
+    EventSchedulerSetNextTime();
     if (ReleaseLock(EventLock, "DequeueItem") == FALSE)
         printf("Took error on ReleaseLock in DequeueItem\n");
 
@@ -1826,30 +1990,262 @@ void DequeueItemFromEventQueue(EVENT *event_ptr, INT32 *error) {
  Look in the event queue.  Don't dequeue anything,
  but just read the time of the first event.
 
+ The scheduler refreshes NextEventTime every time it changes, so
+ this is a single read and needs no EventLock.  It is called on
+ every CALL() through ChargeTimeAndCheckEvents.
+
  return a -1 if there's nothing on the queue
  - the caller must check for this.
  *****************************************************************/
 
 void GetNextEventTime(INT32 *time_of_next_event) {
-    EVENT *ep;
+    *time_of_next_event = NextEventTime;
+}                   // End of GetNextEventTime    
+
+/*****************************************************************
+
+ EVENT SCHEDULER
+
+ Pending events used to sit on a linked list sorted by time, so every
+ AddEvent walked the list.  They now live on a binary heap ordered by
+ time_of_event, with the sequence number breaking ties so that events
+ for the same time are still serviced in the order they were added.
+ Insert and remove are O(log n); the earliest event is entry[0].
+
+ With EVENT_SCHEDULER_WHEEL defined, any event due within
+ EVENT_WHEEL_SIZE time units of EventWheelBase (the time of the last
+ event serviced) goes on a timing wheel with one slot per time unit.
+ Insert is O(1) and the first event is found by scanning a bitmap of
+ busy slots.  Events beyond the wheel wait on the heap and move onto
+ the wheel as EventWheelBase advances.
 
-    GetLock(EventLock, "GetNextEventTime");
-    *time_of_next_event = -1;
-    if (EventQueue.queue == NULL ) {
-        if (ReleaseLock(EventLock, "GetNextEventTime") == FALSE)
-            printf("Took error on ReleaseLock in GetNextEventTime\n");
+ All these routines must be called holding EventLock.
+ *****************************************************************/
+
+void EventSchedulerInit(void) {
+    EventHeap.size = EVENT_HEAP_INITIAL_SIZE;
+    EventHeap.count = 0;
+    EventHeap.entry = (EVENT **) calloc(EventHeap.size, sizeof(EVENT *));
+    if (EventHeap.entry == NULL ) {
+        printf("We didn't complete the calloc in EventSchedulerInit.\n");
+        HardwareInternalPanic(ERR_Z502_INTERNAL_BUG);
+    }
+#ifdef EVENT_SCHEDULER_WHEEL
+    memset(EventWheel, 0, sizeof(EventWheel));
+    memset(EventWheelMap, 0, sizeof(EventWheelMap));
+    EventWheelBase = 0;
+    EventWheelCount = 0;
+#endif
+    NextEventTime = -1;
+}                   // End of EventSchedulerInit
+
+BOOL EventBefore(EVENT *a, EVENT *b) {
+    if (a->time_of_event != b->time_of_event)
+        return (a->time_of_event < b->time_of_event);
+    return ((INT32) (a->sequence - b->sequence) < 0);
+}                   // End of EventBefore
+
+void EventHeapSiftUp(EVENT_HEAP *heap, INT32 index) {
+    EVENT *ep = heap->entry[index];
+    INT32 parent;
+
+    while (index > 0) {
+        parent = (index - 1) / 2;
+        if (EventBefore(ep, heap->entry[parent]) == FALSE)
+            break;
+        heap->entry[index] = heap->entry[parent];
+        heap->entry[index]->heap_index = index;
+        index = parent;
+    }
+    heap->entry[index] = ep;
+    ep->heap_index = index;
+}                   // End of EventHeapSiftUp
+
+void EventHeapSiftDown(EVENT_HEAP *heap, INT32 index) {
+    EVENT *ep = heap->entry[index];
+    INT32 child;
+
+    while ((child = 2 * index + 1) < heap->count) {
+        if (child + 1 < heap->count
+                && EventBefore(heap->entry[child + 1], heap->entry[child]))
+            child++;
+        if (EventBefore(heap->entry[child], ep) == FALSE)
+            break;
+        heap->entry[index] = heap->entry[child];
+        heap->entry[index]->heap_index = index;
+        index = child;
+    }
+    heap->entry[index] = ep;
+    ep->heap_index = index;
+}                   // End of EventHeapSiftDown
+
+void EventHeapInsert(EVENT_HEAP *heap, EVENT *ep) {
+    EVENT **bigger;
+
+    if (heap->count >= heap->size) {
+        bigger = (EVENT **) realloc(heap->entry,
+                2 * heap->size * sizeof(EVENT *));
+        if (bigger == NULL ) {
+            printf("We didn't complete the realloc in EventHeapInsert.\n");
+            HardwareInternalPanic(ERR_Z502_INTERNAL_BUG);
+        }
+        heap->entry = bigger;
+        heap->size *= 2;
+    }
+    heap->entry[heap->count] = ep;
+    heap->count++;
+    EventHeapSiftUp(heap, heap->count - 1);
+}                   // End of EventHeapInsert
+
+EVENT *EventHeapRemoveAt(EVENT_HEAP *heap, INT32 index) {
+    EVENT *ep = heap->entry[index];
+
+    heap->count--;
+    if (index < heap->count) {
+        heap->entry[index] = heap->entry[heap->count];
+        heap->entry[index]->heap_index = index;
+        EventHeapSiftDown(heap, index);
+        EventHeapSiftUp(heap, heap->entry[index]->heap_index);
+    }
+    ep->heap_index = -1;
+    return ep;
+}                   // End of EventHeapRemoveAt
+
+#ifdef EVENT_SCHEDULER_WHEEL
+void EventWheelInsert(EVENT *ep) {
+    INT32 slot = ep->time_of_event & (EVENT_WHEEL_SIZE - 1);
+    EVENT *tail;
+
+    // Equal times share a slot; append so they stay in FIFO order
+    ep->queue = NULL;
+    ep->heap_index = -1;
+    if (EventWheel[slot] == NULL )
+        EventWheel[slot] = ep;
+    else {
+        tail = EventWheel[slot];
+        while (tail->queue != NULL )
+            tail = (EVENT *) tail->queue;
+        tail->queue = (INT32 *) ep;
+    }
+    EventWheelMap[slot >> 5] |= (1U << (slot & 31));
+    EventWheelCount++;
+}                   // End of EventWheelInsert
+
+BOOL EventWheelUnlink(EVENT *ep) {
+    INT32 slot = ep->time_of_event & (EVENT_WHEEL_SIZE - 1);
+    EVENT *last_ptr = NULL;
+    EVENT *temp_ptr = EventWheel[slot];
+
+    while (temp_ptr != NULL && temp_ptr != ep) {
+        last_ptr = temp_ptr;
+        temp_ptr = (EVENT *) temp_ptr->queue;
+    }
+    if (temp_ptr == NULL )
+        return FALSE;
+    if (last_ptr == NULL )
+        EventWheel[slot] = (EVENT *) ep->queue;
+    else
+        last_ptr->queue = ep->queue;
+    ep->queue = NULL;
+    if (EventWheel[slot] == NULL )
+        EventWheelMap[slot >> 5] &= ~(1U << (slot & 31));
+    EventWheelCount--;
+    return TRUE;
+}                   // End of EventWheelUnlink
+
+// Every event on the wheel is within EVENT_WHEEL_SIZE of the base, so
+// the first busy slot at or after the base holds the earliest one.
+EVENT *EventWheelFirst(void) {
+    INT32 index;
+    INT32 slot;
+
+    if (EventWheelCount == 0)
+        return NULL;
+    for (index = 0; index < EVENT_WHEEL_SIZE;) {
+        slot = (EventWheelBase + index) & (EVENT_WHEEL_SIZE - 1);
+        if (EventWheelMap[slot >> 5] == 0) {
+            index += 32 - (slot & 31);
+            continue;
+        }
+        if (EventWheel[slot] != NULL )
+            return EventWheel[slot];
+        index++;
+    }
+    return NULL;
+}                   // End of EventWheelFirst
+#endif
+
+void EventSchedulerInsert(EVENT *ep) {
+#ifdef EVENT_SCHEDULER_WHEEL
+    if (ep->time_of_event >= EventWheelBase
+            && ep->time_of_event < EventWheelBase + EVENT_WHEEL_SIZE) {
+        EventWheelInsert(ep);
         return;
     }
-    ep = (EVENT *) EventQueue.queue;
-    if (ep->structure_id != EVENT_STRUCTURE_ID) {
-        printf("Bad structure id read in GetNextEventTime.\n");
+#endif
+    EventHeapInsert(&EventHeap, ep);
+}                   // End of EventSchedulerInsert
+
+BOOL EventSchedulerRemove(EVENT *ep) {
+    if (ep->heap_index >= 0 && ep->heap_index < EventHeap.count
+            && EventHeap.entry[ep->heap_index] == ep) {
+        EventHeapRemoveAt(&EventHeap, ep->heap_index);
+        return TRUE;
+    }
+#ifdef EVENT_SCHEDULER_WHEEL
+    return EventWheelUnlink(ep);
+#else
+    return FALSE;
+#endif
+}                   // End of EventSchedulerRemove
+
+EVENT *EventSchedulerRemoveFirst(void) {
+    EVENT *ep = NULL;
+#ifdef EVENT_SCHEDULER_WHEEL
+    EVENT *wheel_ep = EventWheelFirst();
+
+    if (EventHeap.count > 0
+            && (wheel_ep == NULL || EventBefore(EventHeap.entry[0], wheel_ep)))
+        ep = EventHeapRemoveAt(&EventHeap, 0);
+    else if (wheel_ep != NULL )
+        EventWheelUnlink(ep = wheel_ep);
+    if (ep == NULL )
+        return NULL;
+
+    // Nothing pending is earlier than ep, so the wheel can turn forward
+    // to it.  Then pull in heap events that now fit on the wheel.
+    if (ep->time_of_event > EventWheelBase)
+        EventWheelBase = ep->time_of_event;
+    while (EventHeap.count > 0
+            && EventHeap.entry[0]->time_of_event >= EventWheelBase
+            && EventHeap.entry[0]->time_of_event
+                    < EventWheelBase + EVENT_WHEEL_SIZE)
+        EventWheelInsert(EventHeapRemoveAt(&EventHeap, 0));
+#else
+    if (EventHeap.count > 0)
+        ep = EventHeapRemoveAt(&EventHeap, 0);
+#endif
+    return ep;
+}                   // End of EventSchedulerRemoveFirst
+
+void EventSchedulerSetNextTime(void) {
+    EVENT *ep = NULL;
+#ifdef EVENT_SCHEDULER_WHEEL
+    EVENT *wheel_ep = EventWheelFirst();
+#endif
+
+    if (EventHeap.count > 0)
+        ep = EventHeap.entry[0];
+#ifdef EVENT_SCHEDULER_WHEEL
+    if (wheel_ep != NULL && (ep == NULL || EventBefore(wheel_ep, ep)))
+        ep = wheel_ep;
+#endif
+    if (ep != NULL && ep->structure_id != EVENT_STRUCTURE_ID) {
+        printf("Bad structure id read in EventSchedulerSetNextTime.\n");
         HardwareInternalPanic(ERR_Z502_INTERNAL_BUG);
     }
-    *time_of_next_event = ep->time_of_event;
-    if (ReleaseLock(EventLock, "GetNextEventTime") == FALSE)
-        printf("Took error on ReleaseLock in GetNextEventTime\n");
-
-}                   // End of GetNextEventTime    
+    NextEventTime = (ep == NULL) ? -1 : ep->time_of_event;
+}                   // End of EventSchedulerSetNextTime
 
 /*****************************************************************
 
@@ -1881,6 +2277,19 @@ void PrintHardwareStats(void) {
         printf("Context Switches = %5d:  ", HardwareStats.context_switches);
     printf("CALLS = %5d:  ", HardwareStats.number_charge_times);
     printf("Masks = %5d\n", HardwareStats.number_mask_set_seen);
+    if (HardwareStats.tlb_hits + HardwareStats.tlb_misses > 0)
+        printf("TLB Hits = %5d:  TLB Misses = %5d\n", HardwareStats.tlb_hits,
+                HardwareStats.tlb_misses);
+    if (HardwareStats.number_faults > 0
+            && HardwareStats.tlb_hits + HardwareStats.tlb_misses > 0)
+        printf("Faults per 1000 references = %8.3f\n",
+                (double) HardwareStats.number_faults * 1000.0
+                        / (double) (HardwareStats.tlb_hits
+                                + HardwareStats.tlb_misses));
+    if (HardwareStats.cache_hits + HardwareStats.cache_misses > 0)
+        printf("Cache Hits = %5d:  Cache Misses = %5d:  Cache Writebacks = %5d\n",
+                HardwareStats.cache_hits, HardwareStats.cache_misses,
+                HardwareStats.cache_writebacks);
 
 }               // End of PrintHardwareStats   
 /*****************************************************************
@@ -1940,8 +2349,12 @@ void PrintRingBuffer(void) {
  Determine if the requested sector exists, and if so hand back the
  location in memory where we've stashed data for this sector.
 
+ Each disk owns one slab of NUM_DISK_SECTORS sectors, indexed
+ directly by sector number.  A sector has been written if its
+ structure_id is set; the slab is calloc'd so unwritten ones are 0.
+
  Actions include:
- o Hunt along the sector data until we find the appropriate sector.
+ o Index into the slab for this disk.
  o Return the address of the sector data.
 
  Error not 0 means the structure wasn't found.  This means that
@@ -1953,38 +2366,30 @@ void GetSectorStructure(INT16 disk_id, INT16 sector, char **sector_ptr,
         INT32 *error) {
     SECTOR *temp_ptr;
 
+    *error = 1;
+    if (GetSectorSlab(disk_id, FALSE) == NULL )
+        return;
+    temp_ptr = &SectorTable[disk_id][sector];
+    if (temp_ptr->structure_id != SECTOR_STRUCTURE_ID)
+        return;
+    if (temp_ptr->sector != sector) {
+        printf("Bad sector number read in GetSectorStructure.\n");
+        HardwareInternalPanic(ERR_Z502_INTERNAL_BUG);
+    }
+    *sector_ptr = (temp_ptr->sector_data);
     *error = 0;
-    temp_ptr = (SECTOR *) sector_queue[disk_id].queue;
-    while (1) {
-        if (temp_ptr == NULL ) {
-            *error = 1;
-            break;
-        }
-
-        if (temp_ptr->structure_id != SECTOR_STRUCTURE_ID) {
-            printf("Bad structure id read in GetSectorStructure.\n");
-            HardwareInternalPanic(ERR_Z502_INTERNAL_BUG);
-        }
-
-        if (temp_ptr->sector == sector) {
-            *sector_ptr = (temp_ptr->sector_data);
-            break;
-        }
-        temp_ptr = (SECTOR *) temp_ptr->queue;
-    }        // End while
 }                // End GetSectorStructure
 
 /*****************************************************************
 
  CreateSectorStruct()
 
- This is the routine that will create a sector structure and add it
- to the list of valid sectors.
+ This is the routine that will mark a sector as written and hand
+ back its data area.
 
  Actions include:
- o Allocate a structure for the event.
+ o Get the slab for this disk, allocating it if need be.
  o Fill in the structure.
- o Enqueue it.
  o Pass back the pointer to the sector data.
 
  WARNING: NO CHECK is made to ensure a structure for this sector
@@ -1995,23 +2400,98 @@ void GetSectorStructure(INT16 disk_id, INT16 sector, char **sector_ptr,
 void CreateSectorStruct(INT16 disk_id, INT16 sector, char **returned_sector_ptr) {
     SECTOR *ssp;
 
-    ssp = (SECTOR *) malloc(sizeof(SECTOR));
-    if (ssp == NULL ) {
-        printf("We didn't complete the malloc in CreateSectorStruct.\n");
-        printf("A malloc returned with a NULL pointer.\n");
-        HardwareInternalPanic(ERR_OS502_GENERATED_BUG);
-    }
+    ssp = &GetSectorSlab(disk_id, TRUE)[sector];
     ssp->structure_id = SECTOR_STRUCTURE_ID;
     ssp->disk_id = disk_id;
     ssp->sector = sector;
     *returned_sector_ptr = (ssp->sector_data);
 
-    /* Enqueue this new structure on the HEAD of the queue for this disk   */
-    ssp->queue = sector_queue[disk_id].queue;
-    sector_queue[disk_id].queue = (INT32 *) ssp;
-
 }                                    // End of CreateSectorStruct
 
+/*****************************************************************
+
+ GetSectorSlab()
+
+ Hand back the slab of sectors for this disk.
+
+ Normally the slab lives in memory and is only allocated when the
+ disk is first written (create is TRUE); until then NULL is returned.
+
+ With DISK_IMAGE_MMAP the slab is a shared mapping of the image file
+ for this disk, created at full size if it doesn't exist yet.  Sector
+ writes go straight to the file, and a later run that maps the same
+ file sees everything that was written, including which sectors have
+ never been written.
+ *****************************************************************/
+
+SECTOR *GetSectorSlab(INT16 disk_id, BOOL create) {
+#ifdef DISK_IMAGE_MMAP
+    char file_name[32];
+    size_t slab_size = NUM_DISK_SECTORS * sizeof(SECTOR);
+#ifdef NT
+    HANDLE file_handle;
+    HANDLE map_handle;
+#endif
+#if defined LINUX || defined MAC
+    int fd;
+    void *map_ptr;
+#endif
+#endif
+
+    if (SectorTable[disk_id] != NULL )
+        return (SectorTable[disk_id]);
+#ifdef DISK_IMAGE_MMAP
+    sprintf(file_name, DISK_IMAGE_NAME, disk_id);
+#ifdef NT
+    file_handle = CreateFileA(file_name, GENERIC_READ | GENERIC_WRITE, 0,
+            NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file_handle == INVALID_HANDLE_VALUE) {
+        printf("Unable to open disk image %s in GetSectorSlab.\n", file_name);
+        HardwareInternalPanic(ERR_OS502_GENERATED_BUG);
+    }
+    map_handle = CreateFileMappingA(file_handle, NULL, PAGE_READWRITE, 0,
+            (DWORD) slab_size, NULL);
+    // The view keeps the mapping alive, so both handles can go now
+    if (map_handle != NULL ) {
+        SectorTable[disk_id] = (SECTOR *) MapViewOfFile(map_handle,
+                FILE_MAP_ALL_ACCESS, 0, 0, slab_size);
+        CloseHandle(map_handle);
+    }
+    CloseHandle(file_handle);
+#endif
+#if defined LINUX || defined MAC
+    fd = open(file_name, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        printf("Unable to open disk image %s in GetSectorSlab.\n", file_name);
+        HardwareInternalPanic(ERR_OS502_GENERATED_BUG);
+    }
+    // Grows a new file to full size; the new space reads back as zeros
+    if (ftruncate(fd, (off_t) slab_size) == 0) {
+        map_ptr = mmap(NULL, slab_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                fd, 0);
+        if (map_ptr != MAP_FAILED)
+            SectorTable[disk_id] = (SECTOR *) map_ptr;
+    }
+    close(fd);
+#endif
+    if (SectorTable[disk_id] == NULL ) {
+        printf("Unable to map disk image %s in GetSectorSlab.\n", file_name);
+        HardwareInternalPanic(ERR_OS502_GENERATED_BUG);
+    }
+#else
+    if (create == FALSE)
+        return (NULL);
+    SectorTable[disk_id] = (SECTOR *) calloc(NUM_DISK_SECTORS,
+            sizeof(SECTOR));
+    if (SectorTable[disk_id] == NULL ) {
+        printf("We didn't complete the calloc in GetSectorSlab.\n");
+        printf("A calloc returned with a NULL pointer.\n");
+        HardwareInternalPanic(ERR_OS502_GENERATED_BUG);
+    }
+#endif
+    return (SectorTable[disk_id]);
+}                                    // End of GetSectorSlab
+
 /**************************************************************************
  **************************************************************************
  THREAD MANAGER
@@ -2915,6 +3395,10 @@ void CreateCondition(UINT32 *RequestedCondition) {
     *RequestedCondition = -1;
     ConditionReturn
     = pthread_cond_init( &(LocalCondition[NextConditionToAllocate]), NULL );
+    if ( ConditionReturn == 0 )
+    ConditionReturn = pthread_mutex_init(
+            &(LocalConditionMutex[NextConditionToAllocate]), NULL );
+    LocalConditionSignaled[NextConditionToAllocate] = FALSE;
 
     if ( ConditionReturn == EAGAIN || ConditionReturn == ENOMEM )
     printf( "PANIC in CreateCondition - No System Resources\n");
@@ -2964,10 +3448,15 @@ int WaitForCondition(UINT32 Condition, UINT32 Mutex, INT32 WaitTime,
 //            printf("WaitForCondition:  %d %d %d\n", Mutex, 
 //                    (int)LocalMutex[Mutex], GetMyTid() );
 //        }
-    pthread_mutex_lock( &(LocalMutex[Mutex]) );
+    // The signal may have come before we got here - then don't wait at all.
+    pthread_mutex_lock( &(LocalConditionMutex[Condition]) );
+    ConditionReturn = 0;
+    while ( LocalConditionSignaled[Condition] == FALSE && ConditionReturn == 0 )
     ConditionReturn
     = pthread_cond_wait( &(LocalCondition[Condition]),
-            &(LocalMutex[Mutex]) );
+            &(LocalConditionMutex[Condition]) );
+    LocalConditionSignaled[Condition] = FALSE;
+    pthread_mutex_unlock( &(LocalConditionMutex[Condition]) );
     if ( ConditionReturn == EINVAL )
     printf( "In WaitForCondition, An illegal argument value was found\n");
     if ( ConditionReturn == EPERM )
@@ -3019,8 +3508,11 @@ int SignalCondition(UINT32 Condition, char* CallingRoutine) {
 #endif
 #if defined LINUX || defined MAC
 
+    pthread_mutex_lock( &(LocalConditionMutex[Condition]) );
+    LocalConditionSignaled[Condition] = TRUE;
     ConditionReturn
     = pthread_cond_signal( &(LocalCondition[Condition]) );
+    pthread_mutex_unlock( &(LocalConditionMutex[Condition]) );
     if ( ConditionReturn == EINVAL || ConditionReturn == EFAULT )
     printf( "In SignalCondition, An illegal value or status was found\n");
     if ( ConditionReturn == 0 )
@@ -3088,6 +3580,8 @@ void GoToExit(int Value) {
 
 void Z502Init() {
     INT16 i;
+    INT32 byte;
+    char *pages;
 
     if (Z502Initialized == FALSE) {
     // Show that we've been in this code.
@@ -3095,7 +3589,7 @@ void Z502Init() {
 
         printf("This is Simulation Version %s and Hardware Version %s.\n\n",
                 CURRENT_REL, HARDWARE_VERSION);
-        EventQueue.queue = NULL;
+        EventSchedulerInit();
         BaseTid = GetMyTid();
         CreateLock(&EventLock, "Z502Init");
         CreateLock(&InterruptLock, "Z502Init");
@@ -3103,7 +3597,7 @@ void Z502Init() {
         CreateLock(&ThreadTableLock, "Z502Init");
         CreateCondition(&InterruptCondition);
         for (i = 1; i < MAX_NUMBER_OF_DISKS ; i++) {
-            sector_queue[i].queue = NULL;
+            SectorTable[i] = NULL;
             disk_state[i].last_sector = 0;
             disk_state[i].disk_in_use = FALSE;
             disk_state[i].event_ptr = NULL;
@@ -3115,6 +3609,9 @@ void Z502Init() {
         HardwareStats.number_charge_times = 0;
         HardwareStats.number_faults = 0;
         HardwareStats.number_mask_set_seen = 0;
+        HardwareStats.tlb_hits = 0;
+        HardwareStats.tlb_misses = 0;
+        Z502InvalidateTLB(-1);
 
         for (i = 0; i <= LARGEST_STAT_VECTOR_INDEX; i++) {
             STAT_VECTOR[SV_ACTIVE ][i] = 0;
@@ -3123,8 +3620,22 @@ void Z502Init() {
         for (i = 0; i < MEMORY_INTERLOCK_SIZE; i++)
             InterlockRecord[i] = -1;
 
-        for (i = 0; i < sizeof(MEMORY); i++)
-            MEMORY[i] = i % 256;
+        pages = getenv("Z502_PHYS_MEM_PGS");
+        if (pages != NULL) {
+            PhysMemPages = atoi(pages);
+            if (PhysMemPages < 1 || PhysMemPages > MAX_PHYS_MEM_PGS) {
+                printf("Z502_PHYS_MEM_PGS must be 1 to %d, using %d pages\n",
+                        MAX_PHYS_MEM_PGS, PHYS_MEM_PGS);
+                PhysMemPages = PHYS_MEM_PGS;
+            }
+        }
+        MEMORY = (char *) malloc(PhysMemPages * PGSIZE);
+        if (MEMORY == NULL) {
+            printf("We didn't complete the malloc in Z502Init.\n");
+            HardwareInternalPanic(ERR_Z502_INTERNAL_BUG);
+        }
+        for (byte = 0; byte < PhysMemPages * PGSIZE; byte++)
+            MEMORY[byte] = byte % 256;
 
         timer_state.timer_in_use = FALSE;
         timer_state.event_ptr = NULL;
@@ -33,6 +33,13 @@
 #define         COST_OF_CPU_INSTRUCTION         1L
 #define         COST_OF_CALL                    2L
 
+/*  A disk request takes DISK_ACCESS_TIME plus the seek, and a request
+    of several sectors adds DISK_SECTOR_TRANSFER_TIME for each sector
+    after the first, so the seek is paid once.                        */
+
+#define         DISK_ACCESS_TIME                100L
+#define         DISK_SECTOR_TRANSFER_TIME       10L
+
 #ifndef NULL
 #define         NULL                            0
 #endif
@@ -43,6 +50,21 @@
 
 #define         EVENT_RING_BUFFER_SIZE          16
 
+/*  The event scheduler keeps pending events in a binary heap.  When
+    EVENT_SCHEDULER_WHEEL is defined in z502.c, events that fall within
+    EVENT_WHEEL_SIZE time units of the last serviced event go on a
+    timing wheel instead, and only far-off events use the heap.   */
+
+#define         EVENT_HEAP_INITIAL_SIZE         32
+#define         EVENT_WHEEL_SIZE                256     // Power of 2
+
+/*  MemoryCommon caches virtual to physical translations in a small
+    direct mapped TLB.  Entries are tagged with the page table they
+    came from, and the OS drops them with Z502InvalidateTLB whenever
+    it takes a valid page away.                                     */
+
+#define         TLB_SIZE                        16      // Power of 2
+
 /*  STAT_VECTOR is a two dimensional array.  The first
     dimension can take on values shown here.  The
     second dimension holds the error or device type.     */
@@ -57,12 +79,21 @@ typedef struct
     {
     INT32               *queue;
     INT32               time_of_event;
+    UINT32              sequence;       // Keeps equal times in FIFO order
+    INT32               heap_index;     // -1 when not on a heap
     INT16               ring_buffer_location;
     INT16               event_error;
     INT16               event_type;
     unsigned char       structure_id;
 } EVENT;
 
+typedef struct
+    {
+    EVENT               **entry;
+    INT32               count;
+    INT32               size;
+} EVENT_HEAP;
+
 /* Supports history which is dumped on a hardware panic */
 
 typedef struct
@@ -84,11 +115,23 @@ typedef struct
     INT32               number_charge_times;
     INT32               number_mask_set_seen;
     INT32               number_faults;
+    INT32               tlb_hits;
+    INT32               tlb_misses;
+    INT32               cache_hits;        // reported by the OS buffer cache
+    INT32               cache_misses;
+    INT32               cache_writebacks;
 } HARDWARE_STATS;
 
 typedef struct
     {
-    INT32               *queue;
+    UINT16              **page_tbl;
+    INT32               vpn;               // -1 when the entry is empty
+    INT32               phys_pg;
+    UINT16              *pte;              // the entry in its leaf, for the R and M bits
+} TLB_ENTRY;
+
+typedef struct
+    {
     INT16               structure_id;
     INT16               disk_id;
     INT16               sector;
@@ -99,7 +142,7 @@ typedef struct
     {
     unsigned char       structure_id;
     void                *entry;
-    UINT16              *page_table_ptr;
+    UINT16              **page_table_ptr;
     INT16               page_table_len;
     INT16               pc;
     INT32               call_type;
@@ -143,6 +186,7 @@ typedef struct
     INT16               sector;
     INT16               action;
     char                *buffer;
+    INT16               count;             // 0 for one buffer, else buffer is a list of count
 } MEMORY_MAPPED_DISK_STATE;
 
 typedef struct